@@ -0,0 +1,183 @@
+#include "include/batch.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+struct batch {
+    const struct batch_ops *ops;
+    char **inputs;
+    char **outputs; // Output path of each input
+    size_t count;
+    const char *out_dir;
+    size_t next; // Next input to hand out
+};
+
+// What one thread got through
+struct batch_worker {
+    struct batch *batch;
+    pthread_t thread;
+    bool started;
+    size_t done, failed;
+    uint64_t in_bytes, out_bytes;
+};
+
+static uint64_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+// out_dir/name with the extension of the input's file name replaced
+static char *output_path(const char *out_dir, const char *input, const char *extension) {
+    const char *name = strrchr(input, '/');
+    name = name ? name + 1 : input;
+    const char *dot = strrchr(name, '.');
+    size_t stem = dot && dot != name ? (size_t)(dot - name) : strlen(name);
+    size_t size = strlen(out_dir) + 1 + stem + strlen(extension) + 1;
+    char *path = malloc(size);
+    if (path) snprintf(path, size, "%s/%.*s%s", out_dir, (int)stem, name, extension);
+    return path;
+}
+
+static void *batch_worker(void *arg) {
+    struct batch_worker *w = arg;
+    struct batch *b = w->batch;
+    void *state = NULL;
+    size_t i;
+    while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->count) {
+        const char *input = b->inputs[i];
+        const char *output = b->outputs[i];
+        if (b->ops->convert(&state, input, output, b->ops->ctx) != 0) {
+            w->failed++;
+        } else {
+            w->done++;
+            w->in_bytes += file_size(input);
+            w->out_bytes += file_size(output);
+        }
+    }
+    if (state) b->ops->free_state(state);
+    return NULL;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(**(char *const *const *)a, **(char *const *const *)b);
+}
+
+// Names every output up front. Inputs with the same file name in different
+// directories would be written to the same file by two threads at once, so
+// those are refused. Returns the paths, or NULL after printing an error.
+static char **output_paths(const struct batch_ops *ops, char **inputs, size_t count, const char *out_dir) {
+    char **outputs = calloc(count + 1, sizeof(*outputs));
+    char ***sorted = calloc(count + 1, sizeof(*sorted));
+    bool ok = outputs && sorted;
+    for (size_t i = 0; ok && i < count; i++) {
+        ok = (outputs[i] = output_path(out_dir, inputs[i], ops->extension)) != NULL;
+        sorted[i] = &outputs[i];
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: out of memory\n");
+    } else {
+        qsort(sorted, count, sizeof(*sorted), compare_paths);
+        for (size_t i = 1; i < count; i++) {
+            if (strcmp(*sorted[i - 1], *sorted[i]) == 0) {
+                fprintf(stderr, "Error: %s and %s would both be written to %s\n", inputs[sorted[i - 1] - outputs], inputs[sorted[i] - outputs], *sorted[i]);
+                ok = false;
+            }
+        }
+    }
+    free(sorted);
+    if (!ok) {
+        batch_free_paths(outputs, count);
+        return NULL;
+    }
+    return outputs;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int batch_run(const struct batch_ops *ops, char **inputs, size_t count, const char *out_dir, int jobs) {
+    char **outputs = output_paths(ops, inputs, count, out_dir);
+    if (!outputs) return -1;
+    if (mkdir(out_dir, 0755) == -1 && errno != EEXIST) {
+        perror("Error creating output directory");
+        batch_free_paths(outputs, count);
+        return -1;
+    }
+    if (jobs <= 0) jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if ((size_t)jobs > count) jobs = count > 0 ? count : 1;
+    struct batch_worker *workers = calloc(jobs, sizeof(*workers));
+    if (!workers) {
+        fprintf(stderr, "Error: out of memory\n");
+        batch_free_paths(outputs, count);
+        return -1;
+    }
+    struct batch b = {ops, inputs, outputs, count, out_dir, 0};
+    double start = now();
+    // This thread takes files too, so a pool that can't grow still finishes
+    for (int i = 0; i < jobs; i++) {
+        workers[i].batch = &b;
+        if (i > 0) workers[i].started = pthread_create(&workers[i].thread, NULL, batch_worker, &workers[i]) == 0;
+    }
+    batch_worker(&workers[0]);
+    struct batch_worker total = {0};
+    for (int i = 0; i < jobs; i++) {
+        if (workers[i].started) pthread_join(workers[i].thread, NULL);
+        total.done += workers[i].done;
+        total.failed += workers[i].failed;
+        total.in_bytes += workers[i].in_bytes;
+        total.out_bytes += workers[i].out_bytes;
+    }
+    double elapsed = now() - start;
+    free(workers);
+    batch_free_paths(outputs, count);
+
+    printf("Converted %zu of %zu files in %.3f s on %d threads: %.1f files/s, %.1f MB/s in, %.1f MB/s out\n", total.done, count, elapsed, jobs,
+           total.done / elapsed, total.in_bytes / elapsed / 1e6, total.out_bytes / elapsed / 1e6);
+    if (total.failed > 0) printf("%zu file%s failed\n", total.failed, total.failed == 1 ? "" : "s");
+    return total.failed;
+}
+
+char **batch_read_paths(FILE *file, size_t *count) {
+    char **paths = NULL;
+    size_t capacity = 0;
+    *count = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, file)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) line[--length] = '\0';
+        if (length == 0) continue;
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = realloc(paths, capacity * sizeof(*paths));
+            if (!grown) break;
+            paths = grown;
+        }
+        if (!(paths[*count] = strdup(line))) break;
+        (*count)++;
+    }
+    bool complete = feof(file);
+    free(line);
+    if (!complete) {
+        batch_free_paths(paths, *count);
+        return NULL;
+    }
+    // An empty list is still a list
+    return paths ? paths : malloc(1);
+}
+
+void batch_free_paths(char **paths, size_t count) {
+    if (!paths) return;
+    for (size_t i = 0; i < count; i++) free(paths[i]);
+    free(paths);
+}
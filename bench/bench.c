@@ -0,0 +1,452 @@
+// Micro benchmarks for the hot paths of FBTools. Results are printed as JSON
+// so they can be compared between releases. Blits run against a virtual
+// framebuffer file, so no /dev/fb0 is needed.
+#include <getopt.h>
+#include <linux/fb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/blit.h"
+#include "../include/brush.h"
+#include "../include/fb_device.h"
+#include "../include/fbimg_file.h"
+#include "../include/pixconv.h"
+#include "../include/png_write.h"
+#include "../include/scale_img.h"
+#include "../thirdparty/lodepng/lodepng.h"
+
+static double min_time = 0.5; // Seconds each benchmark runs for at least
+static const char *filter = NULL;
+static bool first_result = true;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs fn until min_time has passed and prints the mean and fastest run.
+// pixels is the number of pixels one run processes.
+static void run(const char *name, double pixels, void (*fn)(void *), void *arg) {
+    if (filter && !strstr(name, filter)) return;
+    fn(arg); // Warm up caches and lazily initialized state
+    long iterations = 0;
+    double best = 1e30, start = now(), end = start;
+    while (end - start < min_time || iterations < 3) {
+        double t = now();
+        fn(arg);
+        end = now();
+        if (end - t < best) best = end - t;
+        iterations++;
+    }
+    double mean = (end - start) / iterations;
+    printf("%s\n    {\"name\": \"%s\", \"iterations\": %ld, \"mean_ns\": %.0f, \"best_ns\": %.0f, \"mpix_per_s\": %.2f}", first_result ? "" : ",", name, iterations, mean * 1e9, best * 1e9, pixels / best / 1e6);
+    first_result = false;
+    fflush(stdout);
+}
+
+// RGB888 test image with gradients, flat areas and text-like noise, so both
+// the scaler and the run-length coder see realistic input
+static char *make_image(int width, int height) {
+    char *image = malloc((size_t)width * height * 3);
+    uint32_t seed = 1;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t *p = (uint8_t *)image + ((size_t)y * width + x) * 3;
+            if (y < height / 8) {
+                p[0] = 40, p[1] = 44, p[2] = 52;
+            } else if (x < width / 4) {
+                p[0] = x * 255 / width, p[1] = y * 255 / height, p[2] = 128;
+            } else {
+                seed = seed * 1103515245 + 12345;
+                uint8_t v = (seed >> 16) % 8 == 0 ? 20 : 235;
+                p[0] = p[1] = p[2] = v;
+            }
+        }
+    }
+    return image;
+}
+
+struct scale_args {
+    char *image;
+    int width, height, new_width, new_height, threads;
+};
+
+static void bench_scale(void *arg) {
+    struct scale_args *a = arg;
+    free(scale_image(a->image, false, a->width, a->height, a->new_width, a->new_height));
+}
+
+static void bench_scale_mt(void *arg) {
+    struct scale_args *a = arg;
+    free(scale_image_mt(a->image, false, a->width, a->height, a->new_width, a->new_height, a->threads));
+}
+
+static void scale_benchmarks(void) {
+    static const int sizes[][4] = {
+        {640, 480, 1280, 960},
+        {1280, 720, 1920, 1080},
+        {1920, 1080, 1280, 720},
+        {1920, 1080, 640, 360},
+        {3840, 2160, 1920, 1080},
+    };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        struct scale_args a = {make_image(sizes[i][0], sizes[i][1]), sizes[i][0], sizes[i][1], sizes[i][2], sizes[i][3], 0};
+        const char *direction = sizes[i][2] > sizes[i][0] ? "up" : "down";
+        char name[96];
+        snprintf(name, sizeof(name), "scale_%s_%dx%d_to_%dx%d", direction, a.width, a.height, a.new_width, a.new_height);
+        run(name, (double)a.new_width * a.new_height, bench_scale, &a);
+        snprintf(name, sizeof(name), "scale_mt_%s_%dx%d_to_%dx%d", direction, a.width, a.height, a.new_width, a.new_height);
+        run(name, (double)a.new_width * a.new_height, bench_scale_mt, &a);
+        free(a.image);
+    }
+}
+
+struct convert_args {
+    uint8_t *src, *dst;
+    size_t count;
+};
+
+static void bench_rgb_to_bgr(void *arg) {
+    struct convert_args *a = arg;
+    pixconv_rgb_to_bgr(a->dst, a->src, a->count);
+}
+
+static void bench_rgb_to_rgba(void *arg) {
+    struct convert_args *a = arg;
+    pixconv_rgb_to_rgba(a->dst, a->src, a->count);
+}
+
+static void bench_rgba_to_rgb(void *arg) {
+    struct convert_args *a = arg;
+    pixconv_rgba_to_rgb(a->dst, a->src, a->count);
+}
+
+static void bench_rgb_to_xrgb(void *arg) {
+    struct convert_args *a = arg;
+    pixconv_rgb_to_xrgb((uint32_t *)a->dst, a->src, a->count, 0xFF);
+}
+
+static void bench_xrgb_to_rgb(void *arg) {
+    struct convert_args *a = arg;
+    pixconv_xrgb_to_rgb(a->dst, (const uint32_t *)a->src, a->count);
+}
+
+static void convert_benchmarks(void) {
+    struct convert_args a = {malloc(1920 * 1080 * 4), malloc(1920 * 1080 * 4), 1920 * 1080};
+    char *image = make_image(1920, 1080);
+    memcpy(a.src, image, a.count * 3);
+    run("convert_rgb_to_bgr_1920x1080", a.count, bench_rgb_to_bgr, &a);
+    run("convert_rgb_to_rgba_1920x1080", a.count, bench_rgb_to_rgba, &a);
+    run("convert_rgb_to_xrgb_1920x1080", a.count, bench_rgb_to_xrgb, &a);
+    pixconv_rgb_to_rgba(a.src, (const uint8_t *)image, a.count);
+    run("convert_rgba_to_rgb_1920x1080", a.count, bench_rgba_to_rgb, &a);
+    run("convert_xrgb_to_rgb_1920x1080", a.count, bench_xrgb_to_rgb, &a);
+    free(image);
+    free(a.src);
+    free(a.dst);
+}
+
+struct load_args {
+    const char *path;
+};
+
+static void bench_load(void *arg) {
+    struct load_args *a = arg;
+    struct fbimg img;
+    if (fbimg_open(a->path, &img) != FBIMG_OK) return;
+    char *decoded = NULL;
+    const char *pixels = img.pixels;
+    if (img.flags & FBIMG_FLAG_RLE) pixels = decoded = fbimg_decode(&img);
+    // Touch every page like a real consumer would
+    volatile uint8_t sum = 0;
+    size_t size = (size_t)img.width * img.height * fbimg_format_bpp(img.format);
+    for (size_t i = 0; pixels && i < size; i += 4096) sum += pixels[i];
+    free(decoded);
+    fbimg_close(&img);
+}
+
+// Writes image to a temporary .fbimg file and returns its path
+static char *write_fbimg(const char *image, int width, int height, uint32_t flags) {
+    char *path = strdup("/tmp/fbtools-bench-XXXXXX");
+    int fd = mkstemp(path);
+    FILE *file = fdopen(fd, "wb");
+    struct fbimg_writer writer;
+    fbimg_writer_open(&writer, file, width, height, FBIMG_FORMAT_RGB888, width * 3, flags);
+    for (int y = 0; y < height; y++) fbimg_writer_row(&writer, image + (size_t)y * width * 3);
+    fbimg_writer_free(&writer);
+    fclose(file);
+    return path;
+}
+
+static void load_benchmarks(void) {
+    char *image = make_image(1920, 1080);
+    char *raw = write_fbimg(image, 1920, 1080, 0);
+    char *rle = write_fbimg(image, 1920, 1080, FBIMG_FLAG_RLE);
+    struct load_args a = {raw};
+    run("fbimg_load_1920x1080", 1920 * 1080, bench_load, &a);
+    a.path = rle;
+    run("fbimg_load_rle_1920x1080", 1920 * 1080, bench_load, &a);
+    unlink(raw);
+    unlink(rle);
+    free(raw);
+    free(rle);
+    free(image);
+}
+
+struct png_args {
+    unsigned char *rgba;
+    unsigned char *png;
+    size_t png_size;
+    unsigned width, height;
+};
+
+static void bench_png_encode(void *arg) {
+    struct png_args *a = arg;
+    unsigned char *png;
+    size_t size;
+    if (lodepng_encode32(&png, &size, a->rgba, a->width, a->height) == 0) free(png);
+}
+
+static void bench_png_decode(void *arg) {
+    struct png_args *a = arg;
+    unsigned char *rgba;
+    unsigned width, height;
+    if (lodepng_decode32(&rgba, &width, &height, a->png, a->png_size) == 0) free(rgba);
+}
+
+struct png_write_args {
+    const char *rgb;
+    const char *path;
+    int threads;
+};
+
+static void bench_png_write(void *arg) {
+    struct png_write_args *a = arg;
+    png_write_rgb(a->path, a->rgb, 1280, 720, 1, a->threads);
+}
+
+static void png_benchmarks(void) {
+    struct png_args a = {malloc(1280 * 720 * 4), NULL, 0, 1280, 720};
+    char *image = make_image(a.width, a.height);
+    pixconv_rgb_to_rgba(a.rgba, (const uint8_t *)image, (size_t)a.width * a.height);
+    lodepng_encode32(&a.png, &a.png_size, a.rgba, a.width, a.height);
+    run("png_encode_1280x720", a.width * a.height, bench_png_encode, &a);
+    run("png_decode_1280x720", a.width * a.height, bench_png_decode, &a);
+    char path[] = "/tmp/fbtools-bench-XXXXXX";
+    close(mkstemp(path));
+    struct png_write_args w = {image, path, 1};
+    run("png_write_bands_1t_1280x720", a.width * a.height, bench_png_write, &w);
+    w.threads = 0;
+    run("png_write_bands_mt_1280x720", a.width * a.height, bench_png_write, &w);
+    unlink(path);
+    free(a.png);
+    free(a.rgba);
+    free(image);
+}
+
+// Creates and maps a temporary virtual framebuffer in the layout of format
+static int fake_fb_open(struct fb_device *fb, int format, int xres, int yres) {
+    struct fb_var_screeninfo vinfo = {0};
+    fbimg_format_vinfo(format, &vinfo);
+    vinfo.xres = vinfo.xres_virtual = xres;
+    vinfo.yres = vinfo.yres_virtual = yres;
+    char path[] = "/tmp/fbtools-bench-fb-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) return -1;
+    close(fd);
+    int result = fb_device_create(path, &vinfo);
+    if (result == 0) result = fb_device_open(fb, path, true);
+    unlink(path);
+    if (result == 0 && fb_device_map(fb) == -1) {
+        fb_device_close(fb);
+        result = -1;
+    }
+    return result;
+}
+
+struct blit_args {
+    struct fb_device *fb;
+    struct blitter blitter;
+    const char *src;
+    size_t stride;
+    int width, height;
+    const struct fbimg *img;
+};
+
+static void bench_blit(void *arg) {
+    struct blit_args *a = arg;
+    blit_image(&a->blitter, a->fb->ptr, a->fb->finfo.line_length, 0, 0, a->src, a->stride, a->width, a->height);
+}
+
+static void bench_blit_fbimg(void *arg) {
+    struct blit_args *a = arg;
+    blit_fbimg(&a->blitter, a->fb->ptr, a->fb->finfo.line_length, 0, 0, a->img);
+}
+
+static void bench_blit_read(void *arg) {
+    struct blit_args *a = arg;
+    blit_read_image(&a->blitter, a->fb->ptr, a->fb->finfo.line_length, 0, 0, (char *)a->src, a->stride, a->width, a->height);
+}
+
+static void blit_benchmarks(int format, int width, int height) {
+    char *image = make_image(width, height);
+    char *rle = write_fbimg(image, width, height, FBIMG_FLAG_RLE);
+    struct fbimg img;
+    fbimg_open(rle, &img);
+
+    struct fb_device fb;
+    if (fake_fb_open(&fb, format, width, height) != 0) {
+        perror("Error creating virtual framebuffer");
+    } else {
+        size_t line_length = fb.finfo.line_length;
+        const char *layout = fb_layout_name(fb_detect_layout(&fb.vinfo));
+        struct blit_args a = {&fb, {0}, image, (size_t)width * 3, width, height, &img};
+        char name[96];
+
+        blit_init(&a.blitter, &fb.vinfo, FBIMG_FORMAT_RGB888);
+        snprintf(name, sizeof(name), "blit_rgb888_to_%s_%dx%d", layout, width, height);
+        run(name, (double)width * height, bench_blit, &a);
+        snprintf(name, sizeof(name), "blit_rle_rgb888_to_%s_%dx%d", layout, width, height);
+        run(name, (double)width * height, bench_blit_fbimg, &a);
+
+        // Same layout as the framebuffer, one memcpy per row
+        char *native = malloc(fb.size);
+        blit_image(&a.blitter, native, line_length, 0, 0, image, (size_t)width * 3, width, height);
+        blit_init(&a.blitter, &fb.vinfo, format);
+        a.src = native;
+        a.stride = line_length;
+        snprintf(name, sizeof(name), "blit_native_to_%s_%dx%d", layout, width, height);
+        run(name, (double)width * height, bench_blit, &a);
+
+        // An overlay that is mostly transparent, with an opaque bar and
+        // half transparent stripes
+        uint32_t *overlay = malloc((size_t)width * height * 4);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                uint32_t alpha = y < height / 8 ? 255 : (x + y) % 64 < 8 ? 128 : 0;
+                overlay[(size_t)y * width + x] = alpha << 24 | (alpha / 2) << 16 | alpha / 4;
+            }
+        }
+        blit_init(&a.blitter, &fb.vinfo, FBIMG_FORMAT_ARGB8888);
+        a.src = (const char *)overlay;
+        a.stride = (size_t)width * 4;
+        snprintf(name, sizeof(name), "blit_argb8888_over_%s_%dx%d", layout, width, height);
+        run(name, (double)width * height, bench_blit, &a);
+
+        char *readback = malloc((size_t)width * height * 3);
+        blit_init(&a.blitter, &fb.vinfo, FBIMG_FORMAT_RGB888);
+        a.src = readback;
+        a.stride = (size_t)width * 3;
+        snprintf(name, sizeof(name), "blit_read_%s_to_rgb888_%dx%d", layout, width, height);
+        run(name, (double)width * height, bench_blit_read, &a);
+
+        free(readback);
+        free(overlay);
+        free(native);
+        fb_device_close(&fb);
+    }
+    fbimg_close(&img);
+    unlink(rle);
+    free(rle);
+    free(image);
+}
+
+struct stroke_args {
+    struct fb_device *fb;
+    struct brush brush;
+};
+
+static void count_span(void *ctx, int y, int x0, int x1) {
+    (void)y;
+    *(double *)ctx += x1 - x0;
+}
+
+// A zigzag of short segments, like a fast mouse stroke at 1 kHz. With count
+// set only the pixels are counted.
+static void stroke(struct stroke_args *a, double *count) {
+    struct raster_clip clip = {0, 0, a->fb->vinfo.xres, a->fb->vinfo.yres};
+    int x = 100, y = 300;
+    for (int i = 0; i < 256; i++) {
+        int nx = x + 6, ny = (i / 16) % 2 ? y - 5 : y + 5;
+        if (count)
+            raster_capsule(x, y, nx, ny, &a->brush.disc, &clip, count_span, count);
+        else
+            brush_stroke(&a->brush, a->fb->ptr, a->fb->finfo.line_length, x, y, nx, ny, &clip);
+        x = nx, y = ny;
+    }
+}
+
+static void bench_stroke(void *arg) {
+    stroke(arg, NULL);
+}
+
+static void stroke_benchmarks(int format) {
+    static const int sizes[] = {3, 30, 240};
+    struct fb_device fb;
+    if (fake_fb_open(&fb, format, 1920, 1080) != 0) {
+        perror("Error creating virtual framebuffer");
+        return;
+    }
+    const char color[3] = {0x20, 0x80, 0xFF};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        struct stroke_args a = {&fb};
+        brush_init(&a.brush, &fb.vinfo, sizes[i], color);
+        double pixels = 0;
+        stroke(&a, &pixels);
+        char name[96];
+        snprintf(name, sizeof(name), "stroke_%s_size_%d_256_segments", fb_layout_name(fb_detect_layout(&fb.vinfo)), sizes[i]);
+        run(name, pixels, bench_stroke, &a);
+        brush_free(&a.brush);
+    }
+    fb_device_close(&fb);
+}
+
+int main(int argc, char *argv[]) {
+    const struct option long_options[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"filter", required_argument, NULL, 'f'},
+        {"min-time", required_argument, NULL, 't'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "hf:t:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'h':
+                printf("Usage: %s [options]\n", argv[0]);
+                printf("Options:\n");
+                printf("  -h, --help        Show this help message\n");
+                printf("  -f, --filter      Only run benchmarks whose name contains the given text\n");
+                printf("  -t, --min-time    Seconds to run each benchmark for (default 0.5)\n");
+                return 0;
+            case 'f':
+                filter = optarg;
+                break;
+            case 't':
+                min_time = atof(optarg);
+                break;
+            default:
+                fprintf(stderr, "Unknown option: %c\n", opt);
+                return 1;
+        }
+    }
+
+    printf("{\n  \"pixconv_backend\": \"%s\",\n  \"cpus\": %ld,\n  \"min_time_s\": %g,\n  \"results\": [", pixconv_backend(), sysconf(_SC_NPROCESSORS_ONLN), min_time);
+    scale_benchmarks();
+    convert_benchmarks();
+    load_benchmarks();
+    png_benchmarks();
+    blit_benchmarks(FBIMG_FORMAT_XRGB8888, 1920, 1080);
+    blit_benchmarks(FBIMG_FORMAT_BGR888, 1920, 1080);
+    blit_benchmarks(FBIMG_FORMAT_RGB565, 1920, 1080);
+    blit_benchmarks(FBIMG_FORMAT_XRGB8888, 7680, 4320);
+    stroke_benchmarks(FBIMG_FORMAT_XRGB8888);
+    stroke_benchmarks(FBIMG_FORMAT_RGB565);
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,376 @@
+#include "include/blit.h"
+
+#include <linux/fb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/fbimg_file.h"
+#include "include/pixconv.h"
+
+static void row_copy(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width) {
+    memcpy(dst, src, (size_t)width * 3);
+}
+
+static void row_swap24(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width) {
+    pixconv_rgb_to_bgr(dst, src, width);
+}
+
+static void row_xrgb_from_rgb(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width) {
+    pixconv_rgb_to_xrgb((uint32_t *)dst, src, width, b->fill >> 24);
+}
+
+static void row_xrgb_from_bgr(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width) {
+    pixconv_bgr_to_xrgb((uint32_t *)dst, src, width, b->fill >> 24);
+}
+
+static void row_bgrx_from_rgb(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width) {
+    uint32_t *out = (uint32_t *)dst;
+    uint32_t fill = b->fill;
+    for (int i = 0; i < width; i++, src += 3) {
+        out[i] = fill | (uint32_t)src[2] << 24 | (uint32_t)src[1] << 16 | (uint32_t)src[0] << 8;
+    }
+}
+
+static void row_bgrx_from_bgr(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width) {
+    uint32_t *out = (uint32_t *)dst;
+    uint32_t fill = b->fill;
+    for (int i = 0; i < width; i++, src += 3) {
+        out[i] = fill | (uint32_t)src[0] << 24 | (uint32_t)src[1] << 16 | (uint32_t)src[2] << 8;
+    }
+}
+
+static void row_generic32(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width) {
+    uint32_t *out = (uint32_t *)dst;
+    uint32_t fill = b->fill;
+    int s0 = b->shift[0], s1 = b->shift[1], s2 = b->shift[2];
+    for (int i = 0; i < width; i++, src += 3) {
+        out[i] = fill | (uint32_t)src[0] << s0 | (uint32_t)src[1] << s1 | (uint32_t)src[2] << s2;
+    }
+}
+
+static void row_rgb565_from_rgb(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width) {
+    uint16_t *out = (uint16_t *)dst;
+    for (int i = 0; i < width; i++, src += 3) {
+        out[i] = (uint16_t)((src[0] >> 3) << 11 | (src[1] >> 2) << 5 | src[2] >> 3);
+    }
+}
+
+static void row_rgb565_from_bgr(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width) {
+    uint16_t *out = (uint16_t *)dst;
+    for (int i = 0; i < width; i++, src += 3) {
+        out[i] = (uint16_t)((src[2] >> 3) << 11 | (src[1] >> 2) << 5 | src[0] >> 3);
+    }
+}
+
+// Read kernels: dst is packed 3-byte pixels, src is a framebuffer row
+static void read_rgb_from_xrgb(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width) {
+    pixconv_xrgb_to_rgb(dst, (const uint32_t *)src, width);
+}
+
+static void read_bgr_from_xrgb(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width) {
+    pixconv_xrgb_to_bgr(dst, (const uint32_t *)src, width);
+}
+
+static void read_rgb_from_bgrx(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width) {
+    const uint32_t *in = (const uint32_t *)src;
+    for (int i = 0; i < width; i++, dst += 3) {
+        dst[0] = in[i] >> 8;
+        dst[1] = in[i] >> 16;
+        dst[2] = in[i] >> 24;
+    }
+}
+
+static void read_generic32(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width) {
+    const uint32_t *in = (const uint32_t *)src;
+    int s0 = b->shift[0], s1 = b->shift[1], s2 = b->shift[2];
+    for (int i = 0; i < width; i++, dst += 3) {
+        dst[0] = in[i] >> s0;
+        dst[1] = in[i] >> s1;
+        dst[2] = in[i] >> s2;
+    }
+}
+
+static void read_rgb565(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width) {
+    const uint16_t *in = (const uint16_t *)src;
+    int first = b->bgr ? 2 : 0;
+    for (int i = 0; i < width; i++, dst += 3) {
+        uint8_t red = in[i] >> 11, green = (in[i] >> 5) & 0x3F, blue = in[i] & 0x1F;
+        dst[first] = red << 3 | red >> 2;
+        dst[1] = green << 2 | green >> 4;
+        dst[2 - first] = blue << 3 | blue >> 2;
+    }
+}
+
+static bool is_channel(const struct fb_bitfield *field, int offset, int length) {
+    return field->offset == offset && field->length == length;
+}
+
+enum fb_layout fb_detect_layout(const struct fb_var_screeninfo *vinfo) {
+    const struct fb_bitfield *red = &vinfo->red;
+    const struct fb_bitfield *green = &vinfo->green;
+    const struct fb_bitfield *blue = &vinfo->blue;
+
+    if (vinfo->bits_per_pixel == 16) {
+        if (is_channel(red, 11, 5) && is_channel(green, 5, 6) && is_channel(blue, 0, 5)) return FB_LAYOUT_RGB565;
+        return FB_LAYOUT_UNSUPPORTED;
+    }
+    if (red->length != 8 || green->length != 8 || blue->length != 8) return FB_LAYOUT_UNSUPPORTED;
+    if (red->offset % 8 != 0 || green->offset % 8 != 0 || blue->offset % 8 != 0) return FB_LAYOUT_UNSUPPORTED;
+
+    if (vinfo->bits_per_pixel == 24) {
+        if (is_channel(red, 16, 8) && is_channel(green, 8, 8) && is_channel(blue, 0, 8)) return FB_LAYOUT_RGB888;
+        if (is_channel(red, 0, 8) && is_channel(green, 8, 8) && is_channel(blue, 16, 8)) return FB_LAYOUT_BGR888;
+        return FB_LAYOUT_UNSUPPORTED;
+    }
+    if (vinfo->bits_per_pixel == 32) {
+        if (red->offset > 24 || green->offset > 24 || blue->offset > 24) return FB_LAYOUT_UNSUPPORTED;
+        if (is_channel(red, 16, 8) && is_channel(green, 8, 8) && is_channel(blue, 0, 8)) {
+            return vinfo->transp.length > 0 ? FB_LAYOUT_ARGB8888 : FB_LAYOUT_XRGB8888;
+        }
+        if (is_channel(red, 8, 8) && is_channel(green, 16, 8) && is_channel(blue, 24, 8)) return FB_LAYOUT_BGRX8888;
+        return FB_LAYOUT_GENERIC32;
+    }
+    return FB_LAYOUT_UNSUPPORTED;
+}
+
+const char *fb_layout_name(enum fb_layout layout) {
+    switch (layout) {
+        case FB_LAYOUT_XRGB8888:
+            return "XRGB8888";
+        case FB_LAYOUT_ARGB8888:
+            return "ARGB8888";
+        case FB_LAYOUT_BGRX8888:
+            return "BGRX8888";
+        case FB_LAYOUT_GENERIC32:
+            return "32 bpp";
+        case FB_LAYOUT_RGB888:
+            return "RGB888";
+        case FB_LAYOUT_BGR888:
+            return "BGR888";
+        case FB_LAYOUT_RGB565:
+            return "RGB565";
+        default:
+            return "unsupported";
+    }
+}
+
+int fb_layout_format(enum fb_layout layout) {
+    switch (layout) {
+        case FB_LAYOUT_XRGB8888:
+        case FB_LAYOUT_ARGB8888:
+            return FBIMG_FORMAT_XRGB8888;
+        case FB_LAYOUT_BGRX8888:
+            return FBIMG_FORMAT_BGRX8888;
+        case FB_LAYOUT_RGB888:
+            return FBIMG_FORMAT_BGR888;
+        case FB_LAYOUT_BGR888:
+            return FBIMG_FORMAT_RGB888;
+        case FB_LAYOUT_RGB565:
+            return FBIMG_FORMAT_RGB565;
+        default:
+            return -1;
+    }
+}
+
+static void set_channel(struct fb_bitfield *field, int offset, int length) {
+    field->offset = offset;
+    field->length = length;
+}
+
+void fbimg_format_vinfo(int format, struct fb_var_screeninfo *vinfo) {
+    vinfo->bits_per_pixel = fbimg_format_bpp(format) * 8;
+    set_channel(&vinfo->transp, 0, 0);
+    switch (format) {
+        case FBIMG_FORMAT_RGB888:
+            set_channel(&vinfo->red, 0, 8);
+            set_channel(&vinfo->green, 8, 8);
+            set_channel(&vinfo->blue, 16, 8);
+            break;
+        case FBIMG_FORMAT_BGR888:
+        case FBIMG_FORMAT_XRGB8888:
+            set_channel(&vinfo->red, 16, 8);
+            set_channel(&vinfo->green, 8, 8);
+            set_channel(&vinfo->blue, 0, 8);
+            break;
+        case FBIMG_FORMAT_ARGB8888:
+            set_channel(&vinfo->transp, 24, 8);
+            set_channel(&vinfo->red, 16, 8);
+            set_channel(&vinfo->green, 8, 8);
+            set_channel(&vinfo->blue, 0, 8);
+            break;
+        case FBIMG_FORMAT_BGRX8888:
+            set_channel(&vinfo->red, 8, 8);
+            set_channel(&vinfo->green, 16, 8);
+            set_channel(&vinfo->blue, 24, 8);
+            break;
+        case FBIMG_FORMAT_RGB565:
+            set_channel(&vinfo->red, 11, 5);
+            set_channel(&vinfo->green, 5, 6);
+            set_channel(&vinfo->blue, 0, 5);
+            break;
+    }
+}
+
+int blit_init(struct blitter *b, const struct fb_var_screeninfo *vinfo, int format) {
+    memset(b, 0, sizeof(*b));
+    b->layout = fb_detect_layout(vinfo);
+    b->bytes_per_pixel = vinfo->bits_per_pixel / 8;
+    b->xres = vinfo->xres;
+    b->format = format;
+    b->src_bpp = fbimg_format_bpp(format);
+    b->direct = fb_layout_format(b->layout) == format;
+    b->blend = format == FBIMG_FORMAT_ARGB8888;
+    // Other formats are unpacked to RGB888 before going through the row kernels
+    bool bgr = format == FBIMG_FORMAT_BGR888;
+    b->bgr = bgr;
+    if (format == FBIMG_FORMAT_XRGB8888 || format == FBIMG_FORMAT_ARGB8888) b->unpack_row = read_rgb_from_xrgb;
+    if (format == FBIMG_FORMAT_BGRX8888) b->unpack_row = read_rgb_from_bgrx;
+    if (format == FBIMG_FORMAT_RGB565) b->unpack_row = read_rgb565;
+
+    const struct fb_bitfield *first = bgr ? &vinfo->blue : &vinfo->red;
+    const struct fb_bitfield *last = bgr ? &vinfo->red : &vinfo->blue;
+    b->shift[0] = first->offset;
+    b->shift[1] = vinfo->green.offset;
+    b->shift[2] = last->offset;
+    b->fill = ~(0xFFu << b->shift[0] | 0xFFu << b->shift[1] | 0xFFu << b->shift[2]);
+
+    switch (b->layout) {
+        case FB_LAYOUT_XRGB8888:
+        case FB_LAYOUT_ARGB8888:
+            b->row = bgr ? row_xrgb_from_bgr : row_xrgb_from_rgb;
+            b->read_row = bgr ? read_bgr_from_xrgb : read_rgb_from_xrgb;
+            break;
+        case FB_LAYOUT_BGRX8888:
+            b->row = bgr ? row_bgrx_from_bgr : row_bgrx_from_rgb;
+            b->read_row = read_generic32;
+            break;
+        case FB_LAYOUT_GENERIC32:
+            b->row = row_generic32;
+            b->read_row = read_generic32;
+            break;
+        case FB_LAYOUT_RGB888:
+            b->row = bgr ? row_copy : row_swap24;
+            b->read_row = b->row;
+            break;
+        case FB_LAYOUT_BGR888:
+            b->row = bgr ? row_swap24 : row_copy;
+            b->read_row = b->row;
+            break;
+        case FB_LAYOUT_RGB565:
+            b->row = bgr ? row_rgb565_from_bgr : row_rgb565_from_rgb;
+            b->read_row = read_rgb565;
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+// Composites premultiplied ARGB8888 rows over the framebuffer. 32 bpp XRGB
+// and ARGB pixels are blended in place, other layouts are read back and
+// expanded to XRGB words first.
+static void blend_image(const struct blitter *b, uint8_t *dst, size_t line_length, const uint8_t *row, size_t src_stride, int width, int height) {
+    bool in_place = b->layout == FB_LAYOUT_XRGB8888 || b->layout == FB_LAYOUT_ARGB8888;
+    for (int i = 0; i < height; i++, dst += line_length, row += src_stride) {
+        if (in_place) {
+            pixconv_blend_argb((uint32_t *)dst, (const uint32_t *)row, width);
+            continue;
+        }
+        uint8_t rgb[BLIT_CHUNK * 3];
+        uint32_t pixels[BLIT_CHUNK];
+        for (int done = 0; done < width; done += BLIT_CHUNK) {
+            int count = width - done < BLIT_CHUNK ? width - done : BLIT_CHUNK;
+            uint8_t *out = dst + (size_t)done * b->bytes_per_pixel;
+            b->read_row(b, rgb, out, count);
+            pixconv_rgb_to_xrgb(pixels, rgb, count, 0xFF);
+            pixconv_blend_argb(pixels, (const uint32_t *)row + done, count);
+            pixconv_xrgb_to_rgb(rgb, pixels, count);
+            b->row(b, out, rgb, count);
+        }
+    }
+}
+
+void blit_image(const struct blitter *b, char *fb_ptr, size_t line_length, int x, int y, const char *src, size_t src_stride, int width, int height) {
+    uint8_t *dst = (uint8_t *)fb_ptr + (size_t)y * line_length + (size_t)x * b->bytes_per_pixel;
+    const uint8_t *row = (const uint8_t *)src;
+    size_t row_size = (size_t)width * b->bytes_per_pixel;
+    if (height <= 0) return;
+
+    if (b->blend) {
+        blend_image(b, dst, line_length, row, src_stride, width, height);
+        return;
+    }
+    if (b->direct) {
+        // Full-width images with a matching stride are one contiguous block
+        if (x == 0 && width == b->xres && src_stride == line_length) {
+            memcpy(dst, row, (size_t)(height - 1) * line_length + row_size);
+            return;
+        }
+        for (int i = 0; i < height; i++, dst += line_length, row += src_stride) memcpy(dst, row, row_size);
+        return;
+    }
+
+    if (b->unpack_row) {
+        uint8_t rgb[BLIT_CHUNK * 3];
+        for (int i = 0; i < height; i++, dst += line_length, row += src_stride) {
+            for (int done = 0; done < width; done += BLIT_CHUNK) {
+                int count = width - done < BLIT_CHUNK ? width - done : BLIT_CHUNK;
+                b->unpack_row(b, rgb, row + (size_t)done * b->src_bpp, count);
+                b->row(b, dst + (size_t)done * b->bytes_per_pixel, rgb, count);
+            }
+        }
+        return;
+    }
+
+    for (int i = 0; i < height; i++, dst += line_length, row += src_stride) b->row(b, dst, row, width);
+}
+
+int blit_fbimg(const struct blitter *b, char *fb_ptr, size_t line_length, int x, int y, const struct fbimg *img) {
+    if (!(img->flags & FBIMG_FLAG_RLE)) {
+        blit_image(b, fb_ptr, line_length, x, y, img->pixels, img->stride, img->width, img->height);
+        return 0;
+    }
+
+    char *dst = fb_ptr + (size_t)y * line_length + (size_t)x * b->bytes_per_pixel;
+    char *scratch = NULL;
+    if (!b->direct) {
+        scratch = malloc((size_t)img->width * b->src_bpp);
+        if (!scratch) return -1;
+    }
+    struct fbimg_rows rows;
+    fbimg_rows_begin(img, &rows);
+    for (uint32_t i = 0; i < img->height; i++, dst += line_length) {
+        const char *row = fbimg_rows_next(&rows, b->direct ? dst : scratch);
+        if (!row) {
+            free(scratch);
+            return -1;
+        }
+        if (!b->direct) blit_image(b, dst, line_length, 0, 0, row, 0, img->width, 1);
+    }
+    free(scratch);
+    return 0;
+}
+
+void blit_read_image(const struct blitter *b, const char *fb_ptr, size_t line_length, int x, int y, char *dst, size_t dst_stride, int width, int height) {
+    const uint8_t *src = (const uint8_t *)fb_ptr + (size_t)y * line_length + (size_t)x * b->bytes_per_pixel;
+    uint8_t *row = (uint8_t *)dst;
+    for (int i = 0; i < height; i++) {
+        b->read_row(b, row, src, width);
+        src += line_length;
+        row += dst_stride;
+    }
+}
+
+char *blit_convert_to_rgb(const char *src, size_t src_stride, int format, int width, int height) {
+    char *rgb = malloc((size_t)width * height * 3);
+    if (!rgb) return NULL;
+    // Read the source back as if it were a framebuffer in its own layout
+    struct fb_var_screeninfo vinfo = {0};
+    fbimg_format_vinfo(format, &vinfo);
+    struct blitter b;
+    blit_init(&b, &vinfo, FBIMG_FORMAT_RGB888);
+    blit_read_image(&b, src, src_stride, 0, 0, rgb, (size_t)width * 3, width, height);
+    return rgb;
+}
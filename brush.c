@@ -0,0 +1,82 @@
+#include "include/brush.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "include/pixconv.h"
+
+struct span_target {
+    const struct brush *brush;
+    char *fb_ptr;
+    size_t line_length;
+};
+
+static void fill_span(void *ctx, int y, int x0, int x1) {
+    const struct span_target *t = ctx;
+    const struct brush *brush = t->brush;
+    int bpp = brush->bytes_per_pixel;
+    uint8_t *dst = (uint8_t *)t->fb_ptr + (size_t)y * t->line_length + (size_t)x0 * bpp;
+    size_t count = x1 - x0;
+    if (bpp == 4 && ((uintptr_t)dst & 3) == 0) {
+        pixconv_fill32((uint32_t *)dst, brush->word, count);
+        return;
+    }
+    if (bpp == 2 && ((uintptr_t)dst & 1) == 0) {
+        // One leading pixel puts the rest on a 32-bit boundary
+        if (((uintptr_t)dst & 3) != 0 && count > 0) {
+            memcpy(dst, brush->pixel, 2);
+            dst += 2;
+            count--;
+        }
+        pixconv_fill32((uint32_t *)dst, brush->word, count / 2);
+        if (count & 1) memcpy(dst + (count - 1) * 2, brush->pixel, 2);
+        return;
+    }
+    // Anything else: copy the filled part onto the rest, doubling each time
+    if (count == 0) return;
+    size_t size = count * bpp, done = bpp;
+    memcpy(dst, brush->pixel, bpp);
+    while (done < size) {
+        size_t n = done < size - done ? done : size - done;
+        memcpy(dst + done, dst, n);
+        done += n;
+    }
+}
+
+int brush_init(struct brush *brush, const struct fb_var_screeninfo *vinfo, int size, const char color[3]) {
+    memset(brush, 0, sizeof(*brush));
+    if (blit_init(&brush->blitter, vinfo, FBIMG_FORMAT_RGB888) != 0) return -1;
+    brush->bytes_per_pixel = brush->blitter.bytes_per_pixel;
+    brush_set_color(brush, color);
+    return brush_set_size(brush, size);
+}
+
+int brush_set_size(struct brush *brush, int size) {
+    int radius = size / 2;
+    if (brush->disc.extent && brush->disc.radius == radius) return 0;
+    // Keep the old size if the new one can't be set up
+    struct raster_disc disc;
+    if (raster_disc_init(&disc, radius) != 0) return -1;
+    raster_disc_free(&brush->disc);
+    brush->disc = disc;
+    return 0;
+}
+
+void brush_set_color(struct brush *brush, const char color[3]) {
+    brush->blitter.row(&brush->blitter, brush->pixel, (const uint8_t *)color, 1);
+    if (brush->bytes_per_pixel == 4) {
+        memcpy(&brush->word, brush->pixel, 4);
+    } else if (brush->bytes_per_pixel == 2) {
+        memcpy(&brush->word, brush->pixel, 2);
+        memcpy((uint8_t *)&brush->word + 2, brush->pixel, 2);
+    }
+}
+
+void brush_free(struct brush *brush) {
+    raster_disc_free(&brush->disc);
+}
+
+void brush_stroke(const struct brush *brush, char *fb_ptr, size_t line_length, int x0, int y0, int x1, int y1, const struct raster_clip *clip) {
+    struct span_target target = {brush, fb_ptr, line_length};
+    raster_capsule(x0, y0, x1, y1, &brush->disc, clip, fill_span, &target);
+}
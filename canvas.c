@@ -0,0 +1,103 @@
+#include "include/canvas.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/fbimg_file.h"
+
+int canvas_format(const struct fb_var_screeninfo *vinfo) {
+    int format = fb_layout_format(fb_detect_layout(vinfo));
+    if (format == FBIMG_FORMAT_RGB888 || format == FBIMG_FORMAT_BGR888 || format == FBIMG_FORMAT_XRGB8888) return format;
+    return FBIMG_FORMAT_XRGB8888;
+}
+
+int canvas_init(struct canvas *c, uint32_t width, uint32_t height, int format) {
+    memset(c, 0, sizeof(*c));
+    c->width = width;
+    c->height = height;
+    c->format = format;
+    c->stride = fbimg_stride(width, format);
+    size_t size = c->stride * height;
+    c->pixels = aligned_alloc(CANVAS_ROW_ALIGN, size > 0 ? size : CANVAS_ROW_ALIGN);
+    if (!c->pixels) return -1;
+    memset(c->pixels, 0, size);
+    return 0;
+}
+
+void canvas_free(struct canvas *c) {
+    free(c->pixels);
+    c->pixels = NULL;
+}
+
+void canvas_vinfo(const struct canvas *c, struct fb_var_screeninfo *vinfo) {
+    memset(vinfo, 0, sizeof(*vinfo));
+    fbimg_format_vinfo(c->format, vinfo);
+    vinfo->xres = vinfo->xres_virtual = c->width;
+    vinfo->yres = vinfo->yres_virtual = c->height;
+}
+
+static bool rect_contains(const struct canvas_rect *outer, const struct canvas_rect *inner) {
+    return inner->x >= outer->x && inner->y >= outer->y && inner->x + inner->width <= outer->x + outer->width && inner->y + inner->height <= outer->y + outer->height;
+}
+
+static void rect_union(struct canvas_rect *a, const struct canvas_rect *b) {
+    int right = a->x + a->width > b->x + b->width ? a->x + a->width : b->x + b->width;
+    int bottom = a->y + a->height > b->y + b->height ? a->y + a->height : b->y + b->height;
+    if (b->x < a->x) a->x = b->x;
+    if (b->y < a->y) a->y = b->y;
+    a->width = right - a->x;
+    a->height = bottom - a->y;
+}
+
+void canvas_damage(struct canvas *c, int x, int y, int width, int height) {
+    int right = x + width, bottom = y + height;
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (right > (int)c->width) right = c->width;
+    if (bottom > (int)c->height) bottom = c->height;
+    if (right <= x || bottom <= y) return;
+    struct canvas_rect rect = {x, y, right - x, bottom - y};
+
+    for (int i = 0; i < c->dirty_count; i++) {
+        if (rect_contains(&c->dirty[i], &rect)) return;
+    }
+    if (c->dirty_count == CANVAS_MAX_DIRTY) {
+        // Too many to track, copy everything they cover instead
+        for (int i = 1; i < c->dirty_count; i++) rect_union(&c->dirty[0], &c->dirty[i]);
+        rect_union(&c->dirty[0], &rect);
+        c->dirty_count = 1;
+        return;
+    }
+    c->dirty[c->dirty_count++] = rect;
+}
+
+int canvas_flush(struct canvas *c, const struct blitter *b, char *fb_ptr, size_t line_length, int x, int y, struct canvas_rect *bounds) {
+    if (c->dirty_count == 0) return 0;
+    int bpp = fbimg_format_bpp(c->format);
+    *bounds = c->dirty[0];
+    for (int i = 0; i < c->dirty_count; i++) {
+        const struct canvas_rect *r = &c->dirty[i];
+        const char *src = c->pixels + (size_t)r->y * c->stride + (size_t)r->x * bpp;
+        blit_image(b, fb_ptr, line_length, x + r->x, y + r->y, src, c->stride, r->width, r->height);
+        rect_union(bounds, r);
+    }
+    bounds->x += x;
+    bounds->y += y;
+    c->dirty_count = 0;
+    return 1;
+}
+
+int canvas_save(const struct canvas *c, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return -1;
+    // The stride already matches the .fbimg one, so the pixels go out as is
+    size_t size = c->stride * c->height;
+    int result = fbimg_write_header(file, c->width, c->height, c->format, c->stride, 0);
+    if (result == 0 && fwrite(c->pixels, 1, size, file) != size) result = -1;
+    int saved_errno = errno;
+    if (fclose(file) != 0 && result == 0) return -1;
+    errno = saved_errno;
+    return result;
+}
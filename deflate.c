@@ -0,0 +1,389 @@
+#include "include/deflate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW 32768
+#define HASH_BITS 15
+#define BLOCK_SYMBOLS 32768 // Symbols collected before a block is written
+#define MAX_STORED 65535 // Largest stored block
+#define MAX_MATCH 258
+
+// Earlier positions with the same hash tried at each level
+static const int chain_length[DEFLATE_LEVEL_MAX + 1] = {0, 1, 2, 4, 8, 16, 32, 64, 128, 256};
+static const uint8_t code_length_order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// A literal byte in length with distance 0, or a match
+struct symbol {
+    uint16_t length;
+    uint16_t distance;
+};
+
+struct encoder {
+    uint8_t *out;
+    uint64_t bits;
+    int bit_count;
+    const uint8_t *in;
+    int level;
+    struct symbol *symbols;
+    int symbol_count;
+    int32_t *head; // Last position + 1 with each hash, 0 for none
+    int32_t *prev; // Previous position + 1 with the same hash, by position in the window
+};
+
+static void put_bits(struct encoder *e, uint32_t value, int n) {
+    e->bits |= (uint64_t)value << e->bit_count;
+    e->bit_count += n;
+    while (e->bit_count >= 8) {
+        *e->out++ = e->bits;
+        e->bits >>= 8;
+        e->bit_count -= 8;
+    }
+}
+
+static void align_bits(struct encoder *e) {
+    if (e->bit_count > 0) put_bits(e, 0, 8 - e->bit_count);
+}
+
+// Length symbol (minus 257) for a match length, with its extra bits
+static int length_code(int length, int *extra_bits, int *extra) {
+    int l = length - 3;
+    if (length == MAX_MATCH || l < 8) {
+        *extra_bits = 0;
+        *extra = 0;
+        return length == MAX_MATCH ? 28 : l;
+    }
+    int b = 31 - __builtin_clz(l);
+    *extra_bits = b - 2;
+    *extra = l & ((1 << (b - 2)) - 1);
+    return 4 * (b - 1) + ((l >> (b - 2)) & 3);
+}
+
+static int distance_code(int distance, int *extra_bits, int *extra) {
+    int d = distance - 1;
+    if (d < 4) {
+        *extra_bits = 0;
+        *extra = 0;
+        return d;
+    }
+    int b = 31 - __builtin_clz(d);
+    *extra_bits = b - 1;
+    *extra = d & ((1 << (b - 1)) - 1);
+    return 2 * b + ((d >> (b - 1)) & 1);
+}
+
+// Huffman code lengths of at most max_bits for n <= 288 symbols, 0 for
+// unused ones. The code is always complete, so a lone symbol gets a
+// partner.
+static void huffman_lengths(const uint32_t *freq, int n, int max_bits, uint8_t *lengths) {
+    uint32_t f[288], weight[2 * 288];
+    int order[288], parent[2 * 288];
+    uint8_t depth[2 * 288];
+    memcpy(f, freq, n * sizeof(*f));
+    memset(lengths, 0, n);
+    while (true) {
+        int count = 0;
+        for (int i = 0; i < n; i++) {
+            if (f[i] == 0) continue;
+            // Insertion sort by frequency, n is small
+            int k = count++;
+            for (; k > 0 && f[order[k - 1]] > f[i]; k--) order[k] = order[k - 1];
+            order[k] = i;
+        }
+        if (count == 0) return;
+        if (count == 1) {
+            lengths[order[0]] = 1;
+            lengths[order[0] == 0 ? 1 : 0] = 1;
+            return;
+        }
+        for (int k = 0; k < count; k++) weight[k] = f[order[k]];
+        // Leaves and merged nodes both come out in order of weight, so two
+        // queues replace a heap
+        int leaf = 0, node = count, next = count;
+        for (; next < 2 * count - 1; next++) {
+            int pick[2];
+            for (int k = 0; k < 2; k++) {
+                if (leaf < count && (node == next || weight[leaf] <= weight[node])) {
+                    pick[k] = leaf++;
+                } else {
+                    pick[k] = node++;
+                }
+            }
+            weight[next] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = parent[pick[1]] = next;
+        }
+        int root = 2 * count - 2, max_depth = 0;
+        depth[root] = 0;
+        for (int k = root - 1; k >= 0; k--) depth[k] = depth[parent[k]] + 1;
+        for (int k = 0; k < count; k++) {
+            if (depth[k] > max_depth) max_depth = depth[k];
+        }
+        if (max_depth <= max_bits) {
+            for (int k = 0; k < count; k++) lengths[order[k]] = depth[k];
+            return;
+        }
+        // Flatten the frequencies until the tree is shallow enough
+        for (int i = 0; i < n; i++) {
+            if (f[i]) f[i] = (f[i] >> 1) | 1;
+        }
+    }
+}
+
+// Canonical codes for the lengths, bit reversed since deflate sends them
+// most significant bit first
+static void huffman_codes(const uint8_t *lengths, int n, uint16_t *codes) {
+    uint16_t count[16] = {0}, next[16];
+    for (int i = 0; i < n; i++) count[lengths[i]]++;
+    count[0] = 0;
+    uint32_t code = 0;
+    for (int length = 1; length < 16; length++) {
+        code = (code + count[length - 1]) << 1;
+        next[length] = code;
+    }
+    for (int i = 0; i < n; i++) {
+        if (lengths[i] == 0) continue;
+        uint32_t value = next[lengths[i]]++, reversed = 0;
+        for (int b = 0; b < lengths[i]; b++, value >>= 1) reversed = reversed << 1 | (value & 1);
+        codes[i] = reversed;
+    }
+}
+
+static void write_stored(struct encoder *e, size_t start, size_t end, bool final) {
+    do {
+        size_t n = end - start > MAX_STORED ? MAX_STORED : end - start;
+        put_bits(e, final && start + n == end, 1);
+        put_bits(e, 0, 2);
+        align_bits(e);
+        put_bits(e, n, 16);
+        put_bits(e, ~n & 0xFFFF, 16);
+        memcpy(e->out, e->in + start, n);
+        e->out += n;
+        start += n;
+    } while (start < end);
+}
+
+// Writes the collected symbols, covering input [start, end), as a block
+// with dynamic codes, or stored if that is smaller
+static void write_block(struct encoder *e, size_t start, size_t end, bool final) {
+    uint32_t freq[286 + 30] = {0};
+    uint64_t bits = 3 + 5 + 5 + 4;
+    for (int i = 0; i < e->symbol_count; i++) {
+        const struct symbol *s = &e->symbols[i];
+        if (s->distance == 0) {
+            freq[s->length]++;
+            continue;
+        }
+        int extra_bits, extra;
+        freq[257 + length_code(s->length, &extra_bits, &extra)]++;
+        bits += extra_bits;
+        freq[286 + distance_code(s->distance, &extra_bits, &extra)]++;
+        bits += extra_bits;
+    }
+    freq[256] = 1;
+    // Even a block of literals has to describe a distance code
+    bool matches = false;
+    for (int i = 286; i < 286 + 30; i++) matches |= freq[i] != 0;
+    if (!matches) freq[286] = 1;
+
+    uint8_t lengths[286 + 30];
+    uint16_t codes[286 + 30];
+    huffman_lengths(freq, 286, 15, lengths);
+    huffman_lengths(freq + 286, 30, 15, lengths + 286);
+    huffman_codes(lengths, 286, codes);
+    huffman_codes(lengths + 286, 30, codes + 286);
+    for (int i = 0; i < 286 + 30; i++) bits += (uint64_t)freq[i] * lengths[i];
+
+    int literal_count = 286, distance_count = 30;
+    while (literal_count > 257 && lengths[literal_count - 1] == 0) literal_count--;
+    while (distance_count > 1 && lengths[286 + distance_count - 1] == 0) distance_count--;
+    uint8_t all[286 + 30];
+    int total = literal_count + distance_count;
+    memcpy(all, lengths, literal_count);
+    memcpy(all + literal_count, lengths + 286, distance_count);
+
+    // Run-length code the code lengths: 16 repeats the previous length,
+    // 17 and 18 are runs of zeros
+    uint8_t runs[286 + 30], run_extra[286 + 30];
+    uint32_t run_freq[19] = {0};
+    int run_count = 0;
+    for (int i = 0; i < total;) {
+        int value = all[i], run = 1;
+        while (i + run < total && all[i + run] == value) run++;
+        int symbol = value, extra = 0, length = 1;
+        if (value == 0 && run >= 3) {
+            length = run > 138 ? 138 : run;
+            symbol = length >= 11 ? 18 : 17;
+            extra = length - (length >= 11 ? 11 : 3);
+        } else if (value != 0 && i > 0 && all[i - 1] == value && run >= 3) {
+            length = run > 6 ? 6 : run;
+            symbol = 16;
+            extra = length - 3;
+        }
+        runs[run_count] = symbol;
+        run_extra[run_count++] = extra;
+        run_freq[symbol]++;
+        i += length;
+    }
+    uint8_t run_lengths[19];
+    uint16_t run_codes[19];
+    huffman_lengths(run_freq, 19, 7, run_lengths);
+    huffman_codes(run_lengths, 19, run_codes);
+    int order_count = 19;
+    while (order_count > 4 && run_lengths[code_length_order[order_count - 1]] == 0) order_count--;
+    bits += 3 * order_count;
+    for (int i = 0; i < 19; i++) bits += (uint64_t)run_freq[i] * run_lengths[i];
+    bits += run_freq[16] * 2 + run_freq[17] * 3 + run_freq[18] * 7;
+
+    uint64_t stored_bits = (uint64_t)(end - start) * 8 + 40 * ((end - start) / MAX_STORED + 1) + 8;
+    if (stored_bits <= bits) {
+        write_stored(e, start, end, final);
+        return;
+    }
+
+    put_bits(e, final, 1);
+    put_bits(e, 2, 2);
+    put_bits(e, literal_count - 257, 5);
+    put_bits(e, distance_count - 1, 5);
+    put_bits(e, order_count - 4, 4);
+    for (int i = 0; i < order_count; i++) put_bits(e, run_lengths[code_length_order[i]], 3);
+    static const uint8_t run_extra_bits[19] = {[16] = 2, [17] = 3, [18] = 7};
+    for (int i = 0; i < run_count; i++) {
+        put_bits(e, run_codes[runs[i]], run_lengths[runs[i]]);
+        if (runs[i] >= 16) put_bits(e, run_extra[i], run_extra_bits[runs[i]]);
+    }
+
+    for (int i = 0; i < e->symbol_count; i++) {
+        const struct symbol *s = &e->symbols[i];
+        if (s->distance == 0) {
+            put_bits(e, codes[s->length], lengths[s->length]);
+            continue;
+        }
+        int extra_bits, extra;
+        int code = 257 + length_code(s->length, &extra_bits, &extra);
+        put_bits(e, codes[code], lengths[code]);
+        put_bits(e, extra, extra_bits);
+        code = 286 + distance_code(s->distance, &extra_bits, &extra);
+        put_bits(e, codes[code], lengths[code]);
+        put_bits(e, extra, extra_bits);
+    }
+    put_bits(e, codes[256], lengths[256]);
+}
+
+static uint32_t hash3(const uint8_t *p) {
+    return ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16) * 2654435761u >> (32 - HASH_BITS);
+}
+
+static void insert(struct encoder *e, size_t pos) {
+    uint32_t h = hash3(e->in + pos);
+    e->prev[pos & (WINDOW - 1)] = e->head[h];
+    e->head[h] = pos + 1;
+}
+
+// Longest earlier match for pos, following the hash chain
+static int find_match(const struct encoder *e, size_t pos, size_t size, int *distance) {
+    const uint8_t *in = e->in;
+    int limit = size - pos < MAX_MATCH ? (int)(size - pos) : MAX_MATCH;
+    int best = 0;
+    int32_t candidate = e->head[hash3(in + pos)];
+    for (int chain = chain_length[e->level]; candidate > 0 && chain > 0; chain--) {
+        size_t match = candidate - 1;
+        if (pos - match > WINDOW) break;
+        if (in[match + best] == in[pos + best]) {
+            int length = 0;
+            while (length < limit && in[match + length] == in[pos + length]) length++;
+            if (length > best) {
+                best = length;
+                *distance = pos - match;
+                if (length == limit) break;
+            }
+        }
+        candidate = e->prev[match & (WINDOW - 1)];
+    }
+    return best;
+}
+
+size_t deflate_bound(size_t size) {
+    // Every block falls back to stored when that is smaller. Blocks other
+    // than the last hold at least BLOCK_SYMBOLS bytes.
+    return size + 6 * (size / BLOCK_SYMBOLS + size / MAX_STORED + 2) + 16;
+}
+
+size_t deflate_compress(uint8_t *out, const uint8_t *in, size_t size, int level, bool last) {
+    struct encoder e = {out, 0, 0, in, level};
+    bool final_written = false;
+    if (level <= 0) {
+        write_stored(&e, 0, size, last);
+        final_written = last;
+    } else {
+        e.symbols = malloc(BLOCK_SYMBOLS * sizeof(*e.symbols));
+        e.head = calloc(1 << HASH_BITS, sizeof(*e.head));
+        e.prev = malloc(WINDOW * sizeof(*e.prev));
+        if (!e.symbols || !e.head || !e.prev) {
+            free(e.symbols);
+            free(e.head);
+            free(e.prev);
+            return 0;
+        }
+        if (level > DEFLATE_LEVEL_MAX) e.level = DEFLATE_LEVEL_MAX;
+        size_t pos = 0, block_start = 0;
+        while (pos < size) {
+            int length = 0, distance = 0;
+            if (size - pos >= 3) {
+                length = find_match(&e, pos, size, &distance);
+                insert(&e, pos);
+            }
+            if (length >= 3) {
+                e.symbols[e.symbol_count++] = (struct symbol){length, distance};
+                for (size_t i = pos + 1; i < pos + length && size - i >= 3; i++) insert(&e, i);
+                pos += length;
+            } else {
+                e.symbols[e.symbol_count++] = (struct symbol){in[pos], 0};
+                pos++;
+            }
+            if (e.symbol_count == BLOCK_SYMBOLS || pos == size) {
+                final_written = last && pos == size;
+                write_block(&e, block_start, pos, final_written);
+                block_start = pos;
+                e.symbol_count = 0;
+            }
+        }
+        free(e.symbols);
+        free(e.head);
+        free(e.prev);
+        if (last && !final_written) write_stored(&e, size, size, true);
+    }
+    // Sync flush: an empty stored block leaves the output byte aligned
+    if (!last) write_stored(&e, size, size, false);
+    align_bits(&e);
+    return e.out - out;
+}
+
+uint32_t adler32(uint32_t adler, const uint8_t *data, size_t size) {
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (size > 0) {
+        // Largest run that can't overflow b before the modulo
+        size_t n = size < 5552 ? size : 5552;
+        size -= n;
+        for (; n > 0; n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return b << 16 | a;
+}
+
+uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t size2) {
+    const uint32_t base = 65521;
+    uint32_t rem = size2 % base;
+    uint32_t a = adler1 & 0xFFFF;
+    uint32_t b = (uint64_t)rem * a % base;
+    a += (adler2 & 0xFFFF) + base - 1;
+    b += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+    if (a >= base) a -= base;
+    if (a >= base) a -= base;
+    if (b >= base << 1) b -= base << 1;
+    if (b >= base) b -= base;
+    return b << 16 | a;
+}
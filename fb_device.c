@@ -0,0 +1,231 @@
+#include "include/fb_device.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fb.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Virtual framebuffer header, all fields are 32-bit little-endian:
+// "FBDEV\0\0\0", version (1), data offset, xres, yres, bits per pixel, line
+// length, offset and length of the red, green, blue and transp channels,
+// virtual height (0 for yres) and the row that is displayed
+#define FB_FILE_MAGIC "FBDEV\0\0\0"
+#define FB_FILE_FIELDS 16
+#define FB_FILE_YOFFSET_FIELD 15
+
+const char *fb_device_path(const char *option) {
+    if (option) return option;
+    const char *env = getenv(FB_DEVICE_ENV);
+    return (env && *env) ? env : FB_DEVICE_DEFAULT;
+}
+
+static int read_file_header(struct fb_device *fb) {
+    uint8_t header[8 + FB_FILE_FIELDS * 4];
+    if (pread(fb->fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint32_t f[FB_FILE_FIELDS];
+    memcpy(f, header + 8, sizeof(f));
+    uint32_t version = f[0], offset = f[1];
+    if (memcmp(header, FB_FILE_MAGIC, 8) != 0 || version != 1 || offset != FB_FILE_HEADER_SIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct fb_var_screeninfo *v = &fb->vinfo;
+    v->xres = v->xres_virtual = f[2];
+    v->yres = v->yres_virtual = f[3];
+    if (f[14] > f[3]) v->yres_virtual = f[14];
+    v->yoffset = f[FB_FILE_YOFFSET_FIELD];
+    v->bits_per_pixel = f[4];
+    struct fb_bitfield *channels[] = {&v->red, &v->green, &v->blue, &v->transp};
+    for (int i = 0; i < 4; i++) {
+        channels[i]->offset = f[6 + i * 2];
+        channels[i]->length = f[7 + i * 2];
+    }
+    // Computed in 64 bits, so a crafted header can't wrap it around to fit
+    // the file
+    uint64_t smem_len = (uint64_t)f[5] * v->yres_virtual;
+    fb->finfo.line_length = f[5];
+    fb->finfo.smem_len = smem_len;
+    fb->finfo.ypanstep = 1;
+    fb->finfo.type = FB_TYPE_PACKED_PIXELS;
+    fb->finfo.visual = FB_VISUAL_TRUECOLOR;
+    strncpy(fb->finfo.id, "virtual", sizeof(fb->finfo.id));
+
+    struct stat st;
+    if (fstat(fb->fd, &st) == -1) return -1;
+    if (smem_len > UINT32_MAX || (uint64_t)st.st_size < FB_FILE_HEADER_SIZE + smem_len || v->bits_per_pixel == 0 || (uint64_t)v->xres * v->bits_per_pixel / 8 > fb->finfo.line_length || v->yoffset > v->yres_virtual - v->yres) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int fb_device_open(struct fb_device *fb, const char *path, bool writable) {
+    memset(fb, 0, sizeof(*fb));
+    fb->writable = writable;
+    fb->fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fb->fd == -1) return -1;
+    struct stat st;
+    if (fstat(fb->fd, &st) == -1) {
+        close(fb->fd);
+        return -1;
+    }
+
+    int result;
+    if (S_ISREG(st.st_mode)) {
+        fb->backend = FB_BACKEND_FILE;
+        result = read_file_header(fb);
+    } else {
+        fb->backend = FB_BACKEND_FBDEV;
+        result = (ioctl(fb->fd, FBIOGET_VSCREENINFO, &fb->vinfo) == -1 || ioctl(fb->fd, FBIOGET_FSCREENINFO, &fb->finfo) == -1) ? -1 : 0;
+    }
+    if (result == -1) {
+        int error = errno;
+        close(fb->fd);
+        errno = error;
+        return -1;
+    }
+    fb->size = fb->finfo.smem_len;
+
+    const struct fb_var_screeninfo *v = &fb->vinfo;
+    fb->buffers = 1;
+    if (writable && v->yres_virtual >= 2 * (uint64_t)v->yres && (uint64_t)fb->finfo.line_length * v->yres * 2 <= fb->size) {
+        fb->buffers = 2;
+        fb->back = v->yoffset >= v->yres ? 0 : 1;
+        fb->vsync = fb->backend == FB_BACKEND_FBDEV;
+    }
+    return 0;
+}
+
+int fb_device_map(struct fb_device *fb) {
+    if (fb->ptr) return 0;
+    off_t offset = fb->backend == FB_BACKEND_FILE ? FB_FILE_HEADER_SIZE : 0;
+    int prot = fb->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *ptr = mmap(NULL, fb->size, prot, MAP_SHARED, fb->fd, offset);
+    if (ptr == MAP_FAILED) return -1;
+    fb->ptr = ptr;
+    // Start drawing from what is on screen
+    if (fb->buffers == 2) memcpy(fb_device_draw_buffer(fb), fb_device_visible(fb), (size_t)fb->finfo.line_length * fb->vinfo.yres);
+    return 0;
+}
+
+void fb_device_flush(struct fb_device *fb) {
+    // Real framebuffers scan out of the mapping directly
+    if (fb->ptr && fb->backend == FB_BACKEND_FILE) msync(fb->ptr, fb->size, MS_ASYNC);
+}
+
+char *fb_device_draw_buffer(const struct fb_device *fb) {
+    return fb->ptr + (size_t)fb->back * fb->vinfo.yres * fb->finfo.line_length;
+}
+
+const char *fb_device_visible(struct fb_device *fb) {
+    // Another process may have panned since the last look
+    if (fb->backend == FB_BACKEND_FILE) {
+        uint32_t yoffset;
+        if (pread(fb->fd, &yoffset, sizeof(yoffset), 8 + FB_FILE_YOFFSET_FIELD * 4) == (ssize_t)sizeof(yoffset) && yoffset <= fb->vinfo.yres_virtual - fb->vinfo.yres) fb->vinfo.yoffset = yoffset;
+    } else {
+        struct fb_var_screeninfo vinfo;
+        if (ioctl(fb->fd, FBIOGET_VSCREENINFO, &vinfo) == 0) fb->vinfo.yoffset = vinfo.yoffset;
+    }
+    uint32_t yoffset = fb->vinfo.yoffset;
+    if (((uint64_t)yoffset + fb->vinfo.yres) * fb->finfo.line_length > fb->size) yoffset = 0;
+    return fb->ptr + (size_t)yoffset * fb->finfo.line_length + (size_t)fb->vinfo.xoffset * fb->vinfo.bits_per_pixel / 8;
+}
+
+static int pan(struct fb_device *fb, uint32_t yoffset) {
+    if (fb->backend == FB_BACKEND_FILE) {
+        if (pwrite(fb->fd, &yoffset, sizeof(yoffset), 8 + FB_FILE_YOFFSET_FIELD * 4) != (ssize_t)sizeof(yoffset)) return -1;
+    } else {
+        struct fb_var_screeninfo vinfo = fb->vinfo;
+        vinfo.xoffset = 0;
+        vinfo.yoffset = yoffset;
+        if (ioctl(fb->fd, FBIOPAN_DISPLAY, &vinfo) == -1) return -1;
+    }
+    fb->vinfo.xoffset = 0;
+    fb->vinfo.yoffset = yoffset;
+    return 0;
+}
+
+int fb_device_present(struct fb_device *fb, int x, int y, int width, int height) {
+    if (fb->buffers < 2) {
+        fb_device_flush(fb);
+        return 0;
+    }
+    fb_device_flush(fb);
+    if (pan(fb, fb->back * fb->vinfo.yres) == -1) return -1;
+    if (fb->vsync) {
+        uint32_t screen = 0;
+        // Not every driver implements it, panning alone still avoids half-drawn frames
+        if (ioctl(fb->fd, FBIO_WAITFORVSYNC, &screen) == -1) fb->vsync = false;
+    }
+
+    // Bring the new back buffer up to date with the area that just changed
+    const char *front = fb_device_draw_buffer(fb);
+    fb->back = 1 - fb->back;
+    char *back = fb_device_draw_buffer(fb);
+    if (x < 0) {
+        width += x;
+        x = 0;
+    }
+    if (y < 0) {
+        height += y;
+        y = 0;
+    }
+    if (x + width > (int)fb->vinfo.xres) width = fb->vinfo.xres - x;
+    if (y + height > (int)fb->vinfo.yres) height = fb->vinfo.yres - y;
+    if (width <= 0 || height <= 0) return 0;
+    size_t line_length = fb->finfo.line_length;
+    size_t offset = (size_t)y * line_length + (size_t)x * fb->vinfo.bits_per_pixel / 8;
+    size_t row_size = (size_t)width * fb->vinfo.bits_per_pixel / 8;
+    if (x == 0 && width == (int)fb->vinfo.xres) {
+        memcpy(back + offset, front + offset, (size_t)(height - 1) * line_length + row_size);
+    } else {
+        for (int i = 0; i < height; i++, offset += line_length) memcpy(back + offset, front + offset, row_size);
+    }
+    return 0;
+}
+
+void fb_device_close(struct fb_device *fb) {
+    if (fb->ptr) {
+        fb_device_flush(fb);
+        munmap(fb->ptr, fb->size);
+    }
+    close(fb->fd);
+    memset(fb, 0, sizeof(*fb));
+    fb->fd = -1;
+}
+
+int fb_device_create(const char *path, const struct fb_var_screeninfo *vinfo) {
+    uint32_t line_length = ((uint64_t)vinfo->xres * vinfo->bits_per_pixel / 8 + 63) / 64 * 64;
+    uint32_t yres_virtual = vinfo->yres_virtual > vinfo->yres ? vinfo->yres_virtual : vinfo->yres;
+    uint32_t f[FB_FILE_FIELDS] = {1, FB_FILE_HEADER_SIZE, vinfo->xres, vinfo->yres, vinfo->bits_per_pixel, line_length};
+    f[14] = yres_virtual;
+    const struct fb_bitfield *channels[] = {&vinfo->red, &vinfo->green, &vinfo->blue, &vinfo->transp};
+    for (int i = 0; i < 4; i++) {
+        f[6 + i * 2] = channels[i]->offset;
+        f[7 + i * 2] = channels[i]->length;
+    }
+    uint8_t header[FB_FILE_HEADER_SIZE] = {0};
+    memcpy(header, FB_FILE_MAGIC, 8);
+    memcpy(header + 8, f, sizeof(f));
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return -1;
+    // The pixel memory is left sparse and reads back as black
+    if (write(fd, header, sizeof(header)) != (ssize_t)sizeof(header) || ftruncate(fd, FB_FILE_HEADER_SIZE + (off_t)line_length * yres_virtual) == -1) {
+        int error = errno;
+        close(fd);
+        errno = error ? error : EIO;
+        return -1;
+    }
+    return close(fd);
+}
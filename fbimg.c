@@ -1,20 +1,197 @@
-#include <fcntl.h>
+#include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <linux/fb.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
-#include <sys/mman.h>
 #include <unistd.h>
 
+#include "include/blit.h"
+#include "include/fb_device.h"
+#include "include/fbimg_file.h"
+#include "include/fbimg_server.h"
+#include "include/pixconv.h"
+#include "include/png_rows.h"
 #include "include/scale_img.h"
 
+// Where decoded or scaled rows of a PNG go
+struct png_target {
+    const struct blitter *blitter;
+    char *fb_ptr;
+    size_t line_length;
+    int x, y, width;
+    uint32_t *premultiplied; // RGBA rows are converted here, NULL for RGB rows
+};
+
+static void blit_row(void *ctx, int y, const char *row) {
+    const struct png_target *t = ctx;
+    if (t->premultiplied) {
+        pixconv_rgba_to_argb_premultiplied(t->premultiplied, (const uint8_t *)row, t->width);
+        row = (const char *)t->premultiplied;
+    }
+    blit_image(t->blitter, t->fb_ptr, t->line_length, t->x, t->y + y, row, (size_t)t->width * 3, t->width, 1);
+}
+
+static bool is_png(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return false;
+    char signature[8];
+    bool png = fread(signature, 1, sizeof(signature), file) == sizeof(signature) && png_signature(signature, sizeof(signature));
+    fclose(file);
+    return png;
+}
+
+// The stream scaler only handles three channels, so transparent images
+// that have to be scaled are decoded whole and premultiplied, then scaled
+// like ARGB8888 .fbimg files. Returns the scaled pixels, or NULL after
+// printing an error.
+static uint32_t *scale_png_argb(struct png_rows *png, int width, int height, int threads) {
+    uint32_t *pixels = malloc((size_t)png->width * png->height * 4);
+    if (!pixels) {
+        fprintf(stderr, "Error: out of memory while scaling image\n");
+        return NULL;
+    }
+    for (uint32_t y = 0; y < png->height; y++) {
+        const char *row = png_rows_next_rgba(png);
+        if (!row) {
+            fprintf(stderr, "Error: %s\n", png_error_text(png->error));
+            free(pixels);
+            return NULL;
+        }
+        pixconv_rgba_to_argb_premultiplied(pixels + (size_t)y * png->width, (const uint8_t *)row, png->width);
+    }
+    uint32_t *scaled = scale_image_argb_mt(pixels, (size_t)png->width * 4, png->width, png->height, width, height, threads);
+    free(pixels);
+    if (!scaled) fprintf(stderr, "Error: out of memory while scaling image\n");
+    return scaled;
+}
+
+// Draws a PNG file while it is decoded, a row at a time, so neither the
+// whole image nor a scaled copy of it is ever held in memory. Transparent
+// images are composited over the screen, and are only held whole when they
+// have to be scaled.
+static int show_png(const char *path, const char *device, bool centered, int offset_x, int offset_y, int threads) {
+    struct png_rows png;
+    int error = png_rows_open(path, &png);
+    if (error != PNG_OK) {
+        fprintf(stderr, "Error opening file: %s\n", png_error_text(error));
+        return 1;
+    }
+
+    struct fb_device fb;
+    if (fb_device_open(&fb, fb_device_path(device), true) == -1) {
+        perror("Error opening framebuffer device");
+        png_rows_close(&png);
+        return 1;
+    }
+    const struct fb_var_screeninfo vinfo = fb.vinfo;
+    if (fb_detect_layout(&vinfo) == FB_LAYOUT_UNSUPPORTED) {
+        fprintf(stderr, "Error: framebuffer pixel format not supported\n");
+        fb_device_close(&fb);
+        png_rows_close(&png);
+        return 1;
+    }
+
+    int width = png.width, height = png.height;
+    bool scale = vinfo.xres < png.width || vinfo.yres < png.height;
+    if (scale) scale_fit(png.width, png.height, vinfo.xres, vinfo.yres, &width, &height);
+    if (centered) {
+        offset_x = (vinfo.xres - width) / 2;
+        offset_y = (vinfo.yres - height) / 2;
+    } else if (offset_x < 0 || offset_y < 0 || offset_x + width > (int)vinfo.xres || offset_y + height > (int)vinfo.yres) {
+        fprintf(stderr, "Error: Offset out of bounds\n");
+        fb_device_close(&fb);
+        png_rows_close(&png);
+        return 1;
+    }
+
+    // Opaque images are scaled as they stream in
+    bool scale_argb = scale && png.alpha;
+    if (scale_argb) scale = false;
+    struct scaler scaler;
+    struct scaler_stream stream;
+    if (scale && (scaler_init(&scaler, false, png.width, png.height, width, height) != 0 || scaler_stream_init(&stream, &scaler) != 0)) {
+        fprintf(stderr, "Error: out of memory while scaling image\n");
+        fb_device_close(&fb);
+        png_rows_close(&png);
+        return 1;
+    }
+
+    if (fb_device_map(&fb) == -1) {
+        perror("Error mapping framebuffer memory");
+        if (scale) {
+            scaler_stream_free(&stream);
+            scaler_free(&scaler);
+        }
+        fb_device_close(&fb);
+        png_rows_close(&png);
+        return 1;
+    }
+
+    if (scale_argb) {
+        uint32_t *scaled = scale_png_argb(&png, width, height, threads);
+        int status = 1;
+        if (scaled) {
+            struct blitter blitter;
+            blit_init(&blitter, &vinfo, FBIMG_FORMAT_ARGB8888);
+            blit_image(&blitter, fb_device_draw_buffer(&fb), fb.finfo.line_length, offset_x, offset_y, (const char *)scaled, (size_t)width * 4, width, height);
+            if (fb_device_present(&fb, offset_x, offset_y, width, height) == -1) perror("Error panning the framebuffer");
+            free(scaled);
+            status = 0;
+        }
+        fb_device_close(&fb);
+        png_rows_close(&png);
+        return status;
+    }
+
+    // Opaque pixels of images that merely have an alpha channel come out
+    // the same, as runs of them are copied
+    bool blend = png.alpha && !scale;
+    uint32_t *premultiplied = blend ? malloc((size_t)width * 4) : NULL;
+    if (blend && !premultiplied) {
+        fprintf(stderr, "Error: out of memory\n");
+        fb_device_close(&fb);
+        png_rows_close(&png);
+        return 1;
+    }
+    struct blitter blitter;
+    blit_init(&blitter, &vinfo, blend ? FBIMG_FORMAT_ARGB8888 : FBIMG_FORMAT_RGB888);
+    struct png_target target = {&blitter, fb_device_draw_buffer(&fb), fb.finfo.line_length, offset_x, offset_y, width, premultiplied};
+    const char *row;
+    for (int y = 0; (row = blend ? png_rows_next_rgba(&png) : png_rows_next(&png)) != NULL; y++) {
+        if (scale) {
+            scaler_stream_push(&stream, y, row, blit_row, &target);
+        } else {
+            blit_row(&target, y, row);
+        }
+    }
+    if (scale) {
+        scaler_stream_free(&stream);
+        scaler_free(&scaler);
+    }
+    free(premultiplied);
+    int status = 0;
+    if (png.error != PNG_OK) {
+        fprintf(stderr, "Error: %s\n", png_error_text(png.error));
+        status = 1;
+    } else if (fb_device_present(&fb, offset_x, offset_y, width, height) == -1) {
+        perror("Error panning the framebuffer");
+    }
+    fb_device_close(&fb);
+    png_rows_close(&png);
+    return status;
+}
+
 int main(int argc, char *argv[]) {
     bool centered = false;
     int offset_x = 0, offset_y = 0;
+    int threads = 0;
+    const char *device = NULL;
+    const char *daemon_socket = NULL, *client_socket = NULL;
+    long cache_mb = FBIMG_SERVER_CACHE_MB;
     int opt;
     int option_index = 0;
 
@@ -23,16 +200,30 @@ int main(int argc, char *argv[]) {
         {"version", no_argument, 0, 'v'},
         {"offset", required_argument, 0, 'o'},
         {"centered", no_argument, 0, 'c'},
+        {"threads", required_argument, 0, 't'},
+        {"fb", required_argument, 0, 'f'},
+        {"daemon", required_argument, 0, 'd'},
+        {"socket", required_argument, 0, 's'},
+        {"cache-size", required_argument, 0, 'C'},
         {0, 0, 0, 0}};
 
-    while ((opt = getopt_long(argc, argv, "hvo:c", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "hvo:ct:f:d:s:", long_options, &option_index)) != -1) {
         switch (opt) {
             case 'h':
                 printf("Usage: %s [options] image_path\n", argv[0]);
+                printf("  image_path can be a .fbimg or a .png file.\n");
                 printf("  -h, --help       Show this help message.\n");
                 printf("  -v, --version    Show version information.\n");
                 printf("  -o, --offset     Set offset. Takes an argument in the format widthxheight.\n");
                 printf("  -c, --centered   Enable centered mode\n  This option bypasses --offset.\n");
+                printf("  -t, --threads    Number of threads used for scaling (default: all CPUs)\n");
+                printf("  -f, --fb         Framebuffer device or virtual framebuffer file\n");
+                printf("                   (default: $%s or %s)\n", FB_DEVICE_ENV, FB_DEVICE_DEFAULT);
+                printf("  -d, --daemon     Keep the framebuffer open and draw what clients send to\n");
+                printf("                   this Unix socket, until SIGINT or SIGTERM\n");
+                printf("  -s, --socket     Have the daemon listening on this socket draw image_path\n");
+                printf("      --cache-size Memory for files kept ready to draw by --daemon, in MiB\n");
+                printf("                   (default: %d)\n", FBIMG_SERVER_CACHE_MB);
                 return 0;
             case 'v':
                 printf("fbimg version 1.0\n");
@@ -59,90 +250,140 @@ int main(int argc, char *argv[]) {
             case 'c':
                 centered = true;
                 break;
+            case 't':
+                threads = atoi(optarg);
+                if (threads <= 0) {
+                    fprintf(stderr, "Thread count must be a positive integer.\n");
+                    return 1;
+                }
+                break;
+            case 'f':
+                device = optarg;
+                break;
+            case 'd':
+                daemon_socket = optarg;
+                break;
+            case 's':
+                client_socket = optarg;
+                break;
+            case 'C': {
+                char *end;
+                cache_mb = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || cache_mb < 0 || (unsigned long)cache_mb > SIZE_MAX >> 20) {
+                    fprintf(stderr, "Invalid cache size: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
             case '?':
                 printf("Unrecognized option\n");
                 return 1;
         }
     }
+    if (daemon_socket) {
+        if (fbimg_server_run(daemon_socket, device, (size_t)cache_mb << 20, threads) == -1) {
+            perror("Error starting the display server");
+            return 1;
+        }
+        return 0;
+    }
     if (optind >= argc) {
         fprintf(stderr, "Usage: %s <image_path>\n", argv[0]);
         return 1;
     }
-    FILE *file = fopen(argv[optind], "rb");
-    if (!file) {
-        perror("Error opening file");
-        return 1;
-    }
-    char magic[6] = {0}; // Allocate space for 5 characters + null terminator
-    size_t bytesRead = fread(magic, 1, 5, file);
-    if (bytesRead != 5) {
-        fprintf(stderr, "Unexpected end of file\n");
-        fclose(file);
-        return 1;
+    if (client_socket) {
+        // The daemon may run in another directory
+        char path[PATH_MAX];
+        if (!realpath(argv[optind], path)) {
+            perror("Error opening file");
+            return 1;
+        }
+        int sock = fbimg_client_connect(client_socket);
+        if (sock == -1) {
+            perror("Error connecting to the display server");
+            return 1;
+        }
+        struct fbimg_command command = {.type = FBIMG_COMMAND_DRAW_FILE, .flags = centered ? FBIMG_COMMAND_CENTERED : 0, .x = offset_x, .y = offset_y};
+        int status = fbimg_client_send(sock, &command, path, -1);
+        if (status == -1) fprintf(stderr, "Error drawing %s: %s\n", argv[optind], strerror(errno));
+        close(sock);
+        return status == 0 ? 0 : 1;
     }
-    if (strcmp(magic, "FBIMG") != 0) {
-        fprintf(stderr, "Not a valid FBIMG file\n");
-        fclose(file);
+    if (is_png(argv[optind])) return show_png(argv[optind], device, centered, offset_x, offset_y, threads);
+
+    struct fbimg img;
+    int error = fbimg_open(argv[optind], &img);
+    if (error != FBIMG_OK) {
+        fprintf(stderr, "Error opening file: %s\n", fbimg_error_text(error));
         return 1;
     }
-    uint32_t width, height;
-    fread(&width, sizeof(uint32_t), 1, file);
-    fread(&height, sizeof(uint32_t), 1, file);
-    char color[4] = {0};
-    fread(color, 1, 3, file);
-    char *data = malloc(width * height * 3);
-    fread(data, 1, width * height * 3, file);
-    fclose(file);
+    uint32_t width = img.width, height = img.height;
+    const char *data = img.pixels;
+    size_t stride = img.stride;
+    int format = img.format;
+    char *scaled = NULL;
 
     // Open the framebuffer device
-    int fb_fd = open("/dev/fb0", O_RDWR);
-    if (fb_fd == -1) {
+    struct fb_device fb;
+    if (fb_device_open(&fb, fb_device_path(device), true) == -1) {
         perror("Error opening framebuffer device");
+        fbimg_close(&img);
         return 1;
     }
+    const struct fb_var_screeninfo vinfo = fb.vinfo;
+    const struct fb_fix_screeninfo finfo = fb.finfo;
 
-    // Get variable screen info
-    struct fb_var_screeninfo vinfo;
-    if (ioctl(fb_fd, FBIOGET_VSCREENINFO, &vinfo) == -1) {
-        perror("Error getting screen info");
-        close(fb_fd);
-        return 1;
-    }
-
-    // Get fixed screen info
-    struct fb_fix_screeninfo finfo;
-    if (ioctl(fb_fd, FBIOGET_FSCREENINFO, &finfo) == -1) {
-        perror("Error getting fixed screen info");
-        close(fb_fd);
+    if (fb_detect_layout(&vinfo) == FB_LAYOUT_UNSUPPORTED) {
+        fprintf(stderr, "Error: framebuffer pixel format not supported\n");
+        fb_device_close(&fb);
+        fbimg_close(&img);
         return 1;
     }
 
-    if (vinfo.red.length != 8 || vinfo.green.length != 8 || vinfo.blue.length != 8) {
-        fprintf(stderr, "Error: framebuffer color depth per channel is not 8 bits; framebuffer not supported\n");
-        close(fb_fd);
-        return 1;
-    }
-
-    if (vinfo.xres < width) {
-        data = scale_image(data, false, width, height, vinfo.xres, height * ((float)vinfo.xres / width));
-        width = vinfo.xres;
-        height = (int)(height * ((float)vinfo.xres / width));
-    }
-
-    if (vinfo.yres < height) {
-        data = scale_image(data, false, width, height, width * ((float)vinfo.yres / height), vinfo.yres);
-        width = (int)(width * ((float)vinfo.yres / height));
-        height = vinfo.yres;
+    if (vinfo.xres < width || vinfo.yres < height) {
+        int new_width, new_height;
+        scale_fit(width, height, vinfo.xres, vinfo.yres, &new_width, &new_height);
+        // The scaler works on tightly packed 3-byte pixels
+        char *decoded = NULL, *unpacked = NULL;
+        if (img.flags & FBIMG_FLAG_RLE) {
+            decoded = fbimg_decode(&img);
+            data = decoded;
+            stride = (size_t)width * fbimg_format_bpp(format);
+        }
+        if (data && format == FBIMG_FORMAT_ARGB8888) {
+            scaled = (char *)scale_image_argb_mt((const uint32_t *)data, stride, width, height, new_width, new_height, threads);
+            data = NULL;
+        }
+        if (data && (fbimg_format_bpp(format) != 3 || stride != (size_t)width * 3)) {
+            unpacked = blit_convert_to_rgb(data, stride, format, width, height);
+            data = unpacked;
+            format = FBIMG_FORMAT_RGB888;
+        }
+        if (data) scaled = scale_image_mt((char *)data, false, width, height, new_width, new_height, threads);
+        free(unpacked);
+        free(decoded);
+        if (!scaled) {
+            fprintf(stderr, "Error: out of memory or corrupt data while scaling image\n");
+            fb_device_close(&fb);
+            fbimg_close(&img);
+            return 1;
+        }
+        data = scaled;
+        stride = (size_t)new_width * fbimg_format_bpp(format);
+        width = new_width;
+        height = new_height;
     }
 
     // Map framebuffer memory
-    size_t screensize = finfo.smem_len;
-    char *fb_ptr = mmap(NULL, screensize, PROT_READ | PROT_WRITE, MAP_SHARED, fb_fd, 0);
-    if (fb_ptr == MAP_FAILED) {
+    if (fb_device_map(&fb) == -1) {
         perror("Error mapping framebuffer memory");
-        close(fb_fd);
+        fb_device_close(&fb);
+        free(scaled);
+        fbimg_close(&img);
         return 1;
     }
+    // Off-screen when the framebuffer is double buffered
+    char *fb_ptr = fb_device_draw_buffer(&fb);
 
     if (centered) {
         offset_x = (vinfo.xres - width) / 2;
@@ -150,43 +391,30 @@ int main(int argc, char *argv[]) {
     } else {
         if (offset_x < 0 || offset_y < 0 || offset_x + width > vinfo.xres || offset_y + height > vinfo.yres) {
             fprintf(stderr, "Error: Offset out of bounds\n");
-            munmap(fb_ptr, screensize);
-            close(fb_fd);
-            free(data);
+            fb_device_close(&fb);
+            free(scaled);
+            fbimg_close(&img);
             return 1;
         }
     }
 
     // Write pixels to framebuffer
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            int offset = (i + offset_y) * finfo.line_length + (j + offset_x) * (vinfo.bits_per_pixel / 8);
-            int data_offset = (i * width + j) * 3;
-            char red;
-            char green;
-            char blue;
-            char alpha = 0xFF;
-            if (strcmp(color, "RGB") == 0) {
-                red = data[data_offset];
-                green = data[data_offset + 1];
-                blue = data[data_offset + 2];
-            } else if (strcmp(color, "BGR") == 0) {
-                blue = data[data_offset];
-                green = data[data_offset + 1];
-                red = data[data_offset + 2];
-            }
-            uint32_t pixel = 0;
-            if (vinfo.transp.length > 0) {
-                *((char *)(fb_ptr + offset + (vinfo.transp.offset / 8))) = alpha;
-            }
-            *((char *)(fb_ptr + offset + (vinfo.red.offset / 8))) = red;
-            *((char *)(fb_ptr + offset + (vinfo.green.offset / 8))) = green;
-            *((char *)(fb_ptr + offset + (vinfo.blue.offset / 8))) = blue;
-        }
+    struct blitter blitter;
+    blit_init(&blitter, &vinfo, format);
+    if (scaled) {
+        blit_image(&blitter, fb_ptr, finfo.line_length, offset_x, offset_y, data, stride, width, height);
+    } else if (blit_fbimg(&blitter, fb_ptr, finfo.line_length, offset_x, offset_y, &img) == -1) {
+        fprintf(stderr, "Error: corrupt image data\n");
+        fb_device_close(&fb);
+        fbimg_close(&img);
+        return 1;
+    }
+    if (fb_device_present(&fb, offset_x, offset_y, width, height) == -1) {
+        perror("Error panning the framebuffer");
     }
 
     // Unmap framebuffer memory
-    munmap(fb_ptr, screensize);
-    close(fb_fd);
-    free(data);
+    fb_device_close(&fb);
+    free(scaled);
+    fbimg_close(&img);
 }
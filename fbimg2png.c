@@ -1,27 +1,283 @@
+#include <errno.h>
 #include <getopt.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
+#include "include/batch.h"
+#include "include/blit.h"
+#include "include/fbimg_file.h"
+#include "include/fbseq.h"
+#include "include/pixconv.h"
+#include "include/png_write.h"
 #include "thirdparty/lodepng/lodepng.h"
 
+// Compression presets for --level. 0 writes stored blocks, 1 (--fast)
+// does a short greedy search on rows that all use the Sub filter, and 6 is
+// LodePNG's default.
+struct png_preset {
+    unsigned btype, windowsize, nicematch, lazymatching;
+    LodePNGFilterStrategy filter;
+};
+static const struct png_preset presets[] = {
+    {0, 0, 0, 0, LFS_ZERO},
+    {2, 256, 16, 0, LFS_ONE},
+    {2, 512, 32, 0, LFS_ONE},
+    {2, 1024, 64, 0, LFS_ONE},
+    {2, 2048, 64, 1, LFS_MINSUM},
+    {2, 2048, 96, 1, LFS_MINSUM},
+    {2, 2048, 128, 1, LFS_MINSUM},
+    {2, 8192, 258, 1, LFS_MINSUM},
+    {2, 16384, 258, 1, LFS_MINSUM},
+    {2, 32768, 258, 1, LFS_MINSUM},
+};
+#define PNG_LEVEL_MAX (int)(sizeof(presets) / sizeof(*presets) - 1)
+#define PNG_LEVEL_DEFAULT 6
+#define PNG_LEVEL_FAST 1
+
+// Encodes packed RGB888, or RGBA8888 when alpha is set, as an 8-bit PNG of
+// the same color type
+static unsigned encode_png(const char *path, const char *pixels, bool alpha, uint32_t width, uint32_t height, int level) {
+    const struct png_preset *preset = &presets[level];
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_raw.colortype = alpha ? LCT_RGBA : LCT_RGB;
+    state.info_raw.bitdepth = 8;
+    state.info_png.color.colortype = alpha ? LCT_RGBA : LCT_RGB;
+    state.info_png.color.bitdepth = 8;
+    // Scanning the pixels for a smaller color type costs more than it saves
+    // on framebuffer contents
+    state.encoder.auto_convert = 0;
+    state.encoder.filter_strategy = preset->filter;
+    state.encoder.zlibsettings.btype = preset->btype;
+    state.encoder.zlibsettings.use_lz77 = preset->btype != 0;
+    if (preset->btype != 0) {
+        state.encoder.zlibsettings.windowsize = preset->windowsize;
+        state.encoder.zlibsettings.nicematch = preset->nicematch;
+        state.encoder.zlibsettings.lazymatching = preset->lazymatching;
+    }
+    unsigned char *png = NULL;
+    size_t size = 0;
+    unsigned error = lodepng_encode(&png, &size, (const unsigned char *)pixels, width, height, &state);
+    if (!error) error = lodepng_save_file(png, size, path);
+    free(png);
+    lodepng_state_cleanup(&state);
+    return error;
+}
+
+// Converts one row to RGB888, or to RGBA8888 with straight alpha for
+// ARGB8888. RGB needs no conversion and BGR only a swap, everything else is
+// read back through a blitter in the source layout.
+static void convert_row(const struct blitter *b, int format, char *dst, const char *src, uint32_t width) {
+    if (format == FBIMG_FORMAT_ARGB8888) {
+        pixconv_argb_premultiplied_to_rgba((uint8_t *)dst, (const uint32_t *)src, width);
+    } else if (format == FBIMG_FORMAT_RGB888) {
+        memcpy(dst, src, (size_t)width * 3);
+    } else if (format == FBIMG_FORMAT_BGR888) {
+        pixconv_rgb_to_bgr((uint8_t *)dst, (const uint8_t *)src, width);
+    } else {
+        blit_read_image(b, src, 0, 0, 0, dst, 0, width, 1);
+    }
+}
+
+struct options {
+    long frame; // Frame of a .fbseq recording, -1 for a .fbimg file
+    int level;
+    int threads; // Encode with LodePNG when < 0
+};
+
+// Buffers kept from one file to the next
+struct converter {
+    char *converted;
+    size_t converted_size;
+    char *scratch;
+    size_t scratch_size;
+};
+
+// Returns buffer grown to at least size bytes, or NULL
+static char *reserve(char **buffer, size_t *capacity, size_t size) {
+    if (*capacity < size) {
+        free(*buffer);
+        *buffer = malloc(size);
+        *capacity = *buffer ? size : 0;
+    }
+    return *buffer;
+}
+
+static int convert(struct converter *c, const struct options *o, const char *input_file, const char *output_file) {
+    struct fbimg img = {0};
+    struct fbseq seq = {0};
+    uint32_t width, height;
+    int format;
+    int error;
+    int status = -1;
+    if (o->frame >= 0) {
+        error = fbseq_open(input_file, &seq);
+        if (error != FBIMG_OK) {
+            fprintf(stderr, "Error opening input file %s: %s\n", input_file, fbimg_error_text(error));
+            return -1;
+        }
+        while (seq.frame_index <= o->frame) {
+            int next = fbseq_next(&seq);
+            if (next <= 0) {
+                fprintf(stderr, next == 0 ? "Error: %s has only %u frames\n" : "Error: corrupt data in %s after frame %u\n", input_file, seq.frame_index);
+                goto done;
+            }
+        }
+        width = seq.width;
+        height = seq.height;
+        format = seq.format;
+    } else {
+        error = fbimg_open(input_file, &img);
+        if (error != FBIMG_OK) {
+            fprintf(stderr, "Error opening input file %s: %s\n", input_file, fbimg_error_text(error));
+            return -1;
+        }
+        width = img.width;
+        height = img.height;
+        format = img.format;
+    }
+
+    // Packed RGB is encoded straight from the mapping, anything else is
+    // converted into a single RGB or RGBA buffer a row at a time. Premultiplied
+    // ARGB becomes an RGBA PNG, so the transparency survives.
+    bool alpha = format == FBIMG_FORMAT_ARGB8888;
+    size_t row_size = (size_t)width * (alpha ? 4 : 3);
+    const char *pixels = NULL;
+    if (o->frame >= 0 && format == FBIMG_FORMAT_RGB888) {
+        pixels = seq.frame;
+    } else if (o->frame < 0 && format == FBIMG_FORMAT_RGB888 && !(img.flags & FBIMG_FLAG_RLE) && img.stride == row_size) {
+        pixels = img.pixels;
+    } else {
+        char *converted = reserve(&c->converted, &c->converted_size, row_size * height + 1);
+        char *scratch = reserve(&c->scratch, &c->scratch_size, (size_t)width * fbimg_format_bpp(format) + 1);
+        if (!converted || !scratch) {
+            fprintf(stderr, "Error: out of memory\n");
+            goto done;
+        }
+        struct fb_var_screeninfo vinfo = {0};
+        fbimg_format_vinfo(format, &vinfo);
+        struct blitter b;
+        blit_init(&b, &vinfo, FBIMG_FORMAT_RGB888);
+        struct fbimg_rows rows;
+        if (o->frame < 0) fbimg_rows_begin(&img, &rows);
+        for (uint32_t y = 0; y < height; y++) {
+            const char *src = o->frame >= 0 ? seq.frame + (size_t)y * width * fbimg_format_bpp(format) : fbimg_rows_next(&rows, scratch);
+            if (!src) {
+                fprintf(stderr, "Error: corrupt image data in %s\n", input_file);
+                goto done;
+            }
+            convert_row(&b, format, converted + y * row_size, src, width);
+        }
+        pixels = converted;
+    }
+
+    if (o->threads >= 0) {
+        error = alpha ? png_write_rgba(output_file, pixels, width, height, o->level, o->threads) : png_write_rgb(output_file, pixels, width, height, o->level, o->threads);
+        if (error) fprintf(stderr, "Error writing %s: %s\n", output_file, strerror(errno));
+    } else {
+        error = encode_png(output_file, pixels, alpha, width, height, o->level);
+        if (error) fprintf(stderr, "Error encoding %s: %s\n", output_file, lodepng_error_text(error));
+    }
+    status = error ? -1 : 0;
+
+done:
+    fbimg_close(&img);
+    fbseq_close(&seq);
+    return status;
+}
+
+static void free_converter(void *state) {
+    struct converter *c = state;
+    free(c->converted);
+    free(c->scratch);
+    free(c);
+}
+
+static int convert_batch_file(void **state, const char *input, const char *output, void *ctx) {
+    if (!*state && !(*state = calloc(1, sizeof(struct converter)))) {
+        fprintf(stderr, "Error: out of memory\n");
+        return -1;
+    }
+    return convert(*state, ctx, input, output);
+}
+
 int main(int argc, char *argv[]) {
     const struct option long_options[] = {
         {"help", no_argument, NULL, 'h'},
         {"version", no_argument, NULL, 'v'},
+        {"frame", required_argument, NULL, 'f'},
+        {"fast", no_argument, NULL, 'F'},
+        {"level", required_argument, NULL, 'l'},
+        {"threads", required_argument, NULL, 't'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"out-dir", required_argument, NULL, 'o'},
         {NULL, 0, NULL, 0}};
 
+    struct options options = {-1, PNG_LEVEL_DEFAULT, -1};
+    const char *out_dir = NULL;
+    int jobs = 0;
     int opt;
-    while ((opt = getopt_long(argc, argv, "hv", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "hvf:Fl:t:j:o:", long_options, NULL)) != -1) {
         switch (opt) {
             case 'h':
                 printf("Usage: %s [options] input output\n", argv[0]);
+                printf("       %s [options] --out-dir dir [input...]\n", argv[0]);
                 printf("Options:\n");
                 printf("  -h, --help       Show this help message\n");
                 printf("  -v, --version    Show version information\n");
+                printf("  -f, --frame      Convert the given frame (from 0) of a .fbseq recording\n");
+                printf("  -l, --level      Compression level from 0 (stored) to %d (default: %d)\n", PNG_LEVEL_MAX, PNG_LEVEL_DEFAULT);
+                printf("  -F, --fast       Same as --level %d, for quick screenshots\n", PNG_LEVEL_FAST);
+                printf("  -t, --threads    Compress bands of rows in parallel on this many threads,\n");
+                printf("                   0 for all CPUs. The file comes out slightly larger.\n");
+                printf("  -o, --out-dir    Convert every input, or every path read from stdin if none\n");
+                printf("                   are given, into this directory as name.png\n");
+                printf("  -j, --jobs       Threads converting files with --out-dir (default: all CPUs)\n");
                 return 0;
+            case 'f': {
+                char *end;
+                options.frame = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || options.frame < 0) {
+                    fprintf(stderr, "Invalid frame: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            case 'F':
+                options.level = PNG_LEVEL_FAST;
+                break;
+            case 'l': {
+                char *end;
+                options.level = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || options.level < 0 || options.level > PNG_LEVEL_MAX) {
+                    fprintf(stderr, "Invalid level: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            case 't': {
+                char *end;
+                options.threads = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || options.threads < 0) {
+                    fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            case 'o':
+                out_dir = optarg;
+                break;
+            case 'j':
+                jobs = atoi(optarg);
+                if (jobs <= 0) {
+                    fprintf(stderr, "Job count must be a positive integer.\n");
+                    return 1;
+                }
+                break;
             case 'v':
                 printf("FBTools %s v1.0\n", argv[0]);
                 return 0;
@@ -31,6 +287,24 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (out_dir) {
+        struct batch_ops ops = {".png", convert_batch_file, free_converter, &options};
+        char **paths = argv + optind;
+        size_t count = argc - optind;
+        char **read = NULL;
+        if (count == 0 && !(paths = read = batch_read_paths(stdin, &count))) {
+            fprintf(stderr, "Error reading paths from stdin\n");
+            return 1;
+        }
+        int failed = batch_run(&ops, paths, count, out_dir, jobs);
+        batch_free_paths(read, count);
+        return failed == 0 ? 0 : 1;
+    }
+    if (jobs > 0) {
+        fprintf(stderr, "--jobs needs --out-dir\n");
+        return 1;
+    }
+
     char *input_file = NULL;
     char *output_file = NULL;
 
@@ -41,52 +315,10 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "No input or output files specified.\n");
         return 1;
     }
-    FILE *input = fopen(input_file, "rb");
-    if (!input) {
-        fprintf(stderr, "Error opening input file: %s\n", input_file);
-        return 1;
-    }
-    char magic[6] = {0};
-    fread(magic, 1, 5, input);
-    if (strcmp(magic, "FBIMG") != 0) {
-        fprintf(stderr, "Invalid file format: %s\n", input_file);
-        fclose(input);
-        return 1;
-    }
-
-    uint32_t width, height;
-    fread(&width, sizeof(uint32_t), 1, input);
-    fread(&height, sizeof(uint32_t), 1, input);
-
-    char channels[4] = {0};
-    fread(&channels, 1, 3, input);
-
-    char *data = malloc(width * height * 3);
-    fread(data, 3, width * height, input);
-    fclose(input);
-
-    char *image = malloc(width * height * 4);
-    for (uint32_t i = 0; i < width * height; i++) {
-        if (strcmp(channels, "BGR") != 0) {
-            image[i * 4 + 0] = data[i * 3 + 0]; // R
-            image[i * 4 + 1] = data[i * 3 + 1]; // G
-            image[i * 4 + 2] = data[i * 3 + 2]; // B
-        } else {
-            image[i * 4 + 0] = data[i * 3 + 2]; // B
-            image[i * 4 + 1] = data[i * 3 + 1]; // G
-            image[i * 4 + 2] = data[i * 3 + 0]; // R
-        }
-        image[i * 4 + 3] = 255; // A
-    }
-    free(data);
-
-    unsigned error = lodepng_encode32_file(output_file, (unsigned char *)image, width, height);
-    if (error) {
-        fprintf(stderr, "Error encoding PNG: %s\n", lodepng_error_text(error));
-        free(image);
-        return 1;
-    }
-    free(image);
 
-    return 0;
+    struct converter converter = {0};
+    int status = convert(&converter, &options, input_file, output_file);
+    free(converter.converted);
+    free(converter.scratch);
+    return status == 0 ? 0 : 1;
 }
@@ -0,0 +1,261 @@
+#include "include/fbimg_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "include/rle.h"
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+int fbimg_open(const char *path, struct fbimg *img) {
+    memset(img, 0, sizeof(*img));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return FBIMG_EIO;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return FBIMG_EIO;
+    }
+    if (st.st_size < FBIMG_HEADER_SIZE) {
+        close(fd);
+        return FBIMG_ETRUNCATED;
+    }
+
+    // Prefault the whole file so the blit doesn't stall on page faults
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return FBIMG_EIO;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    img->map = map;
+    img->map_size = st.st_size;
+
+    const char *header = map;
+    if (memcmp(header, "FBIMG", 5) != 0) {
+        fbimg_close(img);
+        return FBIMG_EFORMAT;
+    }
+    memcpy(&img->width, header + 5, sizeof(uint32_t));
+    memcpy(&img->height, header + 9, sizeof(uint32_t));
+
+    size_t data_offset = FBIMG_HEADER_SIZE;
+    if (memcmp(header + 13, "EXT", 3) == 0) {
+        if (img->map_size < FBIMG_V2_HEADER_SIZE) {
+            fbimg_close(img);
+            return FBIMG_ETRUNCATED;
+        }
+        uint16_t version, format;
+        uint32_t offset, flags;
+        memcpy(&version, header + 16, sizeof(uint16_t));
+        memcpy(&format, header + 18, sizeof(uint16_t));
+        memcpy(&img->stride, header + 20, sizeof(uint32_t));
+        memcpy(&offset, header + 24, sizeof(uint32_t));
+        memcpy(&flags, header + 28, sizeof(uint32_t));
+        if (version != 2 || (flags & ~FBIMG_FLAG_RLE) != 0) {
+            fbimg_close(img);
+            return FBIMG_EVERSION;
+        }
+        if (format >= FBIMG_FORMAT_COUNT || offset < FBIMG_V2_HEADER_SIZE || img->stride < (uint64_t)img->width * fbimg_format_bpp(format)) {
+            fbimg_close(img);
+            return FBIMG_EFORMAT;
+        }
+        img->version = 2;
+        img->format = format;
+        img->flags = flags;
+        data_offset = offset;
+    } else {
+        img->version = 1;
+        img->format = memcmp(header + 13, "BGR", 3) == 0 ? FBIMG_FORMAT_BGR888 : FBIMG_FORMAT_RGB888;
+        img->stride = img->width * 3;
+    }
+
+    if (data_offset > img->map_size) {
+        fbimg_close(img);
+        return FBIMG_ETRUNCATED;
+    }
+    img->pixels = header + data_offset;
+    img->data_size = img->map_size - data_offset;
+
+    uint64_t data_size = 0;
+    if (img->flags & FBIMG_FLAG_RLE) {
+        // Check that every row fits before anyone starts decoding
+        for (uint32_t y = 0; y < img->height && data_size <= img->data_size; y++) {
+            uint32_t row_size;
+            if (img->data_size - data_size < sizeof(uint32_t)) {
+                data_size = UINT64_MAX;
+                break;
+            }
+            memcpy(&row_size, img->pixels + data_size, sizeof(uint32_t));
+            data_size += sizeof(uint32_t) + (uint64_t)row_size;
+        }
+    } else if (img->width > 0 && img->height > 0) {
+        // The last row only needs its pixels, not the padding up to the stride
+        data_size = (uint64_t)(img->height - 1) * img->stride + (uint64_t)img->width * fbimg_format_bpp(img->format);
+    }
+    if (data_size > img->data_size) {
+        fbimg_close(img);
+        return FBIMG_ETRUNCATED;
+    }
+    return FBIMG_OK;
+}
+
+void fbimg_close(struct fbimg *img) {
+    if (img->map) munmap(img->map, img->map_size);
+    memset(img, 0, sizeof(*img));
+}
+
+const char *fbimg_error_text(int error) {
+    switch (error) {
+        case FBIMG_OK:
+            return "No error";
+        case FBIMG_EIO:
+            return strerror(errno);
+        case FBIMG_ETRUNCATED:
+            return "Unexpected end of file";
+        case FBIMG_EFORMAT:
+            return "Not a valid FBIMG file";
+        case FBIMG_EVERSION:
+            return "Unsupported FBIMG version";
+        default:
+            return "Unknown error";
+    }
+}
+
+void fbimg_rows_begin(const struct fbimg *img, struct fbimg_rows *rows) {
+    rows->img = img;
+    rows->next = img->pixels;
+    rows->y = 0;
+}
+
+const char *fbimg_rows_next(struct fbimg_rows *rows, char *scratch) {
+    const struct fbimg *img = rows->img;
+    if (rows->y >= img->height) return NULL;
+    rows->y++;
+    const char *row = rows->next;
+    if (!(img->flags & FBIMG_FLAG_RLE)) {
+        rows->next += img->stride;
+        return row;
+    }
+
+    uint32_t size;
+    memcpy(&size, row, sizeof(uint32_t));
+    row += sizeof(uint32_t);
+    int bpp = fbimg_format_bpp(img->format);
+    // fbimg_open() already checked that the row lies inside the mapping
+    if (rle_decode((uint8_t *)scratch, img->width, (const uint8_t *)row, size, bpp) < 0) return NULL;
+    rows->next = row + size;
+    return scratch;
+}
+
+char *fbimg_decode(const struct fbimg *img) {
+    size_t row_size = (size_t)img->width * fbimg_format_bpp(img->format);
+    char *data = malloc(row_size * img->height);
+    if (!data) return NULL;
+    struct fbimg_rows rows;
+    fbimg_rows_begin(img, &rows);
+    for (uint32_t y = 0; y < img->height; y++) {
+        char *dst = data + y * row_size;
+        const char *row = fbimg_rows_next(&rows, dst);
+        if (!row) {
+            free(data);
+            return NULL;
+        }
+        if (row != dst) memcpy(dst, row, row_size);
+    }
+    return data;
+}
+
+static const struct {
+    const char *name;
+    int bpp;
+} formats[FBIMG_FORMAT_COUNT] = {
+    [FBIMG_FORMAT_RGB888] = {"rgb888", 3},
+    [FBIMG_FORMAT_BGR888] = {"bgr888", 3},
+    [FBIMG_FORMAT_XRGB8888] = {"xrgb8888", 4},
+    [FBIMG_FORMAT_RGB565] = {"rgb565", 2},
+    [FBIMG_FORMAT_BGRX8888] = {"bgrx8888", 4},
+    [FBIMG_FORMAT_ARGB8888] = {"argb8888", 4},
+};
+
+int fbimg_format_bpp(int format) {
+    return (format >= 0 && format < FBIMG_FORMAT_COUNT) ? formats[format].bpp : 0;
+}
+
+const char *fbimg_format_name(int format) {
+    return (format >= 0 && format < FBIMG_FORMAT_COUNT) ? formats[format].name : "unknown";
+}
+
+int fbimg_format_parse(const char *name) {
+    for (int i = 0; i < FBIMG_FORMAT_COUNT; i++) {
+        if (strcasecmp(name, formats[i].name) == 0) return i;
+    }
+    return -1;
+}
+
+uint32_t fbimg_stride(uint32_t width, int format) {
+    uint32_t row = width * fbimg_format_bpp(format);
+    return (row + FBIMG_V2_STRIDE_ALIGN - 1) / FBIMG_V2_STRIDE_ALIGN * FBIMG_V2_STRIDE_ALIGN;
+}
+
+int fbimg_write_header(FILE *file, uint32_t width, uint32_t height, int format, uint32_t stride, uint32_t flags) {
+    char header[FBIMG_V2_DATA_ALIGN] = {0};
+    size_t size = FBIMG_HEADER_SIZE;
+    memcpy(header, "FBIMG", 5);
+    memcpy(header + 5, &width, sizeof(uint32_t));
+    memcpy(header + 9, &height, sizeof(uint32_t));
+    if ((format == FBIMG_FORMAT_RGB888 || format == FBIMG_FORMAT_BGR888) && stride == width * 3 && flags == 0) {
+        memcpy(header + 13, format == FBIMG_FORMAT_BGR888 ? "BGR" : "RGB", 3);
+    } else {
+        uint16_t version = 2, format16 = format;
+        uint32_t offset = FBIMG_V2_DATA_ALIGN;
+        memcpy(header + 13, "EXT", 3);
+        memcpy(header + 16, &version, sizeof(uint16_t));
+        memcpy(header + 18, &format16, sizeof(uint16_t));
+        memcpy(header + 20, &stride, sizeof(uint32_t));
+        memcpy(header + 24, &offset, sizeof(uint32_t));
+        memcpy(header + 28, &flags, sizeof(uint32_t));
+        size = FBIMG_V2_DATA_ALIGN;
+    }
+    return fwrite(header, 1, size, file) == size ? 0 : -1;
+}
+
+int fbimg_writer_open(struct fbimg_writer *w, FILE *file, uint32_t width, uint32_t height, int format, uint32_t stride, uint32_t flags) {
+    int bpp = fbimg_format_bpp(format);
+    if (flags & FBIMG_FLAG_RLE) stride = width * bpp;
+    w->file = file;
+    w->width = width;
+    w->format = format;
+    w->stride = stride;
+    w->flags = flags;
+    size_t size = (flags & FBIMG_FLAG_RLE) ? sizeof(uint32_t) + rle_bound(width, bpp) : stride;
+    w->buffer = calloc(1, size);
+    if (!w->buffer) return -1;
+    return fbimg_write_header(file, width, height, format, stride, flags);
+}
+
+int fbimg_writer_row(struct fbimg_writer *w, const char *row) {
+    size_t row_size = (size_t)w->width * fbimg_format_bpp(w->format);
+    if (w->flags & FBIMG_FLAG_RLE) {
+        uint32_t size = rle_encode((uint8_t *)w->buffer + sizeof(uint32_t), (const uint8_t *)row, w->width, fbimg_format_bpp(w->format));
+        memcpy(w->buffer, &size, sizeof(uint32_t));
+        return fwrite(w->buffer, 1, sizeof(uint32_t) + size, w->file) == sizeof(uint32_t) + size ? 0 : -1;
+    }
+    if (row_size == w->stride) return fwrite(row, 1, row_size, w->file) == row_size ? 0 : -1;
+    // The padding after the pixels stays zero
+    memcpy(w->buffer, row, row_size);
+    return fwrite(w->buffer, 1, w->stride, w->file) == w->stride ? 0 : -1;
+}
+
+void fbimg_writer_free(struct fbimg_writer *w) {
+    free(w->buffer);
+    w->buffer = NULL;
+}
@@ -0,0 +1,562 @@
+// F_GET_SEALS
+#define _GNU_SOURCE
+#include "include/fbimg_server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "include/blit.h"
+#include "include/fb_device.h"
+#include "include/fbimg_file.h"
+#include "include/pixconv.h"
+#include "include/png_rows.h"
+#include "include/scale_img.h"
+
+// A file converted for drawing. The file on disk is checked against the
+// stat fields before every draw.
+struct asset {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    int width, height;
+    bool blend; // Premultiplied ARGB8888 composited over the screen, framebuffer layout otherwise
+    size_t stride;
+    char *pixels;
+    uint64_t used; // Command count at the last draw, for evicting the least recently used
+};
+
+static struct {
+    struct fb_device fb;
+    int xres, yres;
+    int bytes_per_pixel;
+    struct blitter blitters[FBIMG_FORMAT_COUNT]; // One per source format
+    char *fill_row; // A row of xres fill pixels, as RGB888 or ARGB8888
+    struct asset cache[FBIMG_SERVER_CACHE_ENTRIES];
+    int cached;
+    size_t cache_size, cache_limit;
+    uint64_t commands;
+    int threads;
+    int dirty_x0, dirty_y0, dirty_x1, dirty_y1; // Area drawn since the screen was last updated
+} server;
+
+static volatile sig_atomic_t stopping;
+
+static void stop(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static bool is_png_file(const char *path) {
+    char signature[8];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+    bool png = read(fd, signature, sizeof(signature)) == (ssize_t)sizeof(signature) && png_signature(signature, sizeof(signature));
+    close(fd);
+    return png;
+}
+
+// Decodes a PNG into packed RGB888, or ARGB8888 words if it has an alpha
+// channel. format is set to RGB888, to ARGB8888 (premultiplied) if a pixel is
+// transparent or to XRGB8888 if every one turned out to be opaque. Returns 0
+// or an errno value.
+static int decode_png(const char *path, struct asset *a, char **pixels, int *format) {
+    struct png_rows png;
+    int error = png_rows_open(path, &png);
+    if (error != PNG_OK) return error == PNG_EIO ? errno : EINVAL;
+    a->width = png.width;
+    a->height = png.height;
+    size_t row_size = (size_t)png.width * (png.alpha ? 4 : 3);
+    *pixels = malloc(row_size * png.height);
+    if (!*pixels) {
+        png_rows_close(&png);
+        return ENOMEM;
+    }
+    bool transparent = false;
+    for (uint32_t y = 0; y < png.height; y++) {
+        const char *row = png.alpha ? png_rows_next_rgba(&png) : png_rows_next(&png);
+        if (!row) {
+            png_rows_close(&png);
+            free(*pixels);
+            *pixels = NULL;
+            return EINVAL;
+        }
+        char *dst = *pixels + y * row_size;
+        if (png.alpha) {
+            for (uint32_t x = 0; x < png.width && !transparent; x++) transparent = (uint8_t)row[x * 4 + 3] != 0xFF;
+            pixconv_rgba_to_argb_premultiplied((uint32_t *)dst, (const uint8_t *)row, png.width);
+        } else {
+            memcpy(dst, row, row_size);
+        }
+    }
+    *format = !png.alpha ? FBIMG_FORMAT_RGB888 : transparent ? FBIMG_FORMAT_ARGB8888 : FBIMG_FORMAT_XRGB8888;
+    png_rows_close(&png);
+    return 0;
+}
+
+// Same for a .fbimg file, which keeps premultiplied alpha if it has it
+static int decode_fbimg(const char *path, struct asset *a, char **pixels, int *format) {
+    struct fbimg img;
+    int error = fbimg_open(path, &img);
+    if (error != FBIMG_OK) return error == FBIMG_EIO ? errno : EINVAL;
+    a->width = img.width;
+    a->height = img.height;
+    bool alpha = img.format == FBIMG_FORMAT_ARGB8888;
+    *format = alpha ? FBIMG_FORMAT_ARGB8888 : FBIMG_FORMAT_RGB888;
+    const char *data = img.pixels;
+    size_t stride = img.stride;
+    char *decoded = NULL;
+    if (img.flags & FBIMG_FLAG_RLE) {
+        data = decoded = fbimg_decode(&img);
+        stride = (size_t)img.width * fbimg_format_bpp(img.format);
+    }
+    if (data && alpha) {
+        size_t row_size = (size_t)img.width * 4;
+        *pixels = malloc(row_size * img.height);
+        for (uint32_t y = 0; *pixels && y < img.height; y++) memcpy(*pixels + y * row_size, data + y * stride, row_size);
+    } else if (data) {
+        *pixels = blit_convert_to_rgb(data, stride, img.format, img.width, img.height);
+    }
+    error = !data ? EINVAL : !*pixels ? ENOMEM : 0;
+    free(decoded);
+    fbimg_close(&img);
+    return error;
+}
+
+// Decodes a file, scales it down if it is larger than the screen and
+// converts it to the framebuffer layout, so that drawing it is a copy
+static int load_asset(const char *path, struct asset *a) {
+    char *pixels = NULL;
+    int format;
+    int error = is_png_file(path) ? decode_png(path, a, &pixels, &format) : decode_fbimg(path, a, &pixels, &format);
+    if (error) return error;
+    int bpp = fbimg_format_bpp(format);
+    a->blend = format == FBIMG_FORMAT_ARGB8888;
+
+    if (a->width > server.xres || a->height > server.yres) {
+        int width, height;
+        scale_fit(a->width, a->height, server.xres, server.yres, &width, &height);
+        char *scaled;
+        if (bpp == 4) {
+            scaled = (char *)scale_image_argb_mt((const uint32_t *)pixels, (size_t)a->width * 4, a->width, a->height, width, height, server.threads);
+        } else {
+            scaled = scale_image_mt(pixels, false, a->width, a->height, width, height, server.threads);
+        }
+        free(pixels);
+        if (!scaled) return ENOMEM;
+        pixels = scaled;
+        a->width = width;
+        a->height = height;
+    }
+
+    if (a->blend) {
+        a->pixels = pixels;
+        a->stride = (size_t)a->width * 4;
+        return 0;
+    }
+    a->stride = (size_t)a->width * server.bytes_per_pixel;
+    a->pixels = malloc(a->stride * a->height);
+    if (a->pixels) blit_image(&server.blitters[format], a->pixels, a->stride, 0, 0, pixels, (size_t)a->width * bpp, a->width, a->height);
+    free(pixels);
+    return a->pixels ? 0 : ENOMEM;
+}
+
+static void free_asset(struct asset *a) {
+    free(a->path);
+    free(a->pixels);
+}
+
+// Makes room for size more bytes, dropping the least recently used files
+static void evict(size_t size) {
+    while (server.cached > 0 && (server.cached == FBIMG_SERVER_CACHE_ENTRIES || server.cache_size + size > server.cache_limit)) {
+        int oldest = 0;
+        for (int i = 1; i < server.cached; i++) {
+            if (server.cache[i].used < server.cache[oldest].used) oldest = i;
+        }
+        server.cache_size -= server.cache[oldest].stride * server.cache[oldest].height;
+        free_asset(&server.cache[oldest]);
+        server.cache[oldest] = server.cache[--server.cached];
+    }
+}
+
+// Returns the cached file, loading it first if it is new or has changed.
+// Files larger than the whole cache are loaded into *scratch, which the
+// caller frees. Returns NULL with *error set on failure.
+static struct asset *find_asset(const char *path, struct asset *scratch, int *error) {
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        *error = errno;
+        return NULL;
+    }
+    for (int i = 0; i < server.cached; i++) {
+        struct asset *a = &server.cache[i];
+        if (strcmp(a->path, path) != 0) continue;
+        if (a->dev == st.st_dev && a->ino == st.st_ino && a->size == st.st_size && a->mtime.tv_sec == st.st_mtim.tv_sec && a->mtime.tv_nsec == st.st_mtim.tv_nsec) return a;
+        server.cache_size -= a->stride * a->height;
+        free_asset(a);
+        server.cache[i] = server.cache[--server.cached];
+        break;
+    }
+
+    struct asset loaded = {0};
+    *error = load_asset(path, &loaded);
+    if (*error) return NULL;
+    loaded.dev = st.st_dev;
+    loaded.ino = st.st_ino;
+    loaded.size = st.st_size;
+    loaded.mtime = st.st_mtim;
+    size_t size = loaded.stride * loaded.height;
+    if (size > server.cache_limit || !(loaded.path = strdup(path))) {
+        *scratch = loaded;
+        return scratch;
+    }
+    evict(size);
+    server.cache_size += size;
+    server.cache[server.cached] = loaded;
+    return &server.cache[server.cached++];
+}
+
+// Clips a width x height block at (*x, *y) to the screen and returns the
+// offset of the first visible source pixel, or false if none is visible
+static bool clip(int *x, int *y, int *width, int *height, int *src_x, int *src_y) {
+    // In 64 bits, as a client may send INT_MIN
+    int64_t left = *x, top = *y, right = left + *width, bottom = top + *height;
+    int64_t x0 = left > 0 ? left : 0, y0 = top > 0 ? top : 0;
+    int64_t x1 = right < server.xres ? right : server.xres, y1 = bottom < server.yres ? bottom : server.yres;
+    if (x1 <= x0 || y1 <= y0) return false;
+    *src_x = x0 - left;
+    *src_y = y0 - top;
+    *x = x0;
+    *y = y0;
+    *width = x1 - x0;
+    *height = y1 - y0;
+    if (*x < server.dirty_x0) server.dirty_x0 = *x;
+    if (*y < server.dirty_y0) server.dirty_y0 = *y;
+    if (*x + *width > server.dirty_x1) server.dirty_x1 = *x + *width;
+    if (*y + *height > server.dirty_y1) server.dirty_y1 = *y + *height;
+    return true;
+}
+
+static int draw_file(const struct fbimg_command *c, const char *path) {
+    struct asset scratch = {0};
+    int error;
+    struct asset *a = find_asset(path, &scratch, &error);
+    if (!a) return error;
+    a->used = server.commands;
+
+    int x = c->x, y = c->y, width = a->width, height = a->height, src_x, src_y;
+    if (c->flags & FBIMG_COMMAND_CENTERED) {
+        x = (server.xres - width) / 2;
+        y = (server.yres - height) / 2;
+    }
+    if (clip(&x, &y, &width, &height, &src_x, &src_y)) {
+        char *fb_ptr = fb_device_draw_buffer(&server.fb);
+        size_t line_length = server.fb.finfo.line_length;
+        if (a->blend) {
+            const char *src = a->pixels + (size_t)src_y * a->stride + (size_t)src_x * 4;
+            blit_image(&server.blitters[FBIMG_FORMAT_ARGB8888], fb_ptr, line_length, x, y, src, a->stride, width, height);
+        } else {
+            // Already in the framebuffer layout
+            const char *src = a->pixels + (size_t)src_y * a->stride + (size_t)src_x * server.bytes_per_pixel;
+            char *dst = fb_ptr + (size_t)y * line_length + (size_t)x * server.bytes_per_pixel;
+            size_t row_size = (size_t)width * server.bytes_per_pixel;
+            for (int i = 0; i < height; i++, dst += line_length, src += a->stride) memcpy(dst, src, row_size);
+        }
+    }
+    free_asset(&scratch);
+    return 0;
+}
+
+static int draw_buffer(const struct fbimg_command *c, int fd) {
+    if (fd < 0) return EBADF;
+    int bpp = fbimg_format_bpp(c->format);
+    if (bpp == 0 || c->width == 0 || c->height == 0 || c->width > INT_MAX || c->height > INT_MAX || c->stride < (uint64_t)c->width * bpp) return EINVAL;
+    // 32 and 16-bit pixels are read as words
+    if (bpp != 3 && (c->stride % bpp != 0 || c->offset % bpp != 0)) return EINVAL;
+    // The buffer is mapped, so a client shrinking it while it is drawn would
+    // raise SIGBUS here
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals == -1 || !(seals & F_SEAL_SHRINK)) return EINVAL;
+    struct stat st;
+    if (fstat(fd, &st) == -1) return errno;
+    uint64_t end = c->offset + (uint64_t)c->stride * (c->height - 1) + (uint64_t)c->width * bpp;
+    if (end > (uint64_t)st.st_size || end > SIZE_MAX) return EINVAL;
+
+    int x = c->x, y = c->y, width = c->width, height = c->height, src_x, src_y;
+    if (!clip(&x, &y, &width, &height, &src_x, &src_y)) return 0;
+    // Mapping only the pages that are drawn keeps this cheap for large buffers
+    uint64_t first = c->offset + (uint64_t)src_y * c->stride;
+    uint64_t start = first & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+    size_t size = first - start + (size_t)c->stride * (height - 1) + (size_t)(src_x + width) * bpp;
+    char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, start);
+    if (map == MAP_FAILED) return errno;
+    const char *src = map + (first - start) + (size_t)src_x * bpp;
+    blit_image(&server.blitters[c->format], fb_device_draw_buffer(&server.fb), server.fb.finfo.line_length, x, y, src, c->stride, width, height);
+    munmap(map, size);
+    return 0;
+}
+
+static int fill(const struct fbimg_command *c) {
+    uint32_t alpha = c->color >> 24;
+    if (alpha == 0 || c->width > INT_MAX || c->height > INT_MAX) return alpha == 0 ? 0 : EINVAL;
+    int x = c->x, y = c->y, width = c->width, height = c->height, src_x, src_y;
+    if (!clip(&x, &y, &width, &height, &src_x, &src_y)) return 0;
+    // Every row of the rectangle is drawn from the same source row
+    int format;
+    if (alpha == 255) {
+        uint8_t rgb[3] = {c->color >> 16, c->color >> 8, c->color};
+        for (int i = 0; i < width; i++) memcpy(server.fill_row + i * 3, rgb, 3);
+        format = FBIMG_FORMAT_RGB888;
+    } else {
+        uint8_t rgba[4] = {c->color >> 16, c->color >> 8, c->color, alpha};
+        uint32_t pixel;
+        pixconv_rgba_to_argb_premultiplied(&pixel, rgba, 1);
+        pixconv_fill32((uint32_t *)server.fill_row, pixel, width);
+        format = FBIMG_FORMAT_ARGB8888;
+    }
+    blit_image(&server.blitters[format], fb_device_draw_buffer(&server.fb), server.fb.finfo.line_length, x, y, server.fill_row, 0, width, height);
+    return 0;
+}
+
+// Runs one command and updates the screen unless more are announced
+static int run_command(const struct fbimg_command *c, const char *path, int fd) {
+    server.commands++;
+    int error;
+    switch (c->type) {
+        case FBIMG_COMMAND_DRAW_FILE:
+            error = path ? draw_file(c, path) : EINVAL;
+            break;
+        case FBIMG_COMMAND_DRAW_BUFFER:
+            error = draw_buffer(c, fd);
+            break;
+        case FBIMG_COMMAND_FILL:
+            error = fill(c);
+            break;
+        default:
+            error = EINVAL;
+    }
+    if (!(c->flags & FBIMG_COMMAND_MORE) && server.dirty_x1 > server.dirty_x0) {
+        if (fb_device_present(&server.fb, server.dirty_x0, server.dirty_y0, server.dirty_x1 - server.dirty_x0, server.dirty_y1 - server.dirty_y0) == -1 && !error) error = errno;
+        server.dirty_x0 = server.xres;
+        server.dirty_y0 = server.yres;
+        server.dirty_x1 = server.dirty_y1 = 0;
+    }
+    return error;
+}
+
+// Reads and answers one message. Returns -1 when the client has to be
+// dropped.
+static int serve_client(int sock) {
+    struct fbimg_command command;
+    char path[PATH_MAX];
+    struct iovec iov[2] = {{&command, sizeof(command)}, {path, sizeof(path) - 1}};
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2, .msg_control = &control, .msg_controllen = sizeof(control)};
+    ssize_t size = recvmsg(sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (size == -1) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+    // Every descriptor the kernel installed is ours to close, however many
+    // the client sent. Only a single one is accepted.
+    int fd = -1, fds = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++, fds++) {
+            int received;
+            memcpy(&received, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (fd == -1) {
+                fd = received;
+            } else {
+                close(received);
+            }
+        }
+    }
+    if (size == 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    struct fbimg_reply reply = {0};
+    if (size < (ssize_t)sizeof(command) || (msg.msg_flags & MSG_TRUNC) || command.path_size != size - sizeof(command)) {
+        reply.error = EMSGSIZE;
+    } else if (fds > 1 || (msg.msg_flags & MSG_CTRUNC)) {
+        reply.error = EINVAL;
+    } else {
+        path[command.path_size] = '\0';
+        reply.error = run_command(&command, command.path_size > 0 ? path : NULL, fd);
+    }
+    if (fd >= 0) close(fd);
+    // A client that doesn't read its replies would block everyone else
+    if (send(sock, &reply, sizeof(reply), MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)sizeof(reply)) return -1;
+    return 0;
+}
+
+static int listen_on(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1) return -1;
+    int result = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+    if (result == -1 && errno == EADDRINUSE) {
+        // A socket left behind by a server that is gone can be replaced
+        int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        bool alive = probe != -1 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (probe != -1) close(probe);
+        if (!alive) {
+            unlink(path);
+            result = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+        } else {
+            errno = EADDRINUSE;
+        }
+    }
+    if (result == -1 || listen(sock, FBIMG_SERVER_MAX_CLIENTS) == -1) {
+        int error = errno;
+        close(sock);
+        errno = error;
+        return -1;
+    }
+    return sock;
+}
+
+int fbimg_server_run(const char *socket_path, const char *device, size_t cache_size, int threads) {
+    memset(&server, 0, sizeof(server));
+    server.cache_limit = cache_size;
+    server.threads = threads;
+    if (fb_device_open(&server.fb, fb_device_path(device), true) == -1) return -1;
+    const struct fb_var_screeninfo *vinfo = &server.fb.vinfo;
+    for (int format = 0; format < FBIMG_FORMAT_COUNT; format++) {
+        if (blit_init(&server.blitters[format], vinfo, format) != 0) {
+            fb_device_close(&server.fb);
+            errno = ENOTSUP;
+            return -1;
+        }
+    }
+    server.xres = vinfo->xres;
+    server.yres = vinfo->yres;
+    server.bytes_per_pixel = server.blitters[0].bytes_per_pixel;
+    server.dirty_x0 = server.xres;
+    server.dirty_y0 = server.yres;
+    server.fill_row = malloc((size_t)server.xres * 4);
+    if (!server.fill_row || fb_device_map(&server.fb) == -1) {
+        int error = server.fill_row ? errno : ENOMEM;
+        free(server.fill_row);
+        fb_device_close(&server.fb);
+        errno = error;
+        return -1;
+    }
+    int listener = listen_on(socket_path);
+    if (listener == -1) {
+        int error = errno;
+        free(server.fill_row);
+        fb_device_close(&server.fb);
+        errno = error;
+        return -1;
+    }
+
+    // No SA_RESTART, so poll() returns when asked to stop
+    struct sigaction action = {.sa_handler = stop};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct pollfd fds[1 + FBIMG_SERVER_MAX_CLIENTS];
+    int clients = 0;
+    fds[0] = (struct pollfd){listener, POLLIN, 0};
+    while (!stopping) {
+        if (poll(fds, 1 + clients, -1) == -1) continue;
+        for (int i = 1; i <= clients; i++) {
+            if (!fds[i].revents) continue;
+            if ((fds[i].revents & POLLIN) ? serve_client(fds[i].fd) == -1 : true) {
+                close(fds[i].fd);
+                fds[i--] = fds[clients--];
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int sock = accept(listener, NULL, NULL);
+            if (sock != -1 && clients == FBIMG_SERVER_MAX_CLIENTS) {
+                close(sock);
+            } else if (sock != -1) {
+                fds[++clients] = (struct pollfd){sock, POLLIN, 0};
+            }
+        }
+    }
+
+    for (int i = 1; i <= clients; i++) close(fds[i].fd);
+    close(listener);
+    unlink(socket_path);
+    for (int i = 0; i < server.cached; i++) free_asset(&server.cache[i]);
+    free(server.fill_row);
+    fb_device_close(&server.fb);
+    return 0;
+}
+
+int fbimg_client_connect(const char *socket_path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1) return -1;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        int error = errno;
+        close(sock);
+        errno = error;
+        return -1;
+    }
+    return sock;
+}
+
+int fbimg_client_send(int sock, const struct fbimg_command *command, const char *path, int buffer_fd) {
+    struct fbimg_command c = *command;
+    c.path_size = path ? strlen(path) : 0;
+    struct iovec iov[2] = {{&c, sizeof(c)}, {(void *)path, c.path_size}};
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = path ? 2 : 1};
+    if (buffer_fd >= 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = &control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &buffer_fd, sizeof(int));
+    }
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) == -1) return -1;
+    struct fbimg_reply reply;
+    ssize_t size = recv(sock, &reply, sizeof(reply), 0);
+    if (size != (ssize_t)sizeof(reply)) {
+        if (size >= 0) errno = EPROTO;
+        return -1;
+    }
+    if (reply.error != 0) {
+        errno = reply.error;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,197 @@
+#include "include/fbseq.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "include/fbimg_file.h"
+#include "include/rle.h"
+
+// Frame record: timestamp (u64), tile count (u32), payload size (u32), then
+// per tile its column and row (u16 each), encoded size (u32) and RLE data
+#define FRAME_HEADER_SIZE 16
+#define TILE_HEADER_SIZE 8
+
+static uint32_t tiles_across(uint32_t size, int tile_size) {
+    return (size + tile_size - 1) / tile_size;
+}
+
+int fbseq_writer_open(struct fbseq_writer *w, FILE *file, uint32_t width, uint32_t height, int format, int64_t start_time) {
+    memset(w, 0, sizeof(*w));
+    w->file = file;
+    w->width = width;
+    w->height = height;
+    w->format = format;
+    w->bpp = fbimg_format_bpp(format);
+
+    size_t frame_size = (size_t)width * height * w->bpp;
+    size_t tile_pixels = FBSEQ_TILE_SIZE * FBSEQ_TILE_SIZE;
+    size_t tile_count = (size_t)tiles_across(width, FBSEQ_TILE_SIZE) * tiles_across(height, FBSEQ_TILE_SIZE);
+    w->buffer_size = FRAME_HEADER_SIZE + tile_count * (TILE_HEADER_SIZE + rle_bound(tile_pixels, w->bpp));
+    w->previous = malloc(frame_size);
+    w->tile = malloc(tile_pixels * w->bpp);
+    w->buffer = malloc(w->buffer_size);
+    if (!w->previous || !w->tile || !w->buffer) return -1;
+
+    char header[FBSEQ_HEADER_SIZE] = {0};
+    uint16_t version = 1, format16 = format, tile_size = FBSEQ_TILE_SIZE;
+    memcpy(header, "FBSEQ", 5);
+    memcpy(header + 5, &width, sizeof(uint32_t));
+    memcpy(header + 9, &height, sizeof(uint32_t));
+    memcpy(header + 16, &version, sizeof(uint16_t));
+    memcpy(header + 18, &format16, sizeof(uint16_t));
+    memcpy(header + 20, &tile_size, sizeof(uint16_t));
+    memcpy(header + 24, &start_time, sizeof(int64_t));
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) return -1;
+    return fflush(file) == 0 ? 0 : -1;
+}
+
+int fbseq_write_frame(struct fbseq_writer *w, const char *frame, uint64_t timestamp) {
+    size_t stride = (size_t)w->width * w->bpp;
+    char *out = w->buffer + FRAME_HEADER_SIZE;
+    uint32_t count = 0;
+    for (uint32_t ty = 0; ty * FBSEQ_TILE_SIZE < w->height; ty++) {
+        uint32_t y0 = ty * FBSEQ_TILE_SIZE;
+        uint32_t rows = w->height - y0 < FBSEQ_TILE_SIZE ? w->height - y0 : FBSEQ_TILE_SIZE;
+        for (uint32_t tx = 0; tx * FBSEQ_TILE_SIZE < w->width; tx++) {
+            uint32_t x0 = tx * FBSEQ_TILE_SIZE;
+            uint32_t columns = w->width - x0 < FBSEQ_TILE_SIZE ? w->width - x0 : FBSEQ_TILE_SIZE;
+            size_t offset = y0 * stride + (size_t)x0 * w->bpp;
+            size_t tile_row = (size_t)columns * w->bpp;
+
+            bool changed = !w->started;
+            for (uint32_t y = 0; y < rows && !changed; y++) changed = memcmp(frame + offset + y * stride, w->previous + offset + y * stride, tile_row) != 0;
+            if (!changed) continue;
+
+            for (uint32_t y = 0; y < rows; y++) memcpy(w->tile + y * tile_row, frame + offset + y * stride, tile_row);
+            uint16_t column16 = tx, row16 = ty;
+            uint32_t size = rle_encode((uint8_t *)out + TILE_HEADER_SIZE, (const uint8_t *)w->tile, (size_t)columns * rows, w->bpp);
+            memcpy(out, &column16, sizeof(uint16_t));
+            memcpy(out + 2, &row16, sizeof(uint16_t));
+            memcpy(out + 4, &size, sizeof(uint32_t));
+            out += TILE_HEADER_SIZE + size;
+            count++;
+        }
+    }
+    memcpy(w->previous, frame, stride * w->height);
+    w->started = true;
+
+    uint32_t payload = out - w->buffer - FRAME_HEADER_SIZE;
+    memcpy(w->buffer, &timestamp, sizeof(uint64_t));
+    memcpy(w->buffer + 8, &count, sizeof(uint32_t));
+    memcpy(w->buffer + 12, &payload, sizeof(uint32_t));
+    // Flush every frame so an interrupted recording keeps all complete frames
+    size_t size = out - w->buffer;
+    if (fwrite(w->buffer, 1, size, w->file) != size) return -1;
+    return fflush(w->file) == 0 ? 0 : -1;
+}
+
+void fbseq_writer_free(struct fbseq_writer *w) {
+    free(w->previous);
+    free(w->tile);
+    free(w->buffer);
+    memset(w, 0, sizeof(*w));
+}
+
+int fbseq_open(const char *path, struct fbseq *seq) {
+    memset(seq, 0, sizeof(*seq));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return FBIMG_EIO;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return FBIMG_EIO;
+    }
+    if (st.st_size < FBSEQ_HEADER_SIZE) {
+        close(fd);
+        return FBIMG_ETRUNCATED;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return FBIMG_EIO;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    seq->map = map;
+    seq->map_size = st.st_size;
+
+    const char *header = map;
+    uint16_t version, format, tile_size;
+    memcpy(&seq->width, header + 5, sizeof(uint32_t));
+    memcpy(&seq->height, header + 9, sizeof(uint32_t));
+    memcpy(&version, header + 16, sizeof(uint16_t));
+    memcpy(&format, header + 18, sizeof(uint16_t));
+    memcpy(&tile_size, header + 20, sizeof(uint16_t));
+    memcpy(&seq->start_time, header + 24, sizeof(int64_t));
+    if (memcmp(header, "FBSEQ", 5) != 0 || format >= FBIMG_FORMAT_COUNT || tile_size == 0) {
+        fbseq_close(seq);
+        return FBIMG_EFORMAT;
+    }
+    if (version != 1) {
+        fbseq_close(seq);
+        return FBIMG_EVERSION;
+    }
+    seq->format = format;
+    seq->tile_size = tile_size;
+    seq->data = header + FBSEQ_HEADER_SIZE;
+    seq->size = seq->map_size - FBSEQ_HEADER_SIZE;
+    seq->frame = calloc((size_t)seq->width * seq->height, fbimg_format_bpp(format));
+    if (!seq->frame) {
+        fbseq_close(seq);
+        errno = ENOMEM;
+        return FBIMG_EIO;
+    }
+    return FBIMG_OK;
+}
+
+int fbseq_next(struct fbseq *seq) {
+    if (seq->size - seq->pos < FRAME_HEADER_SIZE) return 0;
+    const char *record = seq->data + seq->pos;
+    uint64_t timestamp;
+    uint32_t count, payload;
+    memcpy(&timestamp, record, sizeof(uint64_t));
+    memcpy(&count, record + 8, sizeof(uint32_t));
+    memcpy(&payload, record + 12, sizeof(uint32_t));
+    if (payload > seq->size - seq->pos - FRAME_HEADER_SIZE) return 0;
+
+    int bpp = fbimg_format_bpp(seq->format);
+    size_t stride = (size_t)seq->width * bpp;
+    uint32_t tile_size = seq->tile_size;
+    char *tile = malloc((size_t)tile_size * tile_size * bpp);
+    if (!tile) return -1;
+    const char *in = record + FRAME_HEADER_SIZE;
+    const char *end = in + payload;
+    uint32_t applied = 0;
+    for (; applied < count; applied++) {
+        uint16_t tx, ty;
+        uint32_t size;
+        if (end - in < TILE_HEADER_SIZE) break;
+        memcpy(&tx, in, sizeof(uint16_t));
+        memcpy(&ty, in + 2, sizeof(uint16_t));
+        memcpy(&size, in + 4, sizeof(uint32_t));
+        in += TILE_HEADER_SIZE;
+        uint64_t x0 = (uint64_t)tx * tile_size, y0 = (uint64_t)ty * tile_size;
+        if (size > (size_t)(end - in) || x0 >= seq->width || y0 >= seq->height) break;
+        uint32_t columns = seq->width - x0 < tile_size ? seq->width - x0 : tile_size;
+        uint32_t rows = seq->height - y0 < tile_size ? seq->height - y0 : tile_size;
+        if (rle_decode((uint8_t *)tile, (size_t)columns * rows, (const uint8_t *)in, size, bpp) < 0) break;
+        for (uint32_t y = 0; y < rows; y++) memcpy(seq->frame + (y0 + y) * stride + x0 * bpp, tile + (size_t)y * columns * bpp, (size_t)columns * bpp);
+        in += size;
+    }
+    free(tile);
+    if (applied != count) return -1;
+    seq->pos += FRAME_HEADER_SIZE + payload;
+    seq->timestamp = timestamp;
+    seq->frame_index++;
+    return 1;
+}
+
+void fbseq_close(struct fbseq *seq) {
+    if (seq->map) munmap(seq->map, seq->map_size);
+    free(seq->frame);
+    memset(seq, 0, sizeof(*seq));
+}
@@ -0,0 +1,263 @@
+#include "include/history.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/fbimg_file.h"
+#include "include/rle.h"
+
+// Canvas area of a tile, smaller than a full tile at the right and bottom edges
+static void tile_rect(const struct history *h, int tx, int ty, struct canvas_rect *r) {
+    r->x = tx * HISTORY_TILE_SIZE;
+    r->y = ty * HISTORY_TILE_SIZE;
+    r->width = h->canvas->width - r->x < HISTORY_TILE_SIZE ? (int)h->canvas->width - r->x : HISTORY_TILE_SIZE;
+    r->height = h->canvas->height - r->y < HISTORY_TILE_SIZE ? (int)h->canvas->height - r->y : HISTORY_TILE_SIZE;
+}
+
+static char *slot_pixels(const struct history *h, int slot) {
+    return h->pool + (size_t)slot * h->slot_size;
+}
+
+// Copies a tile of the canvas into packed rows
+static void copy_tile(const struct history *h, int tx, int ty, char *dst) {
+    struct canvas_rect r;
+    tile_rect(h, tx, ty, &r);
+    size_t row_size = (size_t)r.width * h->bpp;
+    const char *src = h->canvas->pixels + (size_t)r.y * h->canvas->stride + (size_t)r.x * h->bpp;
+    for (int i = 0; i < r.height; i++, src += h->canvas->stride, dst += row_size) memcpy(dst, src, row_size);
+}
+
+// Exchanges a tile of the canvas with packed rows and marks it dirty
+static void swap_tile(struct history *h, int tx, int ty, char *pixels) {
+    struct canvas_rect r;
+    tile_rect(h, tx, ty, &r);
+    size_t row_size = (size_t)r.width * h->bpp;
+    char *row = h->canvas->pixels + (size_t)r.y * h->canvas->stride + (size_t)r.x * h->bpp;
+    char tmp[HISTORY_TILE_SIZE * 4];
+    for (int i = 0; i < r.height; i++, row += h->canvas->stride, pixels += row_size) {
+        memcpy(tmp, row, row_size);
+        memcpy(row, pixels, row_size);
+        memcpy(pixels, tmp, row_size);
+    }
+    canvas_damage(h->canvas, r.x, r.y, r.width, r.height);
+}
+
+static void release_slot(struct history *h, int slot) {
+    h->free_slots[h->free_count++] = slot;
+    h->used -= h->slot_size;
+}
+
+static void release_step(struct history *h, struct history_step *step) {
+    for (int i = 0; i < step->count; i++) {
+        if (step->tiles[i].slot >= 0) release_slot(h, step->tiles[i].slot);
+    }
+    free(step->tiles);
+    free(step->blob);
+    h->used -= step->blob_size;
+    memset(step, 0, sizeof(*step));
+}
+
+// Drops the oldest step that can be undone, unless it is steps[*keep]. keep
+// follows the step it points at. Returns 0 on success, -1 if there is none.
+static int drop_oldest(struct history *h, int *keep) {
+    if (h->done == 0 || (keep && *keep == 0)) return -1;
+    release_step(h, &h->steps[0]);
+    memmove(h->steps, h->steps + 1, (h->step_count - 1) * sizeof(*h->steps));
+    h->step_count--;
+    h->done--;
+    if (keep) (*keep)--;
+    return 0;
+}
+
+// Returns a free slot, dropping old steps to stay inside the budget, or -1
+static int take_slot(struct history *h, int *keep) {
+    while (h->free_count == 0 || h->used + h->slot_size > h->budget) {
+        if (drop_oldest(h, keep) != 0) return -1;
+    }
+    h->used += h->slot_size;
+    return h->free_slots[--h->free_count];
+}
+
+static void clear_steps(struct history *h, int from) {
+    for (int i = from; i < h->step_count; i++) release_step(h, &h->steps[i]);
+    h->step_count = from;
+    if (h->done > from) h->done = from;
+}
+
+// Run-length codes the tiles of a step and gives their slots back, if that
+// saves memory
+static void compress_step(struct history *h, struct history_step *step) {
+    if (step->blob || step->count == 0) return;
+    size_t bound = 0;
+    for (int i = 0; i < step->count; i++) bound += rle_bound((size_t)HISTORY_TILE_SIZE * HISTORY_TILE_SIZE, h->bpp);
+    char *blob = malloc(bound);
+    if (!blob) return;
+    size_t size = 0;
+    for (int i = 0; i < step->count; i++) {
+        struct history_tile *tile = &step->tiles[i];
+        struct canvas_rect r;
+        tile_rect(h, tile->tx, tile->ty, &r);
+        tile->offset = size;
+        tile->size = rle_encode((uint8_t *)blob + size, (const uint8_t *)slot_pixels(h, tile->slot), (size_t)r.width * r.height, h->bpp);
+        size += tile->size;
+    }
+    if (size >= (size_t)step->count * h->slot_size) {
+        free(blob);
+        return;
+    }
+    char *shrunk = realloc(blob, size > 0 ? size : 1);
+    step->blob = shrunk ? shrunk : blob;
+    step->blob_size = size;
+    h->used += size;
+    for (int i = 0; i < step->count; i++) {
+        release_slot(h, step->tiles[i].slot);
+        step->tiles[i].slot = -1;
+    }
+}
+
+// Decodes the compressed tiles of steps[*index] back into slots. Returns 0
+// on success, -1 if there aren't enough slots.
+static int expand_step(struct history *h, int *index) {
+    struct history_step *step = &h->steps[*index];
+    if (!step->blob) return 0;
+    for (int i = 0; i < step->count; i++) {
+        if (step->tiles[i].slot >= 0) continue;
+        int slot = take_slot(h, index);
+        step = &h->steps[*index];
+        if (slot < 0) return -1;
+        struct history_tile *tile = &step->tiles[i];
+        struct canvas_rect r;
+        tile_rect(h, tile->tx, tile->ty, &r);
+        rle_decode((uint8_t *)slot_pixels(h, slot), (size_t)r.width * r.height, (const uint8_t *)step->blob + tile->offset, tile->size, h->bpp);
+        tile->slot = slot;
+    }
+    free(step->blob);
+    h->used -= step->blob_size;
+    step->blob = NULL;
+    step->blob_size = 0;
+    return 0;
+}
+
+int history_init(struct history *h, struct canvas *canvas, size_t budget, bool compress) {
+    memset(h, 0, sizeof(*h));
+    h->canvas = canvas;
+    h->bpp = fbimg_format_bpp(canvas->format);
+    h->tiles_x = (canvas->width + HISTORY_TILE_SIZE - 1) / HISTORY_TILE_SIZE;
+    h->tiles_y = (canvas->height + HISTORY_TILE_SIZE - 1) / HISTORY_TILE_SIZE;
+    h->slot_size = (size_t)HISTORY_TILE_SIZE * HISTORY_TILE_SIZE * h->bpp;
+    h->budget = budget;
+    h->compress = compress;
+    // The pool is only touched as slots are used, so reserving the whole
+    // budget costs address space rather than memory
+    int slots = budget / h->slot_size;
+    size_t tiles = (size_t)h->tiles_x * h->tiles_y;
+    h->pool = malloc((size_t)slots * h->slot_size + 1);
+    h->free_slots = malloc(((size_t)slots + 1) * sizeof(int));
+    h->saved = calloc(tiles, 1);
+    h->open_tiles = malloc((tiles + 1) * sizeof(*h->open_tiles));
+    if (!h->pool || !h->free_slots || !h->saved || !h->open_tiles) {
+        history_free(h);
+        return -1;
+    }
+    // Hand out low slots first so the pool stays compact
+    for (int i = 0; i < slots; i++) h->free_slots[i] = slots - 1 - i;
+    h->free_count = slots;
+    return 0;
+}
+
+void history_free(struct history *h) {
+    clear_steps(h, 0);
+    free(h->steps);
+    free(h->open_tiles);
+    free(h->saved);
+    free(h->free_slots);
+    free(h->pool);
+    memset(h, 0, sizeof(*h));
+}
+
+void history_begin(struct history *h) {
+    if (h->recording) history_end(h);
+    clear_steps(h, h->done);
+    h->recording = true;
+    h->overflow = false;
+    h->open_count = 0;
+}
+
+void history_save(struct history *h, int x, int y, int width, int height) {
+    if (!h->recording || h->overflow) return;
+    int right = x + width, bottom = y + height;
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (right > (int)h->canvas->width) right = h->canvas->width;
+    if (bottom > (int)h->canvas->height) bottom = h->canvas->height;
+    if (right <= x || bottom <= y) return;
+
+    for (int ty = y / HISTORY_TILE_SIZE; ty <= (bottom - 1) / HISTORY_TILE_SIZE; ty++) {
+        for (int tx = x / HISTORY_TILE_SIZE; tx <= (right - 1) / HISTORY_TILE_SIZE; tx++) {
+            uint8_t *saved = &h->saved[ty * h->tiles_x + tx];
+            if (*saved) continue;
+            int slot = take_slot(h, NULL);
+            if (slot < 0) {
+                h->overflow = true;
+                return;
+            }
+            copy_tile(h, tx, ty, slot_pixels(h, slot));
+            h->open_tiles[h->open_count++] = (struct history_tile){tx, ty, slot, 0, 0};
+            *saved = 1;
+        }
+    }
+}
+
+void history_end(struct history *h) {
+    if (!h->recording) return;
+    h->recording = false;
+    for (int i = 0; i < h->open_count; i++) h->saved[h->open_tiles[i].ty * h->tiles_x + h->open_tiles[i].tx] = 0;
+    if (h->open_count == 0 && !h->overflow) return;
+
+    struct history_step step = {malloc(h->open_count * sizeof(*step.tiles)), h->open_count, NULL, 0};
+    if (!h->overflow && step.tiles && h->step_count == h->step_capacity) {
+        int capacity = h->step_capacity ? h->step_capacity * 2 : 64;
+        struct history_step *steps = realloc(h->steps, capacity * sizeof(*steps));
+        if (steps) {
+            h->steps = steps;
+            h->step_capacity = capacity;
+        }
+    }
+    if (h->overflow || !step.tiles || h->step_count == h->step_capacity) {
+        // Part of the stroke wasn't saved, so no earlier step can be undone
+        // without mixing old and new pixels either
+        for (int i = 0; i < h->open_count; i++) release_slot(h, h->open_tiles[i].slot);
+        free(step.tiles);
+        clear_steps(h, 0);
+        h->open_count = 0;
+        return;
+    }
+    memcpy(step.tiles, h->open_tiles, h->open_count * sizeof(*step.tiles));
+    h->open_count = 0;
+    h->steps[h->step_count++] = step;
+    h->done = h->step_count;
+    if (h->compress && h->done > HISTORY_RECENT) compress_step(h, &h->steps[h->done - 1 - HISTORY_RECENT]);
+}
+
+int history_undo(struct history *h) {
+    history_end(h);
+    if (h->done == 0) return 0;
+    int index = h->done - 1;
+    if (expand_step(h, &index) != 0) return 0;
+    struct history_step *step = &h->steps[index];
+    for (int i = 0; i < step->count; i++) swap_tile(h, step->tiles[i].tx, step->tiles[i].ty, slot_pixels(h, step->tiles[i].slot));
+    h->done = index;
+    return 1;
+}
+
+int history_redo(struct history *h) {
+    history_end(h);
+    if (h->done == h->step_count) return 0;
+    int index = h->done;
+    if (expand_step(h, &index) != 0) return 0;
+    struct history_step *step = &h->steps[index];
+    for (int i = 0; i < step->count; i++) swap_tile(h, step->tiles[i].tx, step->tiles[i].ty, slot_pixels(h, step->tiles[i].slot));
+    h->done = index + 1;
+    return 1;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <stddef.h>
+#include <stdio.h>
+
+// Converts many files on a pool of threads, each output named after its
+// input with the extension replaced and placed in one directory
+struct batch_ops {
+    const char *extension; // Of the output files, such as ".fbimg"
+    // Converts one file. state belongs to the calling thread and starts out
+    // NULL, so buffers can be kept from one file to the next. Returns 0 on
+    // success, -1 after printing an error.
+    int (*convert)(void **state, const char *input, const char *output, void *ctx);
+    void (*free_state)(void *state);
+    void *ctx;
+};
+
+// Converts count files on jobs threads, all online CPUs if jobs <= 0, and
+// prints a throughput summary. out_dir is created if it doesn't exist.
+// Returns the number of files that failed, or -1 if the batch couldn't
+// start, such as when two inputs would get the same output name.
+int batch_run(const struct batch_ops *ops, char **inputs, size_t count, const char *out_dir, int jobs);
+
+// Reads one path per line, for a batch given on stdin. Returns the paths,
+// or NULL if memory runs out.
+char **batch_read_paths(FILE *file, size_t *count);
+void batch_free_paths(char **paths, size_t count);
@@ -0,0 +1,73 @@
+#pragma once
+#include <linux/fb.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fbimg_file.h"
+
+// Framebuffer pixel layouts, named after the 32/24/16-bit word from the most
+// significant byte down (XRGB8888 is stored as B, G, R, X in memory)
+enum fb_layout {
+    FB_LAYOUT_UNSUPPORTED,
+    FB_LAYOUT_XRGB8888,
+    FB_LAYOUT_ARGB8888,
+    FB_LAYOUT_BGRX8888,
+    FB_LAYOUT_GENERIC32, // Any other 32 bpp layout with byte aligned 8-bit channels
+    FB_LAYOUT_RGB888,
+    FB_LAYOUT_BGR888,
+    FB_LAYOUT_RGB565,
+};
+
+// Source pixels are converted in chunks of this many pixels when they first
+// have to be unpacked to RGB888
+#define BLIT_CHUNK 1024
+
+struct blitter;
+typedef void (*blit_row_fn)(const struct blitter *b, uint8_t *dst, const uint8_t *src, int width);
+
+struct blitter {
+    enum fb_layout layout;
+    int bytes_per_pixel;
+    int xres;
+    int format; // Source pixel format, enum fbimg_format
+    int src_bpp;
+    bool direct; // Source rows are already in the framebuffer layout
+    bool blend; // Source rows are premultiplied ARGB8888, composited over the framebuffer
+    bool bgr; // 3-byte source pixels are stored as B, G, R instead of R, G, B
+    uint32_t fill; // Bits of a 32 bpp pixel not covered by a color channel, set to 1
+    int shift[3]; // Bit position of source bytes 0, 1 and 2 in a 32 bpp pixel
+    blit_row_fn unpack_row; // Non 3-byte source row to RGB888, NULL otherwise
+    blit_row_fn row; // 3-byte source row to framebuffer row
+    blit_row_fn read_row; // Framebuffer row back to packed 3-byte pixels
+};
+
+enum fb_layout fb_detect_layout(const struct fb_var_screeninfo *vinfo);
+const char *fb_layout_name(enum fb_layout layout);
+
+// The .fbimg format that stores pixels exactly like the layout, or -1
+int fb_layout_format(enum fb_layout layout);
+// Fills in the bit depth and channel offsets of a framebuffer that has the
+// same layout as format
+void fbimg_format_vinfo(int format, struct fb_var_screeninfo *vinfo);
+
+// Picks the row kernels for the given source format and framebuffer layout.
+// Returns 0 on success, -1 if the framebuffer layout is not supported.
+int blit_init(struct blitter *b, const struct fb_var_screeninfo *vinfo, int format);
+
+// Copies a width x height block of source pixels to (x, y) in the framebuffer,
+// or composites it over what is there for ARGB8888 sources
+void blit_image(const struct blitter *b, char *fb_ptr, size_t line_length, int x, int y, const char *src, size_t src_stride, int width, int height);
+
+// Copies a whole .fbimg to (x, y) in the framebuffer. Compressed rows are
+// decoded straight into the framebuffer when no conversion is needed. Returns
+// 0 on success, -1 on corrupt data or allocation errors.
+int blit_fbimg(const struct blitter *b, char *fb_ptr, size_t line_length, int x, int y, const struct fbimg *img);
+
+// Reads a width x height block at (x, y) back into packed 3-byte pixels, in
+// B, G, R order if the blitter was set up for BGR888
+void blit_read_image(const struct blitter *b, const char *fb_ptr, size_t line_length, int x, int y, char *dst, size_t dst_stride, int width, int height);
+
+// Unpacks pixels of any .fbimg format into a new tightly packed RGB888 buffer.
+// Returns NULL if it can't be allocated.
+char *blit_convert_to_rgb(const char *src, size_t src_stride, int format, int width, int height);
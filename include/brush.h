@@ -0,0 +1,29 @@
+#pragma once
+#include <linux/fb.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blit.h"
+#include "raster.h"
+
+// A round brush that paints straight into framebuffer memory. The color is
+// packed into the framebuffer layout once and the disc's row extents are
+// kept for the current size, so a stroke only fills spans.
+struct brush {
+    struct blitter blitter; // Packs RGB888 colors into the framebuffer layout
+    struct raster_disc disc;
+    int bytes_per_pixel;
+    uint8_t pixel[4]; // Brush color in the framebuffer layout
+    uint32_t word; // pixel repeated over 32 bits for 2 and 4 byte pixels
+};
+
+// size is the diameter in pixels. Returns 0 on success, -1 if the layout is
+// not supported or the extents can't be allocated.
+int brush_init(struct brush *brush, const struct fb_var_screeninfo *vinfo, int size, const char color[3]);
+// Returns 0 on success, -1 if the extents can't be allocated
+int brush_set_size(struct brush *brush, int size);
+void brush_set_color(struct brush *brush, const char color[3]);
+void brush_free(struct brush *brush);
+
+// Paints a stroke from (x0, y0) to (x1, y1), clipped to clip
+void brush_stroke(const struct brush *brush, char *fb_ptr, size_t line_length, int x0, int y0, int x1, int y1, const struct raster_clip *clip);
@@ -0,0 +1,48 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blit.h"
+
+#define CANVAS_ROW_ALIGN 64 // Rows start on a cache line
+#define CANVAS_MAX_DIRTY 16 // More dirty rectangles are merged into one
+
+struct canvas_rect {
+    int x, y, width, height;
+};
+
+// An image kept in memory as the source of truth, copied to the screen one
+// dirty rectangle at a time
+struct canvas {
+    uint32_t width, height;
+    int format; // enum fbimg_format, RGB888, BGR888 or XRGB8888
+    size_t stride; // Bytes from one row to the next, a multiple of CANVAS_ROW_ALIGN
+    char *pixels;
+    struct canvas_rect dirty[CANVAS_MAX_DIRTY];
+    int dirty_count;
+};
+
+// The canvas format for a framebuffer: its own layout when that is one of the
+// canvas formats, so presenting is a plain copy, XRGB8888 otherwise
+int canvas_format(const struct fb_var_screeninfo *vinfo);
+
+// Allocates a canvas cleared to black. Returns 0 on success, -1 if it can't
+// be allocated.
+int canvas_init(struct canvas *c, uint32_t width, uint32_t height, int format);
+void canvas_free(struct canvas *c);
+
+// Fills in the bit depth and channel offsets for drawing into the canvas
+// with a blitter or brush set up for a framebuffer
+void canvas_vinfo(const struct canvas *c, struct fb_var_screeninfo *vinfo);
+
+// Marks an area as changed, clipped to the canvas
+void canvas_damage(struct canvas *c, int x, int y, int width, int height);
+
+// Copies the dirty areas through b to the screen, with the canvas at (x, y),
+// and clears them. bounds is set to the screen area that changed. Returns 0
+// if nothing was dirty.
+int canvas_flush(struct canvas *c, const struct blitter *b, char *fb_ptr, size_t line_length, int x, int y, struct canvas_rect *bounds);
+
+// Writes the canvas as a .fbimg file. Returns 0 on success, -1 on errors
+// with errno set.
+int canvas_save(const struct canvas *c, const char *path);
@@ -0,0 +1,23 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEFLATE_LEVEL_MAX 9
+
+// Upper bound of the output of deflate_compress() for size bytes of input
+size_t deflate_bound(size_t size);
+
+// Compresses size bytes into raw deflate blocks, at level 0 (stored blocks)
+// to DEFLATE_LEVEL_MAX (longest match search). Unless last is set, the
+// output ends in an empty stored block (a sync flush) rather than a final
+// block, so the outputs of consecutive calls concatenate into one stream.
+// Every call starts without history, which is what lets pieces of a stream
+// be compressed in parallel. Returns the output size, or 0 if memory runs
+// out.
+size_t deflate_compress(uint8_t *out, const uint8_t *in, size_t size, int level, bool last);
+
+uint32_t adler32(uint32_t adler, const uint8_t *data, size_t size);
+// Checksum of two pieces of data from the checksums of each, size2 being
+// the length of the second piece
+uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t size2);
@@ -0,0 +1,64 @@
+#pragma once
+#include <linux/fb.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Default device when neither --fb nor FBTOOLS_FB is given
+#define FB_DEVICE_DEFAULT "/dev/fb0"
+// Environment variable naming the framebuffer to use
+#define FB_DEVICE_ENV "FBTOOLS_FB"
+
+// Virtual framebuffer files start with a header of this size, followed by
+// the pixel memory
+#define FB_FILE_HEADER_SIZE 4096
+
+enum fb_backend {
+    FB_BACKEND_FBDEV, // A real framebuffer character device
+    FB_BACKEND_FILE, // A regular file created by fb_device_create()
+};
+
+// When the virtual resolution holds two screens, drawing goes to the one
+// that is not displayed and fb_device_present() pans to it, so whole frames
+// appear at once instead of tearing.
+struct fb_device {
+    enum fb_backend backend;
+    int fd;
+    struct fb_var_screeninfo vinfo;
+    struct fb_fix_screeninfo finfo;
+    char *ptr; // Framebuffer memory, NULL until fb_device_map()
+    size_t size;
+    bool writable;
+    int buffers; // 2 when double buffered, 1 otherwise
+    int back; // Screen that is drawn to, the other one is displayed
+    bool vsync; // FBIO_WAITFORVSYNC works
+};
+
+// Picks the framebuffer to use: option if it is set, then FBTOOLS_FB, then
+// /dev/fb0
+const char *fb_device_path(const char *option);
+
+// Opens a framebuffer device or virtual framebuffer file and reads its
+// screen info. Returns 0 on success, -1 with errno set on failure.
+int fb_device_open(struct fb_device *fb, const char *path, bool writable);
+// Maps the framebuffer memory to fb->ptr. Returns 0 on success, -1 with errno
+// set on failure.
+int fb_device_map(struct fb_device *fb);
+// Makes the written pixels visible to other readers of the framebuffer
+void fb_device_flush(struct fb_device *fb);
+
+// Screen to draw into, with finfo.line_length bytes per row. Changes after
+// every fb_device_present().
+char *fb_device_draw_buffer(const struct fb_device *fb);
+// Screen that is displayed right now, as last set by any process
+const char *fb_device_visible(struct fb_device *fb);
+// Shows what was drawn since the last call. When double buffered, this pans
+// to the drawn screen, waits for vertical sync where supported and copies the
+// given area, which must cover everything that was drawn, to the other
+// screen so both stay identical. Returns 0 on success, -1 if panning failed.
+int fb_device_present(struct fb_device *fb, int x, int y, int width, int height);
+void fb_device_close(struct fb_device *fb);
+
+// Creates a virtual framebuffer file with the resolution, bit depth and
+// channel layout of vinfo. The line length is padded to 64 bytes. Returns 0
+// on success, -1 with errno set on failure.
+int fb_device_create(const char *path, const struct fb_var_screeninfo *vinfo);
@@ -0,0 +1,99 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define FBIMG_HEADER_SIZE 16
+#define FBIMG_V2_HEADER_SIZE 64
+#define FBIMG_V2_DATA_ALIGN 4096
+#define FBIMG_V2_STRIDE_ALIGN 64
+
+// v2 header flags
+#define FBIMG_FLAG_RLE 0x1 // Every row is a 32-bit size followed by RLE data (see rle.h)
+
+enum fbimg_error {
+    FBIMG_OK,
+    FBIMG_EIO, // errno holds the cause
+    FBIMG_ETRUNCATED,
+    FBIMG_EFORMAT,
+    FBIMG_EVERSION,
+};
+
+// Pixel formats stored in v2 headers. The 3-byte formats are named by byte
+// order, the others by native-endian word like the framebuffer layouts, so
+// XRGB8888 is B, G, R, X in a little-endian file. ARGB8888 has premultiplied
+// alpha and is composited over the framebuffer instead of replacing it.
+enum fbimg_format {
+    FBIMG_FORMAT_RGB888,
+    FBIMG_FORMAT_BGR888,
+    FBIMG_FORMAT_XRGB8888,
+    FBIMG_FORMAT_RGB565,
+    FBIMG_FORMAT_BGRX8888,
+    FBIMG_FORMAT_ARGB8888,
+    FBIMG_FORMAT_COUNT,
+};
+
+// A .fbimg file mapped read-only. pixels points straight into the page cache
+// and stays valid until fbimg_close().
+struct fbimg {
+    uint32_t width, height;
+    int version;
+    int format; // enum fbimg_format, v1 files are RGB888 or BGR888
+    uint32_t stride; // Bytes from one row to the next
+    uint32_t flags;
+    const char *pixels; // Start of the payload, compressed when FBIMG_FLAG_RLE is set
+    size_t data_size;
+    void *map;
+    size_t map_size;
+};
+
+// Walks the rows of raw and compressed payloads alike
+struct fbimg_rows {
+    const struct fbimg *img;
+    const char *next;
+    uint32_t y;
+};
+
+// Output of a .fbimg file, written one row at a time
+struct fbimg_writer {
+    FILE *file;
+    uint32_t width;
+    int format;
+    uint32_t stride;
+    uint32_t flags;
+    char *buffer; // Padded or compressed row
+};
+
+int fbimg_open(const char *path, struct fbimg *img);
+void fbimg_close(struct fbimg *img);
+const char *fbimg_error_text(int error);
+
+void fbimg_rows_begin(const struct fbimg *img, struct fbimg_rows *rows);
+// Returns the next row, either in place or decoded into scratch, which must
+// hold width * bpp bytes. Returns NULL after the last row or on corrupt data.
+const char *fbimg_rows_next(struct fbimg_rows *rows, char *scratch);
+
+// Decodes the whole payload into a new buffer with a stride of width * bpp.
+// Returns NULL if it can't be allocated or the data is corrupt.
+char *fbimg_decode(const struct fbimg *img);
+
+int fbimg_format_bpp(int format);
+const char *fbimg_format_name(int format);
+// Returns the format for a name such as "xrgb8888", or -1
+int fbimg_format_parse(const char *name);
+
+// Row stride used for v2 files, padded to FBIMG_V2_STRIDE_ALIGN bytes
+uint32_t fbimg_stride(uint32_t width, int format);
+
+// Writes a header followed by padding up to the pixel data. Uncompressed
+// 3-byte formats with a stride of width * 3 get a v1 header so older readers
+// can load them. Returns 0 on success, -1 on write errors.
+int fbimg_write_header(FILE *file, uint32_t width, uint32_t height, int format, uint32_t stride, uint32_t flags);
+
+// Writes the header. Compressed files always use a stride of width * bpp.
+// Returns 0 on success, -1 on allocation or write errors.
+int fbimg_writer_open(struct fbimg_writer *w, FILE *file, uint32_t width, uint32_t height, int format, uint32_t stride, uint32_t flags);
+// Appends a row of width pixels. Returns 0 on success, -1 on write errors.
+int fbimg_writer_row(struct fbimg_writer *w, const char *row);
+void fbimg_writer_free(struct fbimg_writer *w);
@@ -0,0 +1,60 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Protocol of fbimg --daemon. Clients connect to a SOCK_SEQPACKET Unix
+// socket and send one command per message: a struct fbimg_command, followed
+// by the path for FBIMG_COMMAND_DRAW_FILE. A buffer to draw is passed as a
+// file descriptor with SCM_RIGHTS. It must be a memfd sealed with
+// F_SEAL_SHRINK, as it is mapped while drawn, and is refused with EINVAL
+// otherwise, as is a message carrying more than one descriptor. Every
+// command is answered with a struct fbimg_reply, in order. Fields are
+// native-endian, as both ends run on the same machine.
+
+// Clients connected at once
+#define FBIMG_SERVER_MAX_CLIENTS 16
+// Files kept converted to the framebuffer layout
+#define FBIMG_SERVER_CACHE_ENTRIES 256
+// Default memory budget of the file cache in MiB
+#define FBIMG_SERVER_CACHE_MB 64
+
+enum fbimg_command_type {
+    FBIMG_COMMAND_DRAW_FILE = 1, // Draws a .fbimg or .png file at (x, y)
+    FBIMG_COMMAND_DRAW_BUFFER, // Draws width x height pixels of a passed sealed memfd at (x, y)
+    FBIMG_COMMAND_FILL, // Fills a width x height rectangle at (x, y) with color
+};
+
+// Command flags
+#define FBIMG_COMMAND_CENTERED 0x1 // Centers the image on screen, x and y are ignored
+#define FBIMG_COMMAND_MORE 0x2 // More drawing follows, the screen is updated after the last one
+
+struct fbimg_command {
+    uint32_t type; // enum fbimg_command_type
+    uint32_t flags;
+    int32_t x, y; // Anything outside the screen is clipped
+    uint32_t width, height; // Size of the buffer or the filled rectangle
+    uint32_t format; // Buffer pixel format, enum fbimg_format
+    uint32_t stride; // Bytes from one buffer row to the next
+    uint64_t offset; // Offset of the first buffer row in the file descriptor
+    uint32_t color; // Fill color as ARGB8888 with straight alpha, blended below 255
+    uint32_t path_size; // Bytes of path after the command, without a terminator
+};
+
+struct fbimg_reply {
+    int32_t error; // 0 on success, an errno value otherwise
+};
+
+// Keeps the framebuffer mapped and serves commands on socket_path until
+// SIGINT or SIGTERM. Files larger than the screen are scaled down to fit on
+// threads threads (0 for all CPUs) when they are loaded. Up to cache_size
+// bytes of converted files are kept, and reloaded when they change on disk.
+// Returns 0 after a clean shutdown, -1 with errno set if the server couldn't
+// start.
+int fbimg_server_run(const char *socket_path, const char *device, size_t cache_size, int threads);
+
+// Connects to a server. Returns the socket, or -1 with errno set.
+int fbimg_client_connect(const char *socket_path);
+// Sends a command with its path (NULL for none) and buffer (-1 for none),
+// and waits for the reply. Returns 0 on success, -1 with errno set to the
+// error of the server or of the socket.
+int fbimg_client_send(int sock, const struct fbimg_command *command, const char *path, int buffer_fd);
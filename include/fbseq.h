@@ -0,0 +1,54 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define FBSEQ_HEADER_SIZE 64
+#define FBSEQ_TILE_SIZE 64
+
+// Append-only recording of framebuffer frames. Every frame stores only the
+// tiles that changed since the previous one, so a reader has to apply the
+// frames in order.
+struct fbseq_writer {
+    FILE *file;
+    uint32_t width, height;
+    int format; // enum fbimg_format
+    int bpp;
+    bool started; // The previous frame holds valid pixels
+    char *previous;
+    char *tile; // Pixels of one tile, packed
+    char *buffer; // Encoded frame
+    size_t buffer_size;
+};
+
+// A recording mapped read-only, with the pixels of the current frame
+struct fbseq {
+    uint32_t width, height;
+    int format;
+    int tile_size;
+    int64_t start_time; // Microseconds since the epoch
+    uint64_t timestamp; // Microseconds since the start of the recording
+    uint32_t frame_index; // Number of frames applied so far
+    char *frame; // Packed rows of width * bpp bytes
+    const char *data;
+    size_t size, pos;
+    void *map;
+    size_t map_size;
+};
+
+// Writes the header. Returns 0 on success, -1 on allocation or write errors.
+int fbseq_writer_open(struct fbseq_writer *w, FILE *file, uint32_t width, uint32_t height, int format, int64_t start_time);
+// Appends the tiles of frame (packed rows of width * bpp bytes) that differ
+// from the previous frame, all of them for the first one. Returns 0 on
+// success, -1 on write errors.
+int fbseq_write_frame(struct fbseq_writer *w, const char *frame, uint64_t timestamp);
+void fbseq_writer_free(struct fbseq_writer *w);
+
+// Returns an enum fbimg_error
+int fbseq_open(const char *path, struct fbseq *seq);
+// Applies the next frame to seq->frame. Returns 1 if a frame was applied, 0
+// at the end of the recording and -1 on corrupt data. A frame cut short by
+// an interrupted recording counts as the end.
+int fbseq_next(struct fbseq *seq);
+void fbseq_close(struct fbseq *seq);
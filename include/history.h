@@ -0,0 +1,68 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "canvas.h"
+
+#define HISTORY_TILE_SIZE 64
+#define HISTORY_RECENT 4 // Steps kept uncompressed when compression is on
+
+// A tile saved by a step. A step that can be undone holds the tile as it was
+// before the step, one that can be redone as it was after it.
+struct history_tile {
+    uint16_t tx, ty;
+    int slot; // Pool slot with the packed pixels, -1 when compressed
+    uint32_t offset, size; // Compressed data in the step's blob
+};
+
+struct history_step {
+    struct history_tile *tiles;
+    int count;
+    char *blob; // Run-length coded tiles, NULL while the step is uncompressed
+    size_t blob_size;
+};
+
+// Undo/redo of canvas changes, one step per stroke. Only the tiles a step
+// touches are saved, in slots of a pool that is reserved up front, so saving
+// a tile during a stroke never allocates. When the pool or budget runs out
+// the oldest steps are dropped.
+struct history {
+    struct canvas *canvas;
+    int bpp;
+    int tiles_x, tiles_y;
+    size_t slot_size; // Bytes of one full tile
+    char *pool;
+    int *free_slots;
+    int free_count;
+    size_t budget, used; // Bytes of slots and blobs in use
+    bool compress; // Run-length code steps older than HISTORY_RECENT
+    // The step being recorded
+    bool recording;
+    bool overflow; // A tile couldn't be saved, so the step can't be undone
+    uint8_t *saved; // One flag per tile, set once the open step holds it
+    struct history_tile *open_tiles;
+    int open_count;
+    // Steps [0, done) can be undone, [done, step_count) redone
+    struct history_step *steps;
+    int step_count, step_capacity, done;
+};
+
+// Reserves up to budget bytes for saved tiles. Returns 0 on success, -1 if
+// the bookkeeping can't be allocated.
+int history_init(struct history *h, struct canvas *canvas, size_t budget, bool compress);
+void history_free(struct history *h);
+
+// Starts a step and drops everything that could be redone
+void history_begin(struct history *h);
+// Saves the tiles of an area of the canvas that the open step is about to
+// change and hasn't saved yet
+void history_save(struct history *h, int x, int y, int width, int height);
+// Closes the open step
+void history_end(struct history *h);
+
+// Restores the canvas to before the last step, or redoes the last undone
+// one, and marks the tiles dirty. Returns 1 if something changed, 0 if
+// there was nothing to undo or redo or no memory to do it.
+int history_undo(struct history *h);
+int history_redo(struct history *h);
@@ -0,0 +1,50 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define INFLATE_WINDOW 32768
+#define INFLATE_FAST_BITS 10 // Codes up to this long are decoded with one table lookup
+
+// Canonical Huffman code. Short codes are looked up in fast, longer ones are
+// decoded bit by bit from count and symbol.
+struct inflate_huffman {
+    uint16_t fast[1 << INFLATE_FAST_BITS]; // Symbol << 4 | length, 0 for longer codes
+    uint16_t count[16]; // Number of codes of each length
+    uint16_t symbol[288]; // Symbols ordered by code
+};
+
+// Incremental zlib decoder. Output is pulled a few bytes at a time, so a
+// caller can decode one scanline after another without holding the whole
+// result. Input comes in segments from next_input, which lets the data stay
+// split across PNG chunks.
+struct inflate {
+    const uint8_t *in, *in_end;
+    // Sets the next input segment. Returns 0 on success, -1 at the end.
+    int (*next_input)(void *ctx, const uint8_t **data, size_t *size);
+    void *ctx;
+    uint64_t bits;
+    int bit_count;
+    bool overrun; // Bits past the end of the input were used
+    int state;
+    bool last_block;
+    uint32_t stored_left; // Bytes left in a stored block
+    int copy_length, copy_distance; // Rest of a match cut short by the caller
+    uint64_t total; // Bytes produced so far
+    uint32_t adler; // Adler-32 of the bytes produced so far
+    uint8_t window[INFLATE_WINDOW];
+    struct inflate_huffman literals, distances;
+};
+
+// Starts decoding a zlib stream. The first input segment is fetched from
+// next_input.
+void inflate_init(struct inflate *z, int (*next_input)(void *ctx, const uint8_t **data, size_t *size), void *ctx);
+
+// Decodes up to size bytes into out. Returns the number of bytes written,
+// which is only less than size at the end of the stream, or -1 on corrupt
+// data or when the Adler-32 trailer doesn't match.
+long inflate_read(struct inflate *z, uint8_t *out, size_t size);
+// Decodes and drops whatever is left of the stream, so the trailer gets
+// checked once the caller has read all it needs. Returns 0 if the stream is
+// intact, -1 otherwise.
+int inflate_end(struct inflate *z);
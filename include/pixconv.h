@@ -0,0 +1,29 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Packed pixel format conversions. 32-bit XRGB/ARGB pixels are native-endian
+// words, so XRGB8888 is stored as B, G, R, X on little-endian machines.
+// All functions convert count pixels. dst may equal src for rgb_to_bgr only.
+void pixconv_rgb_to_bgr(uint8_t *dst, const uint8_t *src, size_t count);
+void pixconv_rgb_to_xrgb(uint32_t *dst, const uint8_t *src, size_t count, uint8_t x);
+void pixconv_bgr_to_xrgb(uint32_t *dst, const uint8_t *src, size_t count, uint8_t x);
+void pixconv_xrgb_to_rgb(uint8_t *dst, const uint32_t *src, size_t count);
+void pixconv_xrgb_to_bgr(uint8_t *dst, const uint32_t *src, size_t count);
+void pixconv_rgba_to_rgb(uint8_t *dst, const uint8_t *src, size_t count);
+void pixconv_rgb_to_rgba(uint8_t *dst, const uint8_t *src, size_t count);
+void pixconv_bgr_to_rgba(uint8_t *dst, const uint8_t *src, size_t count);
+// Sets count words to value
+void pixconv_fill32(uint32_t *dst, uint32_t value, size_t count);
+// Composites premultiplied ARGB words over dst with the "over" operator. Every
+// byte of dst is blended, so dst may be XRGB or ARGB. Fully transparent and
+// fully opaque runs are skipped and copied.
+void pixconv_blend_argb(uint32_t *dst, const uint32_t *src, size_t count);
+// Straight R, G, B, A bytes to premultiplied ARGB words
+void pixconv_rgba_to_argb_premultiplied(uint32_t *dst, const uint8_t *src, size_t count);
+// And back, rounded. Colors of fully transparent pixels are lost and come
+// out as zero.
+void pixconv_argb_premultiplied_to_rgba(uint8_t *dst, const uint32_t *src, size_t count);
+
+// Name of the kernel set picked for this CPU: "scalar", "ssse3", "avx2" or "neon"
+const char *pixconv_backend(void);
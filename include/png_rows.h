@@ -0,0 +1,75 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "inflate.h"
+
+enum png_error {
+    PNG_OK,
+    PNG_EIO, // errno holds the cause
+    PNG_ETRUNCATED,
+    PNG_EFORMAT,
+    PNG_ECORRUPT,
+};
+
+// A PNG file mapped read-only and decoded one RGB888 or RGBA8888 row at a
+// time, so only two scanlines are held in memory. Interlaced images can't be
+// decoded in row order and are decoded whole up front instead.
+struct png_rows {
+    uint32_t width, height;
+    int color_type, bit_depth;
+    bool alpha; // An alpha channel or a tRNS chunk makes some pixels transparent
+    int error; // enum png_error, set when png_rows_next() fails
+    size_t row_bytes; // Filtered bytes per row, without the filter type
+    int filter_bpp; // Bytes per complete pixel, at least 1
+    uint8_t palette[256 * 3];
+    uint8_t palette_alpha[256];
+    int palette_size;
+    int key[3]; // Fully transparent gray or RGB samples from tRNS, -1 if none
+    struct inflate *z;
+    size_t next_chunk; // Offset of the chunk after the current IDAT
+    uint8_t *rows[2]; // Current and previous scanline, each with its filter type
+    size_t row_capacity;
+    uint8_t *rgb; // Converted row, room for RGBA8888
+    size_t rgb_capacity;
+    unsigned char *decoded; // Whole RGBA8888 image for interlaced files
+    uint32_t y;
+    const uint8_t *data;
+    size_t size;
+    void *map;
+    size_t map_size;
+    size_t released; // Mapped bytes already given back with MADV_DONTNEED
+};
+
+// True if data starts with the PNG signature
+bool png_signature(const void *data, size_t size);
+
+// Returns an enum png_error. There is nothing to close after a failure.
+int png_rows_open(const char *path, struct png_rows *png);
+void png_rows_close(struct png_rows *png);
+
+// For decoding many files in a row: png_rows_reopen() opens the next file
+// but keeps the decoder and row buffers of the previous one where they are
+// large enough. png must come from png_rows_open() or be zeroed, and is
+// freed with png_rows_close() in the end, even after a failed reopen.
+// png_rows_end() unmaps the current file and keeps the buffers.
+int png_rows_reopen(const char *path, struct png_rows *png);
+void png_rows_end(struct png_rows *png);
+const char *png_error_text(int error);
+
+// Returns the next row as width RGB888 pixels, NULL after the last row or on
+// corrupt data, with error set. Alpha is dropped. The row stays valid until
+// the next call.
+const char *png_rows_next(struct png_rows *png);
+// Same as png_rows_next() with R, G, B, A bytes of straight alpha
+const char *png_rows_next_rgba(struct png_rows *png);
+
+// alpha only says that the file can hold transparent pixels, and many
+// opaque images are saved with an alpha channel anyway. This decodes the
+// file at path, which png was opened from, once more with scan and clears
+// alpha if every pixel is opaque. png still starts at its first row. scan
+// is zeroed or kept from an earlier call, so its buffers are reused, and
+// freed with png_rows_close(). Callers that hold the decoded image anyway
+// should look at the alpha bytes themselves instead.
+void png_rows_find_alpha(struct png_rows *png, const char *path, struct png_rows *scan);
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+
+// Rows per band below which splitting an image across more threads costs
+// more compression than it saves time
+#define PNG_WRITE_MIN_BAND_ROWS 32
+
+// Writes packed RGB888 pixels as an 8-bit RGB PNG at compression level 0 to
+// DEFLATE_LEVEL_MAX. The image is cut into one band of rows per thread, and
+// each band is filtered and compressed independently, ending on a sync
+// flush, so the bands join into one zlib stream whose checksum is combined
+// from theirs. Matches can't reach across bands, which costs a little
+// compression. threads <= 0 uses every online CPU. Returns 0 on success,
+// -1 with errno set on failure.
+int png_write_rgb(const char *path, const char *rgb, uint32_t width, uint32_t height, int level, int threads);
+// Same for R, G, B, A bytes of straight alpha, as an 8-bit RGBA PNG
+int png_write_rgba(const char *path, const char *rgba, uint32_t width, uint32_t height, int level, int threads);
@@ -0,0 +1,26 @@
+#pragma once
+
+// Clip rectangle, right and bottom are exclusive
+struct raster_clip {
+    int left, top, right, bottom;
+};
+
+// Row extents of a disc, computed once per radius: row dy of the disc covers
+// the pixels within extent[|dy|] of its center
+struct raster_disc {
+    int radius;
+    int *extent; // radius + 1 entries
+};
+
+// Receives the pixels [x0, x1) of row y
+typedef void (*raster_span_fn)(void *ctx, int y, int x0, int x1);
+
+// Returns 0 on success, -1 if the table can't be allocated
+int raster_disc_init(struct raster_disc *disc, int radius);
+void raster_disc_free(struct raster_disc *disc);
+
+// Covers every pixel within the disc's radius of the segment from (x0, y0)
+// to (x1, y1), the same pixels the disc stamped along the whole line would
+// touch. Each row inside clip is passed to span at most once, and nothing is
+// allocated, so it can run for every mouse packet.
+void raster_capsule(int x0, int y0, int x1, int y1, const struct raster_disc *disc, const struct raster_clip *clip, raster_span_fn span, void *ctx);
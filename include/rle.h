@@ -0,0 +1,17 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Run-length coding of whole pixels (bpp bytes each). A control byte below
+// 128 is followed by that many plus one literal pixels, a control byte c of
+// 128 or more by a single pixel repeated c - 126 times.
+
+// Largest possible encoded size of count pixels
+size_t rle_bound(size_t count, int bpp);
+
+// Encodes count pixels into dst and returns the encoded size
+size_t rle_encode(uint8_t *dst, const uint8_t *src, size_t count, int bpp);
+
+// Decodes exactly count pixels from at most size bytes of src. Returns the
+// number of bytes consumed, or -1 if the data is corrupt or too short.
+long rle_decode(uint8_t *dst, size_t count, const uint8_t *src, size_t size, int bpp);
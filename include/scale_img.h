@@ -1,7 +1,65 @@
 #pragma once
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 int floorpx(float x);
 int calc_index(int width, int height, int x, int y);
 unsigned char lerp(unsigned char a, unsigned char b, float t);
 char *scale_image(char *image, bool bgr, int width, int height, int new_width, int new_height);
+
+// Same result as scale_image(), split into bands of output rows that run on a
+// persistent thread pool. threads <= 0 uses every online CPU.
+#define SCALE_MIN_BAND_ROWS 16
+char *scale_image_mt(char *image, bool bgr, int width, int height, int new_width, int new_height, int threads);
+// Premultiplied ARGB8888 words, stride bytes apart, scaled the same way. The
+// scaler only handles three channels, so the colors and the alpha are scaled
+// separately and put back together. Returns NULL if memory runs out.
+uint32_t *scale_image_argb_mt(const uint32_t *image, size_t stride, int width, int height, int new_width, int new_height, int threads);
+
+// Largest size with the same aspect ratio as width x height that fits in
+// max_width x max_height
+void scale_fit(int width, int height, int max_width, int max_height, int *new_width, int *new_height);
+
+// Bilinear scaler for packed 3-byte pixels. The per-column source offsets and
+// 8-bit weights are computed once by scaler_init(); scale_rows() then walks
+// the output in row order, filtering each needed source row horizontally
+// into a two-row ring before blending the pair vertically. Output is RGB,
+// source is swapped from BGR when bgr is set.
+struct scaler {
+    int width, height;
+    int new_width, new_height;
+    bool bgr;
+    int *x0; // Byte offset of the left source pixel for each output column
+    int *x1; // Byte offset of the right source pixel, clamped to the row
+    uint8_t *wx; // Weight of the right source pixel, 0-255
+};
+
+int scaler_init(struct scaler *s, bool bgr, int width, int height, int new_width, int new_height);
+void scaler_free(struct scaler *s);
+
+// Source rows and weight of the lower row for output row y
+void scaler_source_rows(const struct scaler *s, int y, int *y0, int *y1, int *wy);
+
+// Scales output rows [row_begin, row_end). Returns 0 on success, -1 if the
+// row buffers can't be allocated.
+int scale_rows(const struct scaler *s, const char *image, size_t stride, char *out, size_t out_stride, int row_begin, int row_end);
+
+// Push interface for rows that arrive one at a time, such as from a decoder.
+// Source rows have to be pushed in order, and each output row is passed to
+// emit as soon as the source rows it blends are in. Only two filtered rows
+// are kept.
+typedef void (*scaler_emit_fn)(void *ctx, int y, const char *row);
+
+struct scaler_stream {
+    const struct scaler *s;
+    uint16_t *rows[2]; // Filtered source rows
+    int y[2]; // Source row held by each, -1 if none
+    uint8_t *out; // Blended output row
+    int next; // Next output row
+};
+
+// Returns 0 on success, -1 if the row buffers can't be allocated
+int scaler_stream_init(struct scaler_stream *st, const struct scaler *s);
+void scaler_stream_free(struct scaler_stream *st);
+void scaler_stream_push(struct scaler_stream *st, int y, const char *row, scaler_emit_fn emit, void *ctx);
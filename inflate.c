@@ -0,0 +1,319 @@
+#include "include/inflate.h"
+
+#include <stdint.h>
+#include <string.h>
+
+enum {
+    INFLATE_HEADER,
+    INFLATE_BLOCK,
+    INFLATE_STORED,
+    INFLATE_CODES,
+    INFLATE_TRAILER,
+    INFLATE_DONE,
+};
+
+static const uint16_t length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distance_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distance_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Largest number of bytes before the Adler-32 sums have to be reduced
+#define ADLER_NMAX 5552
+
+static void update_adler(struct inflate *z, const uint8_t *data, size_t size) {
+    uint32_t a = z->adler & 0xFFFF, b = z->adler >> 16;
+    while (size > 0) {
+        size_t n = size < ADLER_NMAX ? size : ADLER_NMAX;
+        size -= n;
+        while (n-- > 0) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    z->adler = b << 16 | a;
+}
+
+static void refill(struct inflate *z) {
+    while (z->bit_count <= 56) {
+        if (z->in == z->in_end) {
+            const uint8_t *data;
+            size_t size;
+            if (!z->next_input || z->next_input(z->ctx, &data, &size) != 0) {
+                z->next_input = NULL;
+                return;
+            }
+            z->in = data;
+            z->in_end = data + size;
+            continue;
+        }
+        z->bits |= (uint64_t)*z->in++ << z->bit_count;
+        z->bit_count += 8;
+    }
+}
+
+// Returns the next n bits without using them, zero past the end of the input
+static uint32_t peek_bits(struct inflate *z, int n) {
+    if (z->bit_count < n) refill(z);
+    return z->bits & ((1u << n) - 1);
+}
+
+static void drop_bits(struct inflate *z, int n) {
+    if (n > z->bit_count) {
+        z->overrun = true;
+        z->bits = 0;
+        z->bit_count = 0;
+        return;
+    }
+    z->bits >>= n;
+    z->bit_count -= n;
+}
+
+static uint32_t get_bits(struct inflate *z, int n) {
+    uint32_t value = peek_bits(z, n);
+    drop_bits(z, n);
+    return value;
+}
+
+static uint32_t reverse_bits(uint32_t code, int length) {
+    uint32_t result = 0;
+    for (int i = 0; i < length; i++, code >>= 1) result = result << 1 | (code & 1);
+    return result;
+}
+
+// Builds the code for n symbols from their code lengths. Returns 0 on
+// success, -1 if the lengths describe more codes than fit.
+static int build_huffman(struct inflate_huffman *h, const uint8_t *lengths, int n) {
+    memset(h->count, 0, sizeof(h->count));
+    memset(h->fast, 0, sizeof(h->fast));
+    for (int i = 0; i < n; i++) h->count[lengths[i]]++;
+    h->count[0] = 0;
+    int left = 1;
+    for (int length = 1; length < 16; length++) {
+        left = (left << 1) - h->count[length];
+        if (left < 0) return -1;
+    }
+
+    uint16_t offset[16] = {0};
+    for (int length = 1; length < 15; length++) offset[length + 1] = offset[length] + h->count[length];
+    for (int i = 0; i < n; i++) {
+        if (lengths[i]) h->symbol[offset[lengths[i]]++] = i;
+    }
+
+    // Canonical codes are handed out in symbol order within each length.
+    // The stream stores them most significant bit first, so the table is
+    // indexed by the reversed code.
+    uint32_t code = 0;
+    int index = 0;
+    for (int length = 1; length < 16; length++, code <<= 1) {
+        for (int i = 0; i < h->count[length]; i++, code++, index++) {
+            if (length > INFLATE_FAST_BITS) continue;
+            uint16_t entry = h->symbol[index] << 4 | length;
+            for (uint32_t j = reverse_bits(code, length); j < (1u << INFLATE_FAST_BITS); j += 1u << length) h->fast[j] = entry;
+        }
+    }
+    return 0;
+}
+
+// Returns the next symbol, or -1 for a code that isn't in the table
+static int decode_symbol(struct inflate *z, const struct inflate_huffman *h) {
+    uint32_t bits = peek_bits(z, 15);
+    uint16_t entry = h->fast[bits & ((1u << INFLATE_FAST_BITS) - 1)];
+    if (entry) {
+        drop_bits(z, entry & 15);
+        return entry >> 4;
+    }
+    int code = 0, first = 0, index = 0;
+    for (int length = 1; length < 16; length++, bits >>= 1) {
+        code |= bits & 1;
+        int count = h->count[length];
+        if (code - first < count) {
+            drop_bits(z, length);
+            return h->symbol[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static int read_fixed_codes(struct inflate *z) {
+    uint8_t lengths[288];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    build_huffman(&z->literals, lengths, 288);
+    memset(lengths, 5, 30);
+    build_huffman(&z->distances, lengths, 30);
+    return 0;
+}
+
+static int read_dynamic_codes(struct inflate *z) {
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    int literal_count = get_bits(z, 5) + 257;
+    int distance_count = get_bits(z, 5) + 1;
+    int length_count = get_bits(z, 4) + 4;
+    if (literal_count > 286 || distance_count > 30) return -1;
+
+    uint8_t lengths[286 + 30] = {0};
+    for (int i = 0; i < length_count; i++) lengths[order[i]] = get_bits(z, 3);
+    // The literal table is rebuilt below, so it can hold the code length code
+    if (build_huffman(&z->literals, lengths, 19) != 0) return -1;
+
+    memset(lengths, 0, sizeof(lengths));
+    int total = literal_count + distance_count;
+    for (int i = 0; i < total;) {
+        int symbol = decode_symbol(z, &z->literals);
+        if (symbol < 0 || z->overrun) return -1;
+        if (symbol < 16) {
+            lengths[i++] = symbol;
+            continue;
+        }
+        uint8_t value = 0;
+        int repeat;
+        if (symbol == 16) {
+            if (i == 0) return -1;
+            value = lengths[i - 1];
+            repeat = 3 + get_bits(z, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + get_bits(z, 3);
+        } else {
+            repeat = 11 + get_bits(z, 7);
+        }
+        if (i + repeat > total) return -1;
+        memset(lengths + i, value, repeat);
+        i += repeat;
+    }
+    if (lengths[256] == 0) return -1; // No end of block code
+    if (build_huffman(&z->literals, lengths, literal_count) != 0) return -1;
+    if (build_huffman(&z->distances, lengths + literal_count, distance_count) != 0) return -1;
+    return 0;
+}
+
+static inline void put_byte(struct inflate *z, uint8_t *out, size_t *n, uint8_t byte) {
+    out[(*n)++] = byte;
+    z->window[z->total++ & (INFLATE_WINDOW - 1)] = byte;
+}
+
+// Decodes a compressed block until it ends or out is full
+static int decode_codes(struct inflate *z, uint8_t *out, size_t size, size_t *n) {
+    while (*n < size) {
+        if (z->copy_length > 0) {
+            int count = z->copy_length < (int)(size - *n) ? z->copy_length : (int)(size - *n);
+            for (int i = 0; i < count; i++) put_byte(z, out, n, z->window[(z->total - z->copy_distance) & (INFLATE_WINDOW - 1)]);
+            z->copy_length -= count;
+            continue;
+        }
+        int symbol = decode_symbol(z, &z->literals);
+        if (symbol < 0 || z->overrun) return -1;
+        if (symbol < 256) {
+            put_byte(z, out, n, symbol);
+        } else if (symbol == 256) {
+            z->state = INFLATE_BLOCK;
+            return 0;
+        } else {
+            symbol -= 257;
+            if (symbol >= 29) return -1;
+            int length = length_base[symbol] + get_bits(z, length_extra[symbol]);
+            symbol = decode_symbol(z, &z->distances);
+            if (symbol < 0 || symbol >= 30) return -1;
+            int distance = distance_base[symbol] + get_bits(z, distance_extra[symbol]);
+            if (z->overrun || (uint64_t)distance > z->total) return -1;
+            z->copy_length = length;
+            z->copy_distance = distance;
+        }
+    }
+    return 0;
+}
+
+void inflate_init(struct inflate *z, int (*next_input)(void *ctx, const uint8_t **data, size_t *size), void *ctx) {
+    z->in = z->in_end = NULL;
+    z->next_input = next_input;
+    z->ctx = ctx;
+    z->bits = 0;
+    z->bit_count = 0;
+    z->overrun = false;
+    z->state = INFLATE_HEADER;
+    z->last_block = false;
+    z->stored_left = 0;
+    z->copy_length = 0;
+    z->copy_distance = 0;
+    z->total = 0;
+    z->adler = 1;
+}
+
+long inflate_read(struct inflate *z, uint8_t *out, size_t size) {
+    size_t n = 0;
+    size_t checked = 0; // Bytes of out already added to the checksum
+    while (n < size) {
+        switch (z->state) {
+            case INFLATE_HEADER: {
+                uint32_t cmf = get_bits(z, 8), flg = get_bits(z, 8);
+                // Deflate with a window of at most 32 KiB and no preset dictionary
+                if (z->overrun || (cmf & 15) != 8 || (cmf >> 4) > 7 || (cmf << 8 | flg) % 31 != 0 || (flg & 0x20)) return -1;
+                z->state = INFLATE_BLOCK;
+                break;
+            }
+            case INFLATE_BLOCK: {
+                if (z->last_block) {
+                    z->state = INFLATE_TRAILER;
+                    break;
+                }
+                z->last_block = get_bits(z, 1);
+                int type = get_bits(z, 2);
+                if (type == 0) {
+                    drop_bits(z, z->bit_count & 7);
+                    uint32_t length = get_bits(z, 16), inverse = get_bits(z, 16);
+                    if (length != (~inverse & 0xFFFF)) return -1;
+                    z->stored_left = length;
+                    z->state = INFLATE_STORED;
+                } else if (type == 1) {
+                    read_fixed_codes(z);
+                    z->state = INFLATE_CODES;
+                } else if (type == 2) {
+                    if (read_dynamic_codes(z) != 0) return -1;
+                    z->state = INFLATE_CODES;
+                } else {
+                    return -1;
+                }
+                if (z->overrun) return -1;
+                break;
+            }
+            case INFLATE_STORED:
+                for (; n < size && z->stored_left > 0; z->stored_left--) put_byte(z, out, &n, get_bits(z, 8));
+                if (z->overrun) return -1;
+                if (z->stored_left == 0) z->state = INFLATE_BLOCK;
+                break;
+            case INFLATE_CODES:
+                if (decode_codes(z, out, size, &n) != 0) return -1;
+                break;
+            case INFLATE_TRAILER: {
+                // Big-endian Adler-32 of the decoded data, from the next
+                // byte boundary
+                update_adler(z, out + checked, n - checked);
+                checked = n;
+                drop_bits(z, z->bit_count & 7);
+                uint32_t expected = 0;
+                for (int i = 0; i < 4; i++) expected = expected << 8 | get_bits(z, 8);
+                if (z->overrun || expected != z->adler) return -1;
+                z->state = INFLATE_DONE;
+                break;
+            }
+            case INFLATE_DONE:
+                return n;
+        }
+    }
+    update_adler(z, out + checked, n - checked);
+    return n;
+}
+
+int inflate_end(struct inflate *z) {
+    uint8_t rest[256];
+    long n;
+    while ((n = inflate_read(z, rest, sizeof(rest))) == (long)sizeof(rest)) {
+    }
+    return n < 0 ? -1 : 0;
+}
@@ -0,0 +1,112 @@
+#include <getopt.h>
+#include <linux/fb.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "include/blit.h"
+#include "include/fb_device.h"
+
+// Named layouts, channels as offset and length from the least significant bit
+static const struct {
+    const char *name;
+    int bpp;
+    int channels[4][2]; // Red, green, blue, transp
+} layouts[] = {
+    {"xrgb8888", 32, {{16, 8}, {8, 8}, {0, 8}, {0, 0}}},
+    {"argb8888", 32, {{16, 8}, {8, 8}, {0, 8}, {24, 8}}},
+    {"bgrx8888", 32, {{8, 8}, {16, 8}, {24, 8}, {0, 0}}},
+    {"rgb888", 24, {{16, 8}, {8, 8}, {0, 8}, {0, 0}}},
+    {"bgr888", 24, {{0, 8}, {8, 8}, {16, 8}, {0, 0}}},
+    {"rgb565", 16, {{11, 5}, {5, 6}, {0, 5}, {0, 0}}},
+};
+
+// Accepts a layout name or BPP:R/LEN,G/LEN,B/LEN[,T/LEN] with channel
+// offsets and lengths in bits
+static int parse_layout(const char *spec, struct fb_var_screeninfo *vinfo) {
+    struct fb_bitfield *channels[] = {&vinfo->red, &vinfo->green, &vinfo->blue, &vinfo->transp};
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        if (strcasecmp(spec, layouts[i].name) == 0) {
+            vinfo->bits_per_pixel = layouts[i].bpp;
+            for (int c = 0; c < 4; c++) {
+                channels[c]->offset = layouts[i].channels[c][0];
+                channels[c]->length = layouts[i].channels[c][1];
+            }
+            return 0;
+        }
+    }
+    unsigned values[9] = {0};
+    int count = sscanf(spec, "%u:%u/%u,%u/%u,%u/%u,%u/%u", &values[0], &values[1], &values[2], &values[3], &values[4], &values[5], &values[6], &values[7], &values[8]);
+    if (count != 7 && count != 9) return -1;
+    vinfo->bits_per_pixel = values[0];
+    for (int c = 0; c < 4; c++) {
+        channels[c]->offset = values[1 + c * 2];
+        channels[c]->length = values[2 + c * 2];
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const struct option long_options[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"version", no_argument, NULL, 'v'},
+        {"layout", required_argument, NULL, 'l'},
+        {"double-buffer", no_argument, NULL, 'd'},
+        {NULL, 0, NULL, 0}};
+
+    struct fb_var_screeninfo vinfo = {0};
+    parse_layout("xrgb8888", &vinfo);
+    bool double_buffer = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "hvl:d", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'h':
+                printf("Usage: %s [options] WIDTHxHEIGHT output\n", argv[0]);
+                printf("Creates a virtual framebuffer file that the other tools can use through\n");
+                printf("--fb or the %s environment variable.\n", FB_DEVICE_ENV);
+                printf("Options:\n");
+                printf("  -h, --help           Show this help message\n");
+                printf("  -v, --version        Show version information\n");
+                printf("  -l, --layout         xrgb8888 (default), argb8888, bgrx8888, rgb888, bgr888,\n");
+                printf("                       rgb565, or BPP:R/LEN,G/LEN,B/LEN[,T/LEN] in bits\n");
+                printf("  -d, --double-buffer  Make room for two screens so the tools can pan\n");
+                return 0;
+            case 'v':
+                printf("FBTools %s v1.0\n", argv[0]);
+                return 0;
+            case 'l':
+                if (parse_layout(optarg, &vinfo) != 0) {
+                    fprintf(stderr, "Unknown layout: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'd':
+                double_buffer = true;
+                break;
+            default:
+                fprintf(stderr, "Unknown option: %c\n", opt);
+                return 1;
+        }
+    }
+    if (optind + 1 >= argc) {
+        fprintf(stderr, "No size or output file specified.\n");
+        return 1;
+    }
+    if (sscanf(argv[optind], "%ux%u", &vinfo.xres, &vinfo.yres) != 2 || vinfo.xres == 0 || vinfo.yres == 0) {
+        fprintf(stderr, "Invalid size: %s\n", argv[optind]);
+        return 1;
+    }
+    vinfo.xres_virtual = vinfo.xres;
+    vinfo.yres_virtual = double_buffer ? vinfo.yres * 2 : vinfo.yres;
+    if (fb_detect_layout(&vinfo) == FB_LAYOUT_UNSUPPORTED) {
+        fprintf(stderr, "Warning: the tools can't draw to this layout\n");
+    }
+
+    if (fb_device_create(argv[optind + 1], &vinfo) != 0) {
+        perror("Error creating virtual framebuffer");
+        return 1;
+    }
+    return 0;
+}
@@ -7,88 +7,65 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
-#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <termios.h>
 #include <unistd.h>
 
+#include "include/blit.h"
+#include "include/brush.h"
+#include "include/canvas.h"
+#include "include/fb_device.h"
+#include "include/fbimg_file.h"
+#include "include/history.h"
 #include "include/scale_img.h"
 
-uint32_t image_width, image_height;
 struct fb_var_screeninfo vinfo;
 struct fb_fix_screeninfo finfo;
 struct termios oldt, newt;
 char *filename;
-volatile sig_atomic_t interrupt = 0;
-int fb_fd;
+struct fb_device fb;
 char *fb_ptr;
 char brush_color[3] = {0xFF, 0xFF, 0xFF}; // Default brush color: white
 int brush_size = 30; // Default brush size
+struct brush brush;
+struct canvas canvas; // The image being painted, shown at (canvas_x, canvas_y)
+int canvas_x, canvas_y;
+struct blitter screen; // Canvas pixels to the framebuffer layout
+struct history history;
+size_t history_budget = 64 << 20; // Bytes kept for undo
+bool compress_history = false;
+int cursor_x = 0, cursor_y = 0; // Cursor position on the canvas
 
-void draw_circle(int x, int y) {
-    int r = brush_size / 2;
-    for (int dy = -r; dy <= r; dy++) {
-        for (int dx = -r; dx <= r; dx++) {
-            if (dx * dx + dy * dy <= r * r) {
-                int px = x + dx;
-                int py = y + dy;
-                if (px >= (vinfo.xres - image_width) / 2 && px < vinfo.xres - (vinfo.xres - image_width) / 2 - 1 && py >= (vinfo.yres - image_height) / 2 &&
-                    py < vinfo.yres - (vinfo.yres - image_height) / 2 - 1) {
-                    int offset = py * finfo.line_length + px * (vinfo.bits_per_pixel / 8);
-                    if (offset >= 0 && offset < finfo.smem_len) {
-                        *((char *)(fb_ptr + offset + (vinfo.red.offset / 8))) = brush_color[0];
-                        *((char *)(fb_ptr + offset + (vinfo.green.offset / 8))) = brush_color[1];
-                        *((char *)(fb_ptr + offset + (vinfo.blue.offset / 8))) = brush_color[2];
-                    }
-                }
-            }
-        }
-    }
+// Draws the cursor as the inverse of the canvas pixel under it. It only ever
+// goes to the screen, so the canvas keeps the real image.
+void draw_cursor(void) {
+    int bpp = fbimg_format_bpp(canvas.format);
+    const char *pixel = canvas.pixels + (size_t)cursor_y * canvas.stride + (size_t)cursor_x * bpp;
+    char inverse[4];
+    for (int i = 0; i < bpp; i++) inverse[i] = ~pixel[i];
+    blit_image(&screen, fb_ptr, finfo.line_length, canvas_x + cursor_x, canvas_y + cursor_y, inverse, bpp, 1, 1);
 }
 
-int **bresenham(int x1, int y1, int x2, int y2, int *out_count) {
-    int dx = abs(x2 - x1);
-    int dy = abs(y2 - y1);
-    int sx = (x1 < x2) ? 1 : -1;
-    int sy = (y1 < y2) ? 1 : -1;
-
-    int max_points = dx > dy ? dx + 1 : dy + 1; // number of points on the line
-    int **points = malloc(max_points * sizeof(int *));
-    if (!points) return NULL;
-
-    for (int i = 0; i < max_points; i++) {
-        points[i] = malloc(2 * sizeof(int));
-        if (!points[i]) {
-            // free previously allocated rows on failure
-            for (int j = 0; j < i; j++) free(points[j]);
-            free(points);
-            return NULL;
-        }
-    }
-
-    int err = (dx > dy ? dx : -dy) / 2;
-    int x = x1, y = y1, i = 0;
-
-    while (true) {
-        points[i][0] = x;
-        points[i][1] = y;
-        i++;
-
-        if (x == x2 && y == y2) break;
-
-        int e2 = err;
-        if (e2 > -dx) {
-            err -= dy;
-            x += sx;
-        }
-        if (e2 < dy) {
-            err += dx;
-            y += sy;
-        }
-    }
+// Copies the dirty parts of the canvas to the screen, puts the cursor on top
+// and shows the result
+void present(void) {
+    struct canvas_rect area;
+    if (!canvas_flush(&canvas, &screen, fb_ptr, finfo.line_length, canvas_x, canvas_y, &area)) return;
+    draw_cursor();
+    fb_device_present(&fb, area.x, area.y, area.width, area.height);
+    fb_ptr = fb_device_draw_buffer(&fb);
+}
 
-    *out_count = i;
-    return points;
+// Paints a stroke of brush_size from (x1, y1) to (x2, y2) on the canvas
+void draw_stroke(int x1, int y1, int x2, int y2) {
+    struct raster_clip clip = {0, 0, canvas.width, canvas.height};
+    int r = brush.disc.radius;
+    int left = (x1 < x2 ? x1 : x2) - r, top = (y1 < y2 ? y1 : y2) - r;
+    int right = (x1 > x2 ? x1 : x2) + r, bottom = (y1 > y2 ? y1 : y2) + r;
+    history_save(&history, left, top, right - left + 1, bottom - top + 1);
+    brush_stroke(&brush, canvas.pixels, canvas.stride, x1, y1, x2, y2, &clip);
+    canvas_damage(&canvas, left, top, right - left + 1, bottom - top + 1);
 }
 
 void parse_color(const char *buffer, char *brush_color) {
@@ -106,147 +83,152 @@ void parse_color(const char *buffer, char *brush_color) {
     }
 }
 
-void sigint() {
-    interrupt = 1;
-}
-
 void save_and_exit() {
-    char *data = malloc(image_width * image_height * 3);
-    for (int i = 0; i < image_height; i++) {
-        for (int v = 0; v < image_width; v++) {
-            int offset =
-                (i + (vinfo.yres - image_height) / 2) * finfo.line_length +
-                (v + (vinfo.xres - image_width) / 2) *
-                    (vinfo.bits_per_pixel / 8);
-            int data_offset = (i * image_width + v) * 3;
-            char red = *((char *)(fb_ptr + offset + (vinfo.red.offset / 8)));
-            char green = *((char *)(fb_ptr + offset + (vinfo.green.offset / 8)));
-            char blue = *((char *)(fb_ptr + offset + (vinfo.blue.offset / 8)));
-            data[data_offset] = red;
-            data[data_offset + 1] = green;
-            data[data_offset + 2] = blue;
-        }
-    }
-    FILE *file = fopen(filename, "wb");
     tcsetattr(STDOUT_FILENO, TCSANOW, &oldt);
-    if (!file) {
-        perror("Error opening file for writing");
-        free(data);
+    if (canvas_save(&canvas, filename) == -1) {
+        perror("Error writing file");
         exit(EXIT_FAILURE);
     }
-    fwrite("FBIMG", 1, 5, file);
-    fwrite(&image_width, sizeof(uint32_t), 1, file);
-    fwrite(&image_height, sizeof(uint32_t), 1, file);
-    char color[4] = "RGB"; // Default color format
-    fwrite(color, 1, 3, file);
-    fwrite(data, 1, image_width * image_height * 3, file);
-    fclose(file);
     printf("\033[?25h\033[H\033[J"); // Show cursor and clear console
     fflush(stdout);
-    munmap(fb_ptr, finfo.smem_len);
-    close(fb_fd);
-    free(data);
+    fb_device_close(&fb);
+    canvas_free(&canvas);
     exit(0);
 }
 
-int draw_image(char fname[], int offset_x, int offset_y, bool centered) {
+// Loads an image into a new canvas, scaled down if it doesn't fit the screen
+int load_image(char fname[]) {
     filename = malloc(strlen(fname) + 1);
     strcpy(filename, fname);
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        perror("Error opening file");
+    struct fbimg img;
+    int error = fbimg_open(filename, &img);
+    if (error != FBIMG_OK) {
+        fprintf(stderr, "Error opening file: %s\n", fbimg_error_text(error));
         return 1;
     }
-    char magic[6] = {0}; // Allocate space for 5 characters + null terminator
-    size_t bytesRead = fread(magic, 1, 5, file);
-    if (bytesRead != 5) {
-        fprintf(stderr, "Unexpected end of file\n");
-        fclose(file);
-        return 1;
+    uint32_t image_width = img.width, image_height = img.height;
+    const char *data = img.pixels;
+    size_t stride = img.stride;
+    int format = img.format;
+    char *scaled = NULL;
+
+    if (vinfo.xres < image_width || vinfo.yres < image_height) {
+        int new_width, new_height;
+        scale_fit(image_width, image_height, vinfo.xres, vinfo.yres, &new_width, &new_height);
+        // The scaler works on tightly packed 3-byte pixels
+        char *decoded = NULL, *unpacked = NULL;
+        if (img.flags & FBIMG_FLAG_RLE) {
+            decoded = fbimg_decode(&img);
+            data = decoded;
+            stride = (size_t)image_width * fbimg_format_bpp(format);
+        }
+        if (data && (fbimg_format_bpp(format) != 3 || stride != (size_t)image_width * 3)) {
+            unpacked = blit_convert_to_rgb(data, stride, format, image_width, image_height);
+            data = unpacked;
+            format = FBIMG_FORMAT_RGB888;
+        }
+        if (data)
+            scaled = scale_image_mt((char *)data, false, image_width, image_height,
+                                    new_width, new_height, 0);
+        free(unpacked);
+        free(decoded);
+        if (!scaled) {
+            fprintf(stderr, "Error: out of memory or corrupt data while scaling image\n");
+            fbimg_close(&img);
+            return 1;
+        }
+        data = scaled;
+        stride = (size_t)new_width * 3;
+        image_width = new_width;
+        image_height = new_height;
     }
-    if (strcmp(magic, "FBIMG") != 0) {
-        fprintf(stderr, "Not a valid FBIMG file\n");
-        fclose(file);
+
+    if (canvas_init(&canvas, image_width, image_height, canvas_format(&vinfo)) == -1) {
+        fprintf(stderr, "Error: out of memory\n");
+        free(scaled);
+        fbimg_close(&img);
         return 1;
     }
-    fread(&image_width, sizeof(uint32_t), 1, file);
-    fread(&image_height, sizeof(uint32_t), 1, file);
-    char color[4] = {0};
-    fread(color, 1, 3, file);
-    char *data = malloc(image_width * image_height * 3);
-    fread(data, 1, image_width * image_height * 3, file);
-    fclose(file);
-
-    if (vinfo.red.length != 8 || vinfo.green.length != 8 ||
-        vinfo.blue.length != 8) {
-        fprintf(stderr,
-                "Error: framebuffer color depth per channel is not 8 bits; "
-                "framebuffer not supported\n");
-        close(fb_fd);
+    struct fb_var_screeninfo canvas_info;
+    canvas_vinfo(&canvas, &canvas_info);
+    struct blitter blitter;
+    blit_init(&blitter, &canvas_info, format);
+    if (scaled) {
+        blit_image(&blitter, canvas.pixels, canvas.stride, 0, 0, data, stride, image_width, image_height);
+    } else if (blit_fbimg(&blitter, canvas.pixels, canvas.stride, 0, 0, &img) == -1) {
+        fprintf(stderr, "Error: corrupt image data\n");
+        fbimg_close(&img);
         return 1;
     }
 
-    if (vinfo.xres < image_width) {
-        data = scale_image(data, false, image_width, image_height, vinfo.xres,
-                           image_height * ((float)vinfo.xres / image_width));
-        image_width = vinfo.xres;
-        image_height = (int)(image_height * ((float)vinfo.xres / image_width));
-    }
+    free(scaled);
+    fbimg_close(&img);
+    return 0;
+}
 
-    if (vinfo.yres < image_height) {
-        data = scale_image(data, false, image_width, image_height,
-                           image_width * ((float)vinfo.yres / image_height),
-                           vinfo.yres);
-        image_width = (int)(image_width * ((float)vinfo.yres / image_height));
-        image_height = vinfo.yres;
+// Handles a command typed on stdin
+void handle_command(int epfd) {
+    static char buffer[256];
+    ssize_t bytes_read = read(STDIN_FILENO, buffer, sizeof(buffer) - 1);
+    if (bytes_read == 0) {
+        // Keep painting without commands once stdin is closed
+        epoll_ctl(epfd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+        return;
     }
-
-    // Map framebuffer memory
-    size_t screensize = finfo.smem_len;
-    fb_ptr =
-        mmap(NULL, screensize, PROT_READ | PROT_WRITE, MAP_SHARED, fb_fd, 0);
-    if (fb_ptr == MAP_FAILED) {
-        perror("Error mapping framebuffer memory");
-        close(fb_fd);
-        return 1;
+    if (bytes_read < 0) return;
+    buffer[bytes_read] = '\0';
+    if (strcmp(buffer, "dq\n") == 0) {
+        tcsetattr(STDOUT_FILENO, TCSANOW, &oldt);
+        printf("\033[?25h\033[H\033[J"); // Show cursor and clear console
+        fflush(stdout);
+        fb_device_close(&fb);
+        exit(0);
+    } else if (strcmp(buffer, "sq\n") == 0) {
+        save_and_exit();
+    } else if (strcmp(buffer, "u\n") == 0) {
+        if (history_undo(&history)) present();
+        return;
+    } else if (strcmp(buffer, "r\n") == 0) {
+        if (history_redo(&history)) present();
+        return;
     }
-
-    if (centered) {
-        offset_x = (vinfo.xres - image_width) / 2;
-        offset_y = (vinfo.yres - image_height) / 2;
+    int size = atoi(buffer);
+    if (size > 0) {
+        if (brush_set_size(&brush, size) == 0) brush_size = size;
+    } else {
+        parse_color(buffer, brush_color);
+        brush_set_color(&brush, brush_color);
     }
+}
 
-    // Write pixels to framebuffer
-    for (int i = 0; i < image_height; i++) {
-        for (int j = 0; j < image_width; j++) {
-            int offset = (i + offset_y) * finfo.line_length +
-                         (j + offset_x) * (vinfo.bits_per_pixel / 8);
-            int data_offset = (i * image_width + j) * 3;
-            char red;
-            char green;
-            char blue;
-            char alpha = 0xFF;
-            if (strcmp(color, "RGB") == 0) {
-                red = data[data_offset];
-                green = data[data_offset + 1];
-                blue = data[data_offset + 2];
-            } else if (strcmp(color, "BGR") == 0) {
-                blue = data[data_offset];
-                green = data[data_offset + 1];
-                red = data[data_offset + 2];
-            }
-            if (vinfo.transp.length > 0) {
-                *((char *)(fb_ptr + offset + (vinfo.transp.offset / 8))) =
-                    alpha;
-            }
-            *((char *)(fb_ptr + offset + (vinfo.red.offset / 8))) = red;
-            *((char *)(fb_ptr + offset + (vinfo.green.offset / 8))) = green;
-            *((char *)(fb_ptr + offset + (vinfo.blue.offset / 8))) = blue;
+// Applies all pending mouse packets and presents the area they touched once
+void handle_mouse(int mousedev) {
+    static signed char packets[3 * 64];
+    ssize_t bytes = read(mousedev, packets, sizeof(packets));
+    if (bytes < 3) return;
+    for (ssize_t i = 0; i + 3 <= bytes; i += 3) {
+        signed char *mouse = packets + i;
+        int prev_x = cursor_x, prev_y = cursor_y;
+        int x = cursor_x + mouse[1];
+        int y = cursor_y - mouse[2];
+        if (x < 0) x = 0;
+        if (y < 0) y = 0;
+        if (x >= (int)canvas.width) x = canvas.width - 1;
+        if (y >= (int)canvas.height) y = canvas.height - 1;
+        // Every press of the left button is one step of the undo history
+        if (mouse[0] & 1) {
+            if (!history.recording) history_begin(&history);
+            draw_stroke(prev_x, prev_y, x, y);
+        } else {
+            history_end(&history);
         }
+        cursor_x = x;
+        cursor_y = y;
+        // The old cursor position gets the canvas back, the new one the cursor
+        canvas_damage(&canvas, prev_x, prev_y, 1, 1);
+        canvas_damage(&canvas, x, y, 1, 1);
     }
-
-    free(data);
-    return 0;
+    present();
 }
 
 int main(int argc, char *argv[]) {
@@ -255,9 +237,13 @@ int main(int argc, char *argv[]) {
         {"usage", no_argument, NULL, 'u'},
         {"color", required_argument, NULL, 'c'},
         {"size", required_argument, NULL, 's'},
+        {"fb", required_argument, NULL, 'f'},
+        {"history", required_argument, NULL, 'm'},
+        {"compress-history", no_argument, NULL, 'z'},
         {NULL, 0, NULL, 0}};
+    const char *device = NULL;
     int opt;
-    while ((opt = getopt_long(argc, argv, "huc:s:", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "huc:s:f:m:z", long_options, NULL)) != -1) {
         switch (opt) {
             case 'h':
                 printf("Usage: %s [options] [filename]\n", argv[0]);
@@ -266,6 +252,11 @@ int main(int argc, char *argv[]) {
                 printf("  -u, --usage    Show usage information\n");
                 printf("  -c, --color    Set brush color (hex format)\n");
                 printf("  -s, --size     Set brush size (positive integer)\n");
+                printf("  -f, --fb       Framebuffer device or virtual framebuffer file\n");
+                printf("                 (default: $%s or %s)\n", FB_DEVICE_ENV, FB_DEVICE_DEFAULT);
+                printf("  -m, --history  Memory for undo in MiB (default 64, 0 disables undo)\n");
+                printf("  -z, --compress-history\n");
+                printf("                 Run-length encode older undo steps to keep more of them\n");
                 return 0;
             case 'u':
                 printf("A painting program that runs on the framebuffer\n");
@@ -280,6 +271,19 @@ int main(int argc, char *argv[]) {
                     return 1;
                 }
                 break;
+            case 'f':
+                device = optarg;
+                break;
+            case 'm':
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "Error: History size must not be negative\n");
+                    return 1;
+                }
+                history_budget = (size_t)atoi(optarg) << 20;
+                break;
+            case 'z':
+                compress_history = true;
+                break;
             default:
                 fprintf(stderr, "Usage: %s [options] [filename]\n", argv[0]);
                 exit(EXIT_FAILURE);
@@ -288,121 +292,88 @@ int main(int argc, char *argv[]) {
 
     printf("\033[?25l"); // Hide cursor
     fflush(stdout);
-    signal(SIGINT, sigint);
+    // SIGINT is read from a signalfd in the main loop instead of interrupting it
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    int sigfd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
     tcgetattr(STDIN_FILENO, &oldt);
     newt = oldt;
     newt.c_lflag &= ~(ECHO); // Disable echo
     tcsetattr(STDIN_FILENO, TCSANOW, &newt);
     fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK);
 
-    fb_fd = open("/dev/fb0", O_RDWR);
-    if (fb_fd == -1) {
+    if (fb_device_open(&fb, fb_device_path(device), true) == -1) {
         perror("Error opening framebuffer device");
         return 1;
     }
-
-    // Get variable screen info
-    if (ioctl(fb_fd, FBIOGET_VSCREENINFO, &vinfo) == -1) {
-        perror("Error getting screen info");
-        close(fb_fd);
-        return 1;
+    vinfo = fb.vinfo;
+    finfo = fb.finfo;
+    if (optind < argc) {
+        if (load_image(argv[optind]) != 0) {
+            fb_device_close(&fb);
+            return 1;
+        }
+    } else {
+        if (canvas_init(&canvas, vinfo.xres, vinfo.yres, canvas_format(&vinfo)) == -1) {
+            fprintf(stderr, "Error: out of memory\n");
+            fb_device_close(&fb);
+            return 1;
+        }
+        filename = "paint.fbimg";
     }
-
-    // Get fixed screen info
-    if (ioctl(fb_fd, FBIOGET_FSCREENINFO, &finfo) == -1) {
-        perror("Error getting fixed screen info");
-        close(fb_fd);
+    canvas_x = (vinfo.xres - canvas.width) / 2;
+    canvas_y = (vinfo.yres - canvas.height) / 2;
+    struct fb_var_screeninfo canvas_info;
+    canvas_vinfo(&canvas, &canvas_info);
+    if (blit_init(&screen, &vinfo, canvas.format) != 0 || brush_init(&brush, &canvas_info, brush_size, brush_color) != 0) {
+        fprintf(stderr, "Error: framebuffer pixel format not supported\n");
+        fb_device_close(&fb);
         return 1;
     }
-    if (vinfo.red.length != 8 || vinfo.green.length != 8 ||
-        vinfo.blue.length != 8) {
-        fprintf(stderr,
-                "Error: framebuffer color depth per channel is not 8 bits; "
-                "framebuffer not supported\n");
-        close(fb_fd);
+    if (fb_device_map(&fb) == -1) {
+        perror("Error mapping framebuffer memory");
+        fb_device_close(&fb);
         return 1;
     }
-    if (optind < argc) {
-        char *filename = argv[optind];
-        draw_image(filename, 0, 0, true);
-    } else {
-        fb_ptr = mmap(NULL, finfo.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED, fb_fd, 0);
-        for (int i = 0; i < vinfo.yres * finfo.line_length; i++) {
-            *((char *)(fb_ptr + i)) = 0; // Clear framebuffer
-        }
-        image_width = vinfo.xres;
-        image_height = vinfo.yres;
-        filename = "paint.fbimg";
+    if (history_init(&history, &canvas, history_budget, compress_history) != 0) {
+        fprintf(stderr, "Error: out of memory\n");
+        fb_device_close(&fb);
+        return 1;
     }
-    int mousedev = open("/dev/input/mice", O_RDONLY);
+    fb_ptr = fb_device_draw_buffer(&fb);
+    canvas_damage(&canvas, 0, 0, canvas.width, canvas.height);
+    present();
+    int mousedev = open("/dev/input/mice", O_RDONLY | O_NONBLOCK);
     if (mousedev == -1) {
         perror("Error opening mouse device");
-        munmap(fb_ptr, finfo.smem_len);
-        close(fb_fd);
+        fb_device_close(&fb);
         return 1;
     }
-    int x = 0, y = 0;
-    int prev_x = 0, prev_y = 0;
-    char *pixel = (char[]){fb_ptr[0], fb_ptr[1], fb_ptr[2]};
-    while (true) {
-        if (interrupt) {
-            save_and_exit();
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN};
+    int fds[] = {STDIN_FILENO, mousedev, sigfd};
+    for (int i = 0; i < 3; i++) {
+        ev.data.fd = fds[i];
+        if (epfd == -1 || sigfd == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) == -1) {
+            perror("Error setting up the event loop");
+            fb_device_close(&fb);
+            return 1;
         }
-        char *buffer = malloc(256);
-        ssize_t bytes_read = read(STDIN_FILENO, buffer, 256);
-        if (bytes_read != -1) {
-            buffer[bytes_read] = '\0';
-            if (strcmp(buffer, "dq\n") == 0) {
-                tcsetattr(STDOUT_FILENO, TCSANOW, &oldt);
-                printf("\033[?25h\033[H\033[J"); // Show cursor and clear console
-                fflush(stdout);
-                munmap(fb_ptr, finfo.smem_len);
-                close(fb_fd);
-                exit(0);
-                return 0;
-            } else if (strcmp(buffer, "sq\n") == 0) {
+    }
+    while (true) {
+        struct epoll_event events[3];
+        int count = epoll_wait(epfd, events, 3, -1);
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == sigfd) {
                 save_and_exit();
-                return 0;
-            }
-            int size = atoi(buffer);
-            if (size > 0) {
-                brush_size = size;
-            } else {
-                parse_color(buffer, brush_color);
-            }
-        }
-        free(buffer);
-        signed char mouse[3];
-        ssize_t bytes = read(mousedev, mouse, sizeof(mouse));
-        if (bytes == 3) {
-            prev_x = x;
-            prev_y = y;
-            x += mouse[1];
-            y -= mouse[2];
-            if (x < (vinfo.xres - image_width) / 2)
-                x = (vinfo.xres - image_width) / 2;
-            if (y < (vinfo.yres - image_height) / 2)
-                y = (vinfo.yres - image_height) / 2;
-            if (x >= vinfo.xres - (vinfo.xres - image_width) / 2)
-                x = vinfo.xres - (vinfo.xres - image_width) / 2 - 1;
-            if (y >= vinfo.yres - (vinfo.yres - image_height) / 2)
-                y = vinfo.yres - (vinfo.yres - image_height) / 2 - 1;
-            memcpy(fb_ptr + (prev_y * finfo.line_length) + prev_x * (vinfo.bits_per_pixel / 8), pixel, 3);
-            memcpy(pixel, fb_ptr + (y * finfo.line_length) + x * (vinfo.bits_per_pixel / 8), 3);
-            char *ipixel = (char[]){~pixel[0], ~pixel[1], ~pixel[2]};
-            memcpy(fb_ptr + (y * finfo.line_length) + x * (vinfo.bits_per_pixel / 8), ipixel, 3);
-            if (mouse[0] & 1) {
-                int count = 0;
-                int **line_points = bresenham(prev_x, prev_y, x, y, &count);
-                if (line_points) {
-                    for (int i = 0; i < count; i++) {
-                        draw_circle(line_points[i][0], line_points[i][1]);
-                        free(line_points[i]);
-                    }
-                    free(line_points);
-                }
+            } else if (fd == STDIN_FILENO) {
+                handle_command(epfd);
+            } else if (fd == mousedev) {
+                handle_mouse(mousedev);
             }
         }
-        usleep(1000);
     }
 }
@@ -0,0 +1,553 @@
+#include "include/pixconv.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define PIXCONV_X86
+#elif defined(__aarch64__) || (defined(__arm__) && defined(__ARM_NEON))
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#define PIXCONV_NEON
+#ifndef HWCAP_ASIMD
+#define HWCAP_ASIMD (1 << 1)
+#endif
+#ifndef HWCAP_NEON
+#define HWCAP_NEON (1 << 12)
+#endif
+#endif
+
+// Byte level kernels: expand turns 3-byte pixels into 4-byte ones with x as
+// the last byte, pack drops the last byte. The _swap variants also reverse the
+// order of the three color bytes. fill32 stores the same word count times.
+// blend composites premultiplied ARGB words over the destination words.
+struct kernels {
+    const char *name;
+    void (*swap24)(uint8_t *dst, const uint8_t *src, size_t count);
+    void (*expand)(uint8_t *dst, const uint8_t *src, size_t count, uint8_t x);
+    void (*expand_swap)(uint8_t *dst, const uint8_t *src, size_t count, uint8_t x);
+    void (*pack)(uint8_t *dst, const uint8_t *src, size_t count);
+    void (*pack_swap)(uint8_t *dst, const uint8_t *src, size_t count);
+    void (*fill32)(uint32_t *dst, uint32_t value, size_t count);
+    void (*blend)(uint32_t *dst, const uint32_t *src, size_t count);
+};
+
+static void swap24_scalar(uint8_t *dst, const uint8_t *src, size_t count) {
+    for (size_t i = 0; i < count; i++, dst += 3, src += 3) {
+        uint8_t first = src[0];
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = first;
+    }
+}
+
+static void expand_scalar(uint8_t *dst, const uint8_t *src, size_t count, uint8_t x) {
+    for (size_t i = 0; i < count; i++, dst += 4, src += 3) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = x;
+    }
+}
+
+static void expand_swap_scalar(uint8_t *dst, const uint8_t *src, size_t count, uint8_t x) {
+    for (size_t i = 0; i < count; i++, dst += 4, src += 3) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        dst[3] = x;
+    }
+}
+
+static void pack_scalar(uint8_t *dst, const uint8_t *src, size_t count) {
+    for (size_t i = 0; i < count; i++, dst += 3, src += 4) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+    }
+}
+
+static void pack_swap_scalar(uint8_t *dst, const uint8_t *src, size_t count) {
+    for (size_t i = 0; i < count; i++, dst += 3, src += 4) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+    }
+}
+
+static void fill32_scalar(uint32_t *dst, uint32_t value, size_t count) {
+    for (size_t i = 0; i < count; i++) dst[i] = value;
+}
+
+// x / 255 rounded to nearest for x up to 255 * 255
+static inline unsigned div255(unsigned x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Each channel, alpha included, becomes src + dst * (255 - alpha) / 255. The
+// sum saturates so that colors brighter than their alpha can't wrap.
+static void blend_scalar(uint32_t *dst, const uint32_t *src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t s = src[i];
+        unsigned inverse = 255 - (s >> 24);
+        if (s == 0) continue;
+        if (inverse == 0) {
+            dst[i] = s;
+            continue;
+        }
+        uint32_t d = dst[i], out = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            unsigned c = (s >> shift & 0xFF) + div255((d >> shift & 0xFF) * inverse);
+            out |= (uint32_t)(c < 255 ? c : 255) << shift;
+        }
+        dst[i] = out;
+    }
+}
+
+static const struct kernels scalar_kernels = {"scalar", swap24_scalar, expand_scalar, expand_swap_scalar, pack_scalar, pack_swap_scalar, fill32_scalar, blend_scalar};
+
+#ifdef PIXCONV_X86
+// SSE2 has no byte shuffle, so the baseline vector kernels need SSSE3 (pshufb)
+#define Z 0x80
+#define SHUF_EXPAND 0, 1, 2, Z, 3, 4, 5, Z, 6, 7, 8, Z, 9, 10, 11, Z
+#define SHUF_EXPAND_SWAP 2, 1, 0, Z, 5, 4, 3, Z, 8, 7, 6, Z, 11, 10, 9, Z
+#define SHUF_PACK 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, Z, Z, Z, Z
+#define SHUF_PACK_SWAP 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, Z, Z, Z, Z
+#define SHUF_SWAP24 2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15
+
+// The last 4 bytes pass through unchanged, so the 16-byte store is safe in
+// place and is overwritten by the next iteration otherwise
+__attribute__((target("ssse3"))) static void swap24_ssse3(uint8_t *dst, const uint8_t *src, size_t count) {
+    const __m128i mask = _mm_setr_epi8(SHUF_SWAP24);
+    size_t i = 0;
+    for (; i + 6 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 3));
+        _mm_storeu_si128((__m128i *)(dst + i * 3), _mm_shuffle_epi8(v, mask));
+    }
+    swap24_scalar(dst + i * 3, src + i * 3, count - i);
+}
+
+__attribute__((target("ssse3"), always_inline)) static inline void expand_ssse3_impl(uint8_t *dst, const uint8_t *src, size_t count, uint8_t x, bool swap) {
+    const __m128i mask = swap ? _mm_setr_epi8(SHUF_EXPAND_SWAP) : _mm_setr_epi8(SHUF_EXPAND);
+    const __m128i fill = _mm_set1_epi32((int)((uint32_t)x << 24));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const uint8_t *in = src + i * 3;
+        __m128i a = _mm_loadu_si128((const __m128i *)in);
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(in + 32));
+        __m128i *out = (__m128i *)(dst + i * 4);
+        _mm_storeu_si128(out, _mm_or_si128(_mm_shuffle_epi8(a, mask), fill));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), mask), fill));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), mask), fill));
+        _mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), mask), fill));
+    }
+    (swap ? expand_swap_scalar : expand_scalar)(dst + i * 4, src + i * 3, count - i, x);
+}
+
+__attribute__((target("ssse3"))) static void expand_ssse3(uint8_t *dst, const uint8_t *src, size_t count, uint8_t x) {
+    expand_ssse3_impl(dst, src, count, x, false);
+}
+
+__attribute__((target("ssse3"))) static void expand_swap_ssse3(uint8_t *dst, const uint8_t *src, size_t count, uint8_t x) {
+    expand_ssse3_impl(dst, src, count, x, true);
+}
+
+__attribute__((target("ssse3"), always_inline)) static inline void pack_ssse3_impl(uint8_t *dst, const uint8_t *src, size_t count, bool swap) {
+    const __m128i mask = swap ? _mm_setr_epi8(SHUF_PACK_SWAP) : _mm_setr_epi8(SHUF_PACK);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i *in = (const __m128i *)(src + i * 4);
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(in), mask);
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(in + 1), mask);
+        __m128i c = _mm_shuffle_epi8(_mm_loadu_si128(in + 2), mask);
+        __m128i d = _mm_shuffle_epi8(_mm_loadu_si128(in + 3), mask);
+        __m128i *out = (__m128i *)(dst + i * 3);
+        _mm_storeu_si128(out, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+    }
+    (swap ? pack_swap_scalar : pack_scalar)(dst + i * 3, src + i * 4, count - i);
+}
+
+__attribute__((target("ssse3"))) static void pack_ssse3(uint8_t *dst, const uint8_t *src, size_t count) {
+    pack_ssse3_impl(dst, src, count, false);
+}
+
+__attribute__((target("ssse3"))) static void pack_swap_ssse3(uint8_t *dst, const uint8_t *src, size_t count) {
+    pack_ssse3_impl(dst, src, count, true);
+}
+
+__attribute__((target("sse2"))) static void fill32_sse2(uint32_t *dst, uint32_t value, size_t count) {
+    const __m128i v = _mm_set1_epi32((int)value);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i *out = (__m128i *)(dst + i);
+        _mm_storeu_si128(out, v);
+        _mm_storeu_si128(out + 1, v);
+        _mm_storeu_si128(out + 2, v);
+        _mm_storeu_si128(out + 3, v);
+    }
+    for (; i + 4 <= count; i += 4) _mm_storeu_si128((__m128i *)(dst + i), v);
+    fill32_scalar(dst + i, value, count - i);
+}
+
+// Alpha of the two pixels in each half of a vector, spread over their four
+// 16-bit channels
+#define SHUF_ALPHA_LOW 3, Z, 3, Z, 3, Z, 3, Z, 7, Z, 7, Z, 7, Z, 7, Z
+#define SHUF_ALPHA_HIGH 11, Z, 11, Z, 11, Z, 11, Z, 15, Z, 15, Z, 15, Z, 15, Z
+
+// Runs of 4 fully transparent pixels are skipped and runs of 4 opaque ones
+// copied, so only the edges of icons and badges pay for the multiplies.
+// (x + 128) * 257 >> 16 is the same rounded division by 255 as div255().
+__attribute__((target("ssse3"))) static void blend_ssse3(uint32_t *dst, const uint32_t *src, size_t count) {
+    const __m128i alpha_mask = _mm_set1_epi32((int)0xFF000000);
+    const __m128i alpha_low = _mm_setr_epi8(SHUF_ALPHA_LOW), alpha_high = _mm_setr_epi8(SHUF_ALPHA_HIGH);
+    const __m128i full = _mm_set1_epi16(255), round = _mm_set1_epi16(128), scale = _mm_set1_epi16(257);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i alpha = _mm_and_si128(s, alpha_mask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xFFFF) continue;
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alpha_mask)) == 0xFFFF) {
+            _mm_storeu_si128((__m128i *)(dst + i), s);
+            continue;
+        }
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i low = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, _mm_shuffle_epi8(s, alpha_low)));
+        __m128i high = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, _mm_shuffle_epi8(s, alpha_high)));
+        low = _mm_mulhi_epu16(_mm_add_epi16(low, round), scale);
+        high = _mm_mulhi_epu16(_mm_add_epi16(high, round), scale);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epu8(s, _mm_packus_epi16(low, high)));
+    }
+    blend_scalar(dst + i, src + i, count - i);
+}
+
+static const struct kernels ssse3_kernels = {"ssse3", swap24_ssse3, expand_ssse3, expand_swap_ssse3, pack_ssse3, pack_swap_ssse3, fill32_sse2, blend_ssse3};
+
+// AVX2 shuffles within 128-bit lanes, so each lane gets its own 4 pixels:
+// the high lane is loaded 12 bytes after the low one
+__attribute__((target("avx2"), always_inline)) static inline __m256i load_pixels_avx2(const uint8_t *src) {
+    __m128i low = _mm_loadu_si128((const __m128i *)src);
+    __m128i high = _mm_loadu_si128((const __m128i *)(src + 12));
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+}
+
+// Stores the low 12 bytes of each lane as 24 contiguous bytes
+__attribute__((target("avx2"), always_inline)) static inline void store_packed_avx2(uint8_t *dst, __m256i v) {
+    v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(v));
+    _mm_storel_epi64((__m128i *)(dst + 16), _mm256_extracti128_si256(v, 1));
+}
+
+__attribute__((target("avx2"))) static void swap24_avx2(uint8_t *dst, const uint8_t *src, size_t count) {
+    const __m256i mask = _mm256_setr_epi8(SHUF_SWAP24, SHUF_SWAP24);
+    size_t i = 0;
+    for (; i + 10 <= count; i += 8) {
+        store_packed_avx2(dst + i * 3, _mm256_shuffle_epi8(load_pixels_avx2(src + i * 3), mask));
+    }
+    swap24_scalar(dst + i * 3, src + i * 3, count - i);
+}
+
+__attribute__((target("avx2"), always_inline)) static inline void expand_avx2_impl(uint8_t *dst, const uint8_t *src, size_t count, uint8_t x, bool swap) {
+    const __m256i mask = swap ? _mm256_setr_epi8(SHUF_EXPAND_SWAP, SHUF_EXPAND_SWAP) : _mm256_setr_epi8(SHUF_EXPAND, SHUF_EXPAND);
+    const __m256i fill = _mm256_set1_epi32((int)((uint32_t)x << 24));
+    size_t i = 0;
+    for (; i + 10 <= count; i += 8) {
+        __m256i v = _mm256_shuffle_epi8(load_pixels_avx2(src + i * 3), mask);
+        _mm256_storeu_si256((__m256i *)(dst + i * 4), _mm256_or_si256(v, fill));
+    }
+    (swap ? expand_swap_scalar : expand_scalar)(dst + i * 4, src + i * 3, count - i, x);
+}
+
+__attribute__((target("avx2"))) static void expand_avx2(uint8_t *dst, const uint8_t *src, size_t count, uint8_t x) {
+    expand_avx2_impl(dst, src, count, x, false);
+}
+
+__attribute__((target("avx2"))) static void expand_swap_avx2(uint8_t *dst, const uint8_t *src, size_t count, uint8_t x) {
+    expand_avx2_impl(dst, src, count, x, true);
+}
+
+__attribute__((target("avx2"), always_inline)) static inline void pack_avx2_impl(uint8_t *dst, const uint8_t *src, size_t count, bool swap) {
+    const __m256i mask = swap ? _mm256_setr_epi8(SHUF_PACK_SWAP, SHUF_PACK_SWAP) : _mm256_setr_epi8(SHUF_PACK, SHUF_PACK);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+        store_packed_avx2(dst + i * 3, _mm256_shuffle_epi8(v, mask));
+    }
+    (swap ? pack_swap_scalar : pack_scalar)(dst + i * 3, src + i * 4, count - i);
+}
+
+__attribute__((target("avx2"))) static void pack_avx2(uint8_t *dst, const uint8_t *src, size_t count) {
+    pack_avx2_impl(dst, src, count, false);
+}
+
+__attribute__((target("avx2"))) static void pack_swap_avx2(uint8_t *dst, const uint8_t *src, size_t count) {
+    pack_avx2_impl(dst, src, count, true);
+}
+
+__attribute__((target("avx2"))) static void fill32_avx2(uint32_t *dst, uint32_t value, size_t count) {
+    const __m256i v = _mm256_set1_epi32((int)value);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i *out = (__m256i *)(dst + i);
+        _mm256_storeu_si256(out, v);
+        _mm256_storeu_si256(out + 1, v);
+        _mm256_storeu_si256(out + 2, v);
+        _mm256_storeu_si256(out + 3, v);
+    }
+    for (; i + 8 <= count; i += 8) _mm256_storeu_si256((__m256i *)(dst + i), v);
+    fill32_scalar(dst + i, value, count - i);
+}
+
+// Same as blend_ssse3() on 8 pixels, the unpacks and shuffles work per lane
+__attribute__((target("avx2"))) static void blend_avx2(uint32_t *dst, const uint32_t *src, size_t count) {
+    const __m256i alpha_mask = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i alpha_low = _mm256_setr_epi8(SHUF_ALPHA_LOW, SHUF_ALPHA_LOW), alpha_high = _mm256_setr_epi8(SHUF_ALPHA_HIGH, SHUF_ALPHA_HIGH);
+    const __m256i full = _mm256_set1_epi16(255), round = _mm256_set1_epi16(128), scale = _mm256_set1_epi16(257);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i alpha = _mm256_and_si256(s, alpha_mask);
+        if (_mm256_testz_si256(s, s)) continue;
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(alpha, alpha_mask)) == -1) {
+            _mm256_storeu_si256((__m256i *)(dst + i), s);
+            continue;
+        }
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i low = _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(full, _mm256_shuffle_epi8(s, alpha_low)));
+        __m256i high = _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(full, _mm256_shuffle_epi8(s, alpha_high)));
+        low = _mm256_mulhi_epu16(_mm256_add_epi16(low, round), scale);
+        high = _mm256_mulhi_epu16(_mm256_add_epi16(high, round), scale);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_adds_epu8(s, _mm256_packus_epi16(low, high)));
+    }
+    blend_ssse3(dst + i, src + i, count - i);
+}
+
+static const struct kernels avx2_kernels = {"avx2", swap24_avx2, expand_avx2, expand_swap_avx2, pack_avx2, pack_swap_avx2, fill32_avx2, blend_avx2};
+
+static const struct kernels *detect_kernels(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return &scalar_kernels;
+    bool ssse3 = ecx & bit_SSSE3;
+    bool avx2 = false;
+    if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+        // The OS has to save the YMM registers on context switches too
+        unsigned int xcr0_low, xcr0_high;
+        __asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+        if ((xcr0_low & 6) == 6 && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) avx2 = ebx & bit_AVX2;
+    }
+    if (avx2) return &avx2_kernels;
+    if (ssse3) return &ssse3_kernels;
+    return &scalar_kernels;
+}
+#elif defined(PIXCONV_NEON)
+static void swap24_neon(uint8_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x3_t v = vld3q_u8(src + i * 3);
+        uint8x16_t first = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = first;
+        vst3q_u8(dst + i * 3, v);
+    }
+    swap24_scalar(dst + i * 3, src + i * 3, count - i);
+}
+
+static inline void expand_neon_impl(uint8_t *dst, const uint8_t *src, size_t count, uint8_t x, bool swap) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x3_t in = vld3q_u8(src + i * 3);
+        uint8x16x4_t out;
+        out.val[0] = swap ? in.val[2] : in.val[0];
+        out.val[1] = in.val[1];
+        out.val[2] = swap ? in.val[0] : in.val[2];
+        out.val[3] = vdupq_n_u8(x);
+        vst4q_u8(dst + i * 4, out);
+    }
+    (swap ? expand_swap_scalar : expand_scalar)(dst + i * 4, src + i * 3, count - i, x);
+}
+
+static void expand_neon(uint8_t *dst, const uint8_t *src, size_t count, uint8_t x) {
+    expand_neon_impl(dst, src, count, x, false);
+}
+
+static void expand_swap_neon(uint8_t *dst, const uint8_t *src, size_t count, uint8_t x) {
+    expand_neon_impl(dst, src, count, x, true);
+}
+
+static inline void pack_neon_impl(uint8_t *dst, const uint8_t *src, size_t count, bool swap) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x4_t in = vld4q_u8(src + i * 4);
+        uint8x16x3_t out;
+        out.val[0] = swap ? in.val[2] : in.val[0];
+        out.val[1] = in.val[1];
+        out.val[2] = swap ? in.val[0] : in.val[2];
+        vst3q_u8(dst + i * 3, out);
+    }
+    (swap ? pack_swap_scalar : pack_scalar)(dst + i * 3, src + i * 4, count - i);
+}
+
+static void pack_neon(uint8_t *dst, const uint8_t *src, size_t count) {
+    pack_neon_impl(dst, src, count, false);
+}
+
+static void pack_swap_neon(uint8_t *dst, const uint8_t *src, size_t count) {
+    pack_neon_impl(dst, src, count, true);
+}
+
+static void fill32_neon(uint32_t *dst, uint32_t value, size_t count) {
+    const uint32x4_t v = vdupq_n_u32(value);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        vst1q_u32(dst + i, v);
+        vst1q_u32(dst + i + 4, v);
+        vst1q_u32(dst + i + 8, v);
+        vst1q_u32(dst + i + 12, v);
+    }
+    for (; i + 4 <= count; i += 4) vst1q_u32(dst + i, v);
+    fill32_scalar(dst + i, value, count - i);
+}
+
+// 8 pixels at a time, split into channel planes so alpha is a vector of its
+// own. Fully transparent runs are skipped and opaque ones copied.
+static void blend_neon(uint32_t *dst, const uint32_t *src, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x4_t s = vld4_u8((const uint8_t *)(src + i));
+        uint8x8_t any = vorr_u8(vorr_u8(s.val[0], s.val[1]), vorr_u8(s.val[2], s.val[3]));
+        if (vget_lane_u64(vreinterpret_u64_u8(any), 0) == 0) continue;
+        if (vget_lane_u64(vreinterpret_u64_u8(s.val[3]), 0) == UINT64_MAX) {
+            vst4_u8((uint8_t *)(dst + i), s);
+            continue;
+        }
+        uint8x8x4_t d = vld4_u8((const uint8_t *)(dst + i));
+        uint8x8_t inverse = vmvn_u8(s.val[3]);
+        for (int c = 0; c < 4; c++) {
+            uint16x8_t x = vaddq_u16(vmull_u8(d.val[c], inverse), vdupq_n_u16(128));
+            d.val[c] = vqadd_u8(s.val[c], vshrn_n_u16(vaddq_u16(x, vshrq_n_u16(x, 8)), 8));
+        }
+        vst4_u8((uint8_t *)(dst + i), d);
+    }
+    blend_scalar(dst + i, src + i, count - i);
+}
+
+static const struct kernels neon_kernels = {"neon", swap24_neon, expand_neon, expand_swap_neon, pack_neon, pack_swap_neon, fill32_neon, blend_neon};
+
+static const struct kernels *detect_kernels(void) {
+#ifdef __aarch64__
+    if (getauxval(AT_HWCAP) & HWCAP_ASIMD) return &neon_kernels;
+#else
+    if (getauxval(AT_HWCAP) & HWCAP_NEON) return &neon_kernels;
+#endif
+    return &scalar_kernels;
+}
+#else
+static const struct kernels *detect_kernels(void) {
+    return &scalar_kernels;
+}
+#endif
+
+static const struct kernels *kernels = &scalar_kernels;
+
+__attribute__((constructor)) static void pixconv_init(void) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    kernels = detect_kernels();
+#endif
+}
+
+const char *pixconv_backend(void) {
+    return kernels->name;
+}
+
+void pixconv_rgb_to_bgr(uint8_t *dst, const uint8_t *src, size_t count) {
+    kernels->swap24(dst, src, count);
+}
+
+void pixconv_rgb_to_rgba(uint8_t *dst, const uint8_t *src, size_t count) {
+    kernels->expand(dst, src, count, 0xFF);
+}
+
+void pixconv_bgr_to_rgba(uint8_t *dst, const uint8_t *src, size_t count) {
+    kernels->expand_swap(dst, src, count, 0xFF);
+}
+
+void pixconv_rgba_to_rgb(uint8_t *dst, const uint8_t *src, size_t count) {
+    kernels->pack(dst, src, count);
+}
+
+void pixconv_fill32(uint32_t *dst, uint32_t value, size_t count) {
+    kernels->fill32(dst, value, count);
+}
+
+void pixconv_blend_argb(uint32_t *dst, const uint32_t *src, size_t count) {
+    kernels->blend(dst, src, count);
+}
+
+void pixconv_rgba_to_argb_premultiplied(uint32_t *dst, const uint8_t *src, size_t count) {
+    for (size_t i = 0; i < count; i++, src += 4) {
+        unsigned alpha = src[3];
+        dst[i] = (uint32_t)alpha << 24 | div255(src[0] * alpha) << 16 | div255(src[1] * alpha) << 8 | div255(src[2] * alpha);
+    }
+}
+
+void pixconv_argb_premultiplied_to_rgba(uint8_t *dst, const uint32_t *src, size_t count) {
+    for (size_t i = 0; i < count; i++, dst += 4) {
+        unsigned alpha = src[i] >> 24;
+        for (int c = 0; c < 3; c++) {
+            unsigned value = alpha ? ((src[i] >> (16 - c * 8) & 0xFF) * 255 + alpha / 2) / alpha : 0;
+            dst[c] = value > 255 ? 255 : value;
+        }
+        dst[3] = alpha;
+    }
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+void pixconv_rgb_to_xrgb(uint32_t *dst, const uint8_t *src, size_t count, uint8_t x) {
+    kernels->expand_swap((uint8_t *)dst, src, count, x);
+}
+
+void pixconv_bgr_to_xrgb(uint32_t *dst, const uint8_t *src, size_t count, uint8_t x) {
+    kernels->expand((uint8_t *)dst, src, count, x);
+}
+
+void pixconv_xrgb_to_rgb(uint8_t *dst, const uint32_t *src, size_t count) {
+    kernels->pack_swap(dst, (const uint8_t *)src, count);
+}
+
+void pixconv_xrgb_to_bgr(uint8_t *dst, const uint32_t *src, size_t count) {
+    kernels->pack(dst, (const uint8_t *)src, count);
+}
+#else
+// Big-endian words are X, R, G, B in memory, which the byte kernels don't cover
+void pixconv_rgb_to_xrgb(uint32_t *dst, const uint8_t *src, size_t count, uint8_t x) {
+    for (size_t i = 0; i < count; i++, src += 3) dst[i] = (uint32_t)x << 24 | (uint32_t)src[0] << 16 | (uint32_t)src[1] << 8 | src[2];
+}
+
+void pixconv_bgr_to_xrgb(uint32_t *dst, const uint8_t *src, size_t count, uint8_t x) {
+    for (size_t i = 0; i < count; i++, src += 3) dst[i] = (uint32_t)x << 24 | (uint32_t)src[2] << 16 | (uint32_t)src[1] << 8 | src[0];
+}
+
+void pixconv_xrgb_to_rgb(uint8_t *dst, const uint32_t *src, size_t count) {
+    for (size_t i = 0; i < count; i++, dst += 3) {
+        dst[0] = src[i] >> 16;
+        dst[1] = src[i] >> 8;
+        dst[2] = src[i];
+    }
+}
+
+void pixconv_xrgb_to_bgr(uint8_t *dst, const uint32_t *src, size_t count) {
+    for (size_t i = 0; i < count; i++, dst += 3) {
+        dst[0] = src[i];
+        dst[1] = src[i] >> 8;
+        dst[2] = src[i] >> 16;
+    }
+}
+#endif
@@ -1,26 +1,274 @@
 #include <getopt.h>
+#include <linux/fb.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "thirdparty/lodepng/lodepng.h"
+#include "include/batch.h"
+#include "include/blit.h"
+#include "include/fb_device.h"
+#include "include/fbimg_file.h"
+#include "include/pixconv.h"
+#include "include/png_rows.h"
+#include "include/scale_img.h"
+
+// Picks the .fbimg format matching the framebuffer, and the size and line
+// length that let rows of full-width images be copied in one block
+static int query_framebuffer(const char *device, int *format, int *xres, int *yres, uint32_t *line_length) {
+    struct fb_device fb;
+    if (fb_device_open(&fb, device, false) == -1) {
+        perror("Error opening framebuffer device");
+        return -1;
+    }
+    struct fb_var_screeninfo vinfo = fb.vinfo;
+    struct fb_fix_screeninfo finfo = fb.finfo;
+    fb_device_close(&fb);
+    enum fb_layout layout = fb_detect_layout(&vinfo);
+    *format = fb_layout_format(layout);
+    if (*format < 0) {
+        fprintf(stderr, "Error: no .fbimg format matches the %s framebuffer layout\n", fb_layout_name(layout));
+        return -1;
+    }
+    *xres = vinfo.xres;
+    *yres = vinfo.yres;
+    *line_length = finfo.line_length;
+    return 0;
+}
+
+struct options {
+    int format; // -1 for RGB888, or ARGB8888 for images with transparency
+    int line_width; // Rows this many pixels wide are stored line_length apart, 0 for none
+    uint32_t line_length;
+    int fit_width, fit_height; // Larger images are scaled down to fit, 0 for no limit
+    uint32_t flags;
+};
+
+// Buffers kept from one file to the next
+struct converter {
+    struct png_rows png;
+    struct png_rows scan; // Looks for transparent pixels ahead of png
+    char *out_row;
+    size_t out_row_size;
+};
+
+// Where decoded or scaled rows go on their way to the file
+struct row_target {
+    const struct blitter *blitter;
+    struct fbimg_writer *writer;
+    char *out_row;
+    int format;
+    int width;
+    int status;
+};
+
+static void write_row(void *ctx, int y, const char *row) {
+    struct row_target *t = ctx;
+    if (t->status != 0) return;
+    if (t->format == FBIMG_FORMAT_ARGB8888) {
+        pixconv_rgba_to_argb_premultiplied((uint32_t *)t->out_row, (const uint8_t *)row, t->width);
+        row = t->out_row;
+    } else if (t->format != FBIMG_FORMAT_RGB888) {
+        blit_image(t->blitter, t->out_row, 0, 0, 0, row, (size_t)t->width * 3, t->width, 1);
+        row = t->out_row;
+    }
+    t->status = fbimg_writer_row(t->writer, row);
+}
+
+static int convert(struct converter *c, const struct options *o, const char *input_file, const char *output_file) {
+    // Rows are decoded, scaled and written one at a time, so memory use
+    // doesn't grow with the image
+    struct png_rows *png = &c->png;
+    int error = png_rows_reopen(input_file, png);
+    if (error != PNG_OK) {
+        fprintf(stderr, "Error decoding %s: %s\n", input_file, png_error_text(error));
+        return -1;
+    }
+    int width = png->width, height = png->height;
+    bool scale = (o->fit_width > 0 && width > o->fit_width) || (o->fit_height > 0 && height > o->fit_height);
+    if (scale) scale_fit(png->width, png->height, o->fit_width > 0 ? o->fit_width : width, o->fit_height > 0 ? o->fit_height : height, &width, &height);
+    // The scaler only handles three channels, so images that have to be
+    // scaled lose their transparency
+    int format = o->format;
+    if (format < 0 && !scale) png_rows_find_alpha(png, input_file, &c->scan);
+    if (format < 0) format = png->alpha && !scale ? FBIMG_FORMAT_ARGB8888 : FBIMG_FORMAT_RGB888;
+    if (format == FBIMG_FORMAT_ARGB8888 && scale) {
+        fprintf(stderr, "Error: %s doesn't fit and argb8888 images can't be scaled\n", input_file);
+        png_rows_end(png);
+        return -1;
+    }
+    uint32_t stride;
+    if (width == o->line_width) {
+        stride = o->line_length;
+    } else {
+        stride = fbimg_format_bpp(format) == 3 ? width * 3 : fbimg_stride(width, format);
+    }
+    size_t row_size = (size_t)width * fbimg_format_bpp(format);
+    if (c->out_row_size < row_size) {
+        free(c->out_row);
+        c->out_row = malloc(row_size);
+        c->out_row_size = c->out_row ? row_size : 0;
+        if (!c->out_row) {
+            fprintf(stderr, "Error: out of memory\n");
+            png_rows_end(png);
+            return -1;
+        }
+    }
+
+    struct scaler scaler;
+    struct scaler_stream stream;
+    if (scale && (scaler_init(&scaler, false, png->width, png->height, width, height) != 0 || scaler_stream_init(&stream, &scaler) != 0)) {
+        fprintf(stderr, "Error: out of memory while scaling %s\n", input_file);
+        png_rows_end(png);
+        return -1;
+    }
+
+    FILE *output = fopen(output_file, "wb");
+    if (!output) {
+        fprintf(stderr, "Error opening output file: %s\n", output_file);
+        if (scale) {
+            scaler_stream_free(&stream);
+            scaler_free(&scaler);
+        }
+        png_rows_end(png);
+        return -1;
+    }
+
+    // Write header to file
+    struct fbimg_writer writer;
+    int status = fbimg_writer_open(&writer, output, width, height, format, stride, o->flags);
+    if (status != 0) fprintf(stderr, "Error writing output file: %s\n", output_file);
+
+    // Write image data to file, one row at a time through the blitter so the
+    // pixels end up in the target layout
+    struct fb_var_screeninfo vinfo = {0};
+    fbimg_format_vinfo(format, &vinfo);
+    struct blitter blitter;
+    blit_init(&blitter, &vinfo, FBIMG_FORMAT_RGB888);
+    struct row_target target = {&blitter, &writer, c->out_row, format, width, status};
+    for (int y = 0; y < (int)png->height && target.status == 0; y++) {
+        const char *rgb_row = format == FBIMG_FORMAT_ARGB8888 ? png_rows_next_rgba(png) : png_rows_next(png);
+        if (!rgb_row) {
+            fprintf(stderr, "Error decoding %s: %s\n", input_file, png_error_text(png->error));
+            status = -1;
+            break;
+        }
+        if (scale) {
+            scaler_stream_push(&stream, y, rgb_row, write_row, &target);
+        } else {
+            write_row(&target, y, rgb_row);
+        }
+        if (target.status != 0) fprintf(stderr, "Error writing output file: %s\n", output_file);
+    }
+    if (target.status != 0) status = -1;
+
+    if (scale) {
+        scaler_stream_free(&stream);
+        scaler_free(&scaler);
+    }
+    fbimg_writer_free(&writer);
+    if (fclose(output) != 0 && status == 0) {
+        fprintf(stderr, "Error writing output file: %s\n", output_file);
+        status = -1;
+    }
+    png_rows_end(png);
+    return status;
+}
+
+static void free_converter(void *state) {
+    struct converter *c = state;
+    png_rows_close(&c->png);
+    png_rows_close(&c->scan);
+    free(c->out_row);
+    free(c);
+}
+
+static int convert_batch_file(void **state, const char *input, const char *output, void *ctx) {
+    if (!*state && !(*state = calloc(1, sizeof(struct converter)))) {
+        fprintf(stderr, "Error: out of memory\n");
+        return -1;
+    }
+    return convert(*state, ctx, input, output);
+}
 
 int main(int argc, char *argv[]) {
     const struct option long_options[] = {
         {"help", no_argument, NULL, 'h'},
         {"version", no_argument, NULL, 'v'},
+        {"target-format", required_argument, NULL, 't'},
+        {"format", required_argument, NULL, 't'},
+        {"match-fb", optional_argument, NULL, 'm'},
+        {"fit", required_argument, NULL, 's'},
+        {"compress", no_argument, NULL, 'z'},
+        {"fb", required_argument, NULL, 'f'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"out-dir", required_argument, NULL, 'o'},
         {NULL, 0, NULL, 0}};
 
+    struct options options = {-1, 0, 0, 0, 0, 0};
+    const char *target = NULL;
+    const char *device = NULL;
+    bool match_fb = false;
+    const char *out_dir = NULL;
+    int jobs = 0;
     int opt;
-    while ((opt = getopt_long(argc, argv, "hv", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "hvt:ms:zf:j:o:", long_options, NULL)) != -1) {
         switch (opt) {
             case 'h':
                 printf("Usage: %s [options] input output\n", argv[0]);
+                printf("       %s [options] --out-dir dir [input...]\n", argv[0]);
                 printf("Options:\n");
-                printf("  -h, --help       Show this help message\n");
-                printf("  -v, --version    Show version information\n");
+                printf("  -h, --help             Show this help message\n");
+                printf("  -v, --version          Show version information\n");
+                printf("  -t, --format           Pixel format of the output: rgb888, bgr888, xrgb8888,\n");
+                printf("      --target-format    bgrx8888, rgb565, argb8888 (premultiplied alpha, drawn\n");
+                printf("                         over the screen), or fb0 to match the framebuffer.\n");
+                printf("                         Default: argb8888 for images with transparency that\n");
+                printf("                         aren't scaled, rgb888 otherwise\n");
+                printf("  -m, --match-fb[=dev]   Store the pixels in the layout of the framebuffer and\n");
+                printf("                         scale larger images down to its resolution, so showing\n");
+                printf("                         them is a plain copy\n");
+                printf("  -s, --fit              Scale images larger than widthxheight down to fit\n");
+                printf("  -z, --compress         Run-length encode the pixel rows\n");
+                printf("  -f, --fb               Framebuffer matched by fb0 (default: $%s or %s)\n", FB_DEVICE_ENV, FB_DEVICE_DEFAULT);
+                printf("  -o, --out-dir          Convert every input, or every path read from stdin if\n");
+                printf("                         none are given, into this directory as name.fbimg\n");
+                printf("  -j, --jobs             Threads converting files with --out-dir (default: all CPUs)\n");
                 return 0;
+            case 't':
+                target = optarg;
+                break;
+            case 'm':
+                match_fb = true;
+                if (optarg) device = optarg;
+                break;
+            case 's': {
+                char *end;
+                options.fit_width = strtol(optarg, &end, 10);
+                options.fit_height = *end == 'x' ? strtol(end + 1, &end, 10) : 0;
+                if (*end != '\0' || options.fit_width <= 0 || options.fit_height <= 0) {
+                    fprintf(stderr, "Invalid size: %s. Use widthxheight.\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            case 'z':
+                options.flags |= FBIMG_FLAG_RLE;
+                break;
+            case 'f':
+                device = optarg;
+                break;
+            case 'o':
+                out_dir = optarg;
+                break;
+            case 'j':
+                jobs = atoi(optarg);
+                if (jobs <= 0) {
+                    fprintf(stderr, "Job count must be a positive integer.\n");
+                    return 1;
+                }
+                break;
             case 'v':
                 printf("FBTools %s v1.0\n", argv[0]);
                 return 0;
@@ -30,6 +278,42 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // The framebuffer is queried once, not for every file of a batch
+    if (match_fb && target) {
+        fprintf(stderr, "--match-fb and --format can't be combined\n");
+        return 1;
+    }
+    if (match_fb || (target && strcmp(target, "fb0") == 0)) {
+        int xres, yres;
+        if (query_framebuffer(fb_device_path(device), &options.format, &xres, &yres, &options.line_length) != 0) return 1;
+        options.line_width = xres;
+        if (match_fb && options.fit_width == 0) {
+            options.fit_width = xres;
+            options.fit_height = yres;
+        }
+    } else if (target && (options.format = fbimg_format_parse(target)) < 0) {
+        fprintf(stderr, "Unknown target format: %s\n", target);
+        return 1;
+    }
+
+    if (out_dir) {
+        struct batch_ops ops = {".fbimg", convert_batch_file, free_converter, &options};
+        char **paths = argv + optind;
+        size_t count = argc - optind;
+        char **read = NULL;
+        if (count == 0 && !(paths = read = batch_read_paths(stdin, &count))) {
+            fprintf(stderr, "Error reading paths from stdin\n");
+            return 1;
+        }
+        int failed = batch_run(&ops, paths, count, out_dir, jobs);
+        batch_free_paths(read, count);
+        return failed == 0 ? 0 : 1;
+    }
+    if (jobs > 0) {
+        fprintf(stderr, "--jobs needs --out-dir\n");
+        return 1;
+    }
+
     char *input_file = NULL;
     char *output_file = NULL;
 
@@ -42,49 +326,10 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    unsigned char *image;
-    unsigned width, height;
-    unsigned error = lodepng_decode32_file(&image, &width, &height, input_file);
-    if (error) {
-        fprintf(stderr, "Error decoding PNG: %s\n", lodepng_error_text(error));
-        return 1;
-    }
-    FILE *output = fopen(output_file, "wb");
-    if (!output) {
-        fprintf(stderr, "Error opening output file: %s\n", output_file);
-        free(image);
-        return 1;
-    }
-
-    char header[16];
-    const char *magic = "FBIMG";
-    const char *rgb = "RGB";
-    uint32_t width_uint32 = (uint32_t)width;
-    uint32_t height_uint32 = (uint32_t)height;
-    char *converted_img = malloc(width * height * 3);
-
-    memcpy(header, magic, 5);
-    memcpy(header + 5, &width_uint32, sizeof(uint32_t));
-    memcpy(header + 9, &height_uint32, sizeof(uint32_t));
-    memcpy(header + 13, rgb, 3);
-
-    // Write header to file
-    fwrite(header, sizeof(header), 1, output);
-    // Write image data to file
-
-    for (int px = 0; px < width * height; px++) {
-        int r = image[px * 4];
-        int g = image[px * 4 + 1];
-        int b = image[px * 4 + 2];
-        converted_img[px * 3] = r;
-        converted_img[px * 3 + 1] = g;
-        converted_img[px * 3 + 2] = b;
-    }
-    fwrite(converted_img, 1, width * height * 3, output);
-
-    fclose(output);
-    free(converted_img);
-    free(image);
-
-    return 0;
+    struct converter converter = {0};
+    int status = convert(&converter, &options, input_file, output_file);
+    png_rows_close(&converter.png);
+    png_rows_close(&converter.scan);
+    free(converter.out_row);
+    return status == 0 ? 0 : 1;
 }
@@ -0,0 +1,445 @@
+#include "include/png_rows.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "include/pixconv.h"
+#include "thirdparty/lodepng/lodepng.h"
+
+#define PNG_RELEASE_MASK ((1 << 20) - 1)
+
+static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+static uint32_t read_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static int read_be16(const uint8_t *p) {
+    return p[0] << 8 | p[1];
+}
+
+bool png_signature(const void *data, size_t size) {
+    return size >= sizeof(signature) && memcmp(data, signature, sizeof(signature)) == 0;
+}
+
+// Hands the IDAT chunks to the decoder one after another, straight from the
+// mapping
+static int next_idat(void *ctx, const uint8_t **data, size_t *size) {
+    struct png_rows *png = ctx;
+    size_t pos = png->next_chunk;
+    if (pos > png->size || png->size - pos < 8 || memcmp(png->data + pos + 4, "IDAT", 4) != 0) return -1;
+    size_t length = read_be32(png->data + pos);
+    // A cut off chunk still yields what is there
+    if (length > png->size - pos - 8) length = png->size - pos - 8;
+    *data = png->data + pos + 8;
+    *size = length;
+    png->next_chunk = pos + 12 + length;
+    return 0;
+}
+
+// Checks the bit depth against the color type and returns the bits per pixel, or 0
+static int bits_per_pixel(int color_type, int bit_depth) {
+    switch (color_type) {
+        case 0:
+            return (bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8 || bit_depth == 16) ? bit_depth : 0;
+        case 3:
+            return (bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8) ? bit_depth : 0;
+        case 2:
+        case 4:
+        case 6: {
+            int channels = color_type == 2 ? 3 : color_type == 4 ? 2 : 4;
+            return (bit_depth == 8 || bit_depth == 16) ? channels * bit_depth : 0;
+        }
+        default:
+            return 0;
+    }
+}
+
+// Maps and checks a file, keeping whatever buffers png already has
+static int open_file(const char *path, struct png_rows *png) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return PNG_EIO;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return PNG_EIO;
+    }
+    if (st.st_size < (off_t)sizeof(signature)) {
+        close(fd);
+        return PNG_ETRUNCATED;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return PNG_EIO;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    png->map = map;
+    png->map_size = st.st_size;
+    png->data = map;
+    png->size = st.st_size;
+    if (!png_signature(png->data, png->size)) {
+        png_rows_end(png);
+        return PNG_EFORMAT;
+    }
+
+    // Everything needed before the pixels comes ahead of the first IDAT
+    bool header = false, interlaced = false;
+    memset(png->palette_alpha, 0xFF, sizeof(png->palette_alpha));
+    png->key[0] = png->key[1] = png->key[2] = -1;
+    size_t pos = sizeof(signature);
+    while (true) {
+        if (png->size - pos < 12) {
+            png_rows_end(png);
+            return PNG_ETRUNCATED;
+        }
+        const uint8_t *chunk = png->data + pos;
+        size_t length = read_be32(chunk);
+        if (length > png->size - pos - 12 && memcmp(chunk + 4, "IDAT", 4) != 0) {
+            png_rows_end(png);
+            return PNG_ETRUNCATED;
+        }
+        if (memcmp(chunk + 4, "IHDR", 4) == 0 && length == 13) {
+            png->width = read_be32(chunk + 8);
+            png->height = read_be32(chunk + 12);
+            png->bit_depth = chunk[16];
+            png->color_type = chunk[17];
+            interlaced = chunk[20] == 1;
+            header = chunk[18] == 0 && chunk[19] == 0 && chunk[20] <= 1;
+        } else if (memcmp(chunk + 4, "PLTE", 4) == 0 && length % 3 == 0 && length <= sizeof(png->palette)) {
+            memcpy(png->palette, chunk + 8, length);
+            png->palette_size = length / 3;
+        } else if (memcmp(chunk + 4, "tRNS", 4) == 0) {
+            // Comes after IHDR and PLTE
+            if (png->color_type == 3 && length <= sizeof(png->palette_alpha)) {
+                memcpy(png->palette_alpha, chunk + 8, length);
+                png->alpha = true;
+            } else if ((png->color_type == 0 && length == 2) || (png->color_type == 2 && length == 6)) {
+                for (size_t i = 0; i < length / 2; i++) png->key[i] = read_be16(chunk + 8 + i * 2);
+                png->alpha = true;
+            }
+        } else if (memcmp(chunk + 4, "IDAT", 4) == 0) {
+            break;
+        }
+        pos += 12 + length;
+    }
+    if (png->color_type == 4 || png->color_type == 6) png->alpha = true;
+    int bits = bits_per_pixel(png->color_type, png->bit_depth);
+    if (!header || bits == 0 || png->width == 0 || png->height == 0 || png->width > INT32_MAX / 4 || png->height > INT32_MAX) {
+        png_rows_end(png);
+        return PNG_EFORMAT;
+    }
+    png->row_bytes = ((uint64_t)png->width * bits + 7) / 8;
+    png->filter_bpp = bits >= 8 ? bits / 8 : 1;
+
+    if (png->rgb_capacity < (size_t)png->width * 4) {
+        free(png->rgb);
+        png->rgb = malloc((size_t)png->width * 4);
+        png->rgb_capacity = png->rgb ? (size_t)png->width * 4 : 0;
+        if (!png->rgb) {
+            png_rows_end(png);
+            errno = ENOMEM;
+            return PNG_EIO;
+        }
+    }
+    if (interlaced) {
+        // Adam7 passes cover the whole image before the last row is known
+        unsigned width, height;
+        if (lodepng_decode32(&png->decoded, &width, &height, png->data, png->size) != 0) {
+            png_rows_end(png);
+            return PNG_ECORRUPT;
+        }
+        return PNG_OK;
+    }
+
+    if (!png->z) png->z = malloc(sizeof(*png->z));
+    if (png->row_capacity < png->row_bytes + 1) {
+        free(png->rows[0]);
+        free(png->rows[1]);
+        png->rows[0] = malloc(png->row_bytes + 1);
+        png->rows[1] = malloc(png->row_bytes + 1);
+        png->row_capacity = png->row_bytes + 1;
+    }
+    if (!png->z || !png->rows[0] || !png->rows[1]) {
+        png_rows_close(png);
+        errno = ENOMEM;
+        return PNG_EIO;
+    }
+    // The first row is unfiltered against a row of zeros
+    memset(png->rows[1], 0, png->row_bytes + 1);
+    png->next_chunk = pos;
+    inflate_init(png->z, next_idat, png);
+    return PNG_OK;
+}
+
+int png_rows_open(const char *path, struct png_rows *png) {
+    memset(png, 0, sizeof(*png));
+    return open_file(path, png);
+}
+
+int png_rows_reopen(const char *path, struct png_rows *png) {
+    png_rows_end(png);
+    struct png_rows kept = *png;
+    memset(png, 0, sizeof(*png));
+    png->z = kept.z;
+    png->rows[0] = kept.rows[0];
+    png->rows[1] = kept.rows[1];
+    png->row_capacity = kept.row_capacity;
+    png->rgb = kept.rgb;
+    png->rgb_capacity = kept.rgb_capacity;
+    return open_file(path, png);
+}
+
+void png_rows_end(struct png_rows *png) {
+    free(png->decoded);
+    png->decoded = NULL;
+    if (png->map) munmap(png->map, png->map_size);
+    png->map = NULL;
+    png->data = NULL;
+}
+
+void png_rows_close(struct png_rows *png) {
+    png_rows_end(png);
+    free(png->z);
+    free(png->rows[0]);
+    free(png->rows[1]);
+    free(png->rgb);
+    memset(png, 0, sizeof(*png));
+}
+
+const char *png_error_text(int error) {
+    switch (error) {
+        case PNG_OK:
+            return "No error";
+        case PNG_EIO:
+            return strerror(errno);
+        case PNG_ETRUNCATED:
+            return "Unexpected end of file";
+        case PNG_EFORMAT:
+            return "Not a valid PNG file";
+        case PNG_ECORRUPT:
+            return "Corrupt PNG data";
+        default:
+            return "Unknown error";
+    }
+}
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// Undoes the filter of a scanline in place. prev is the unfiltered line
+// above, all zero for the first one.
+static int unfilter(int type, uint8_t *row, const uint8_t *prev, size_t size, int bpp) {
+    size_t i;
+    switch (type) {
+        case 0:
+            return 0;
+        case 1:
+            for (i = bpp; i < size; i++) row[i] += row[i - bpp];
+            return 0;
+        case 2:
+            for (i = 0; i < size; i++) row[i] += prev[i];
+            return 0;
+        case 3:
+            for (i = 0; i < (size_t)bpp && i < size; i++) row[i] += prev[i] >> 1;
+            for (; i < size; i++) row[i] += (row[i - bpp] + prev[i]) >> 1;
+            return 0;
+        case 4:
+            for (i = 0; i < (size_t)bpp && i < size; i++) row[i] += prev[i];
+            for (; i < size; i++) row[i] += paeth(row[i - bpp], prev[i], prev[i - bpp]);
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+// Sample x of a row of 1, 2 or 4-bit samples
+static int packed_sample(const uint8_t *row, uint32_t x, int depth) {
+    size_t bit = (size_t)x * depth;
+    return (row[bit / 8] >> (8 - depth - bit % 8)) & ((1 << depth) - 1);
+}
+
+static const char *convert_row(struct png_rows *png, const uint8_t *src) {
+    uint8_t *dst = png->rgb;
+    uint32_t width = png->width;
+    int depth = png->bit_depth;
+    // 16-bit samples are big-endian, the high byte is enough for RGB888
+    int step = depth == 16 ? 2 : 1;
+    switch (png->color_type) {
+        case 2:
+            if (depth == 8) return (const char *)src;
+            for (uint32_t x = 0; x < width; x++, dst += 3, src += 6) {
+                dst[0] = src[0];
+                dst[1] = src[2];
+                dst[2] = src[4];
+            }
+            break;
+        case 6:
+            if (depth == 8) {
+                pixconv_rgba_to_rgb(dst, src, width);
+                break;
+            }
+            for (uint32_t x = 0; x < width; x++, dst += 3, src += 8) {
+                dst[0] = src[0];
+                dst[1] = src[2];
+                dst[2] = src[4];
+            }
+            break;
+        case 0:
+        case 4: {
+            int channels = png->color_type == 4 ? 2 : 1;
+            for (uint32_t x = 0; x < width; x++, dst += 3) {
+                uint8_t gray;
+                if (depth >= 8)
+                    gray = src[(size_t)x * channels * step];
+                else
+                    gray = packed_sample(src, x, depth) * 255 / ((1 << depth) - 1);
+                dst[0] = dst[1] = dst[2] = gray;
+            }
+            break;
+        }
+        case 3:
+            for (uint32_t x = 0; x < width; x++, dst += 3) {
+                int index = depth == 8 ? src[x] : packed_sample(src, x, depth);
+                if (index < png->palette_size) {
+                    memcpy(dst, png->palette + index * 3, 3);
+                } else {
+                    dst[0] = dst[1] = dst[2] = 0;
+                }
+            }
+            break;
+    }
+    return (const char *)png->rgb;
+}
+
+// RGBA8888 row with straight alpha. Samples that match the tRNS key are
+// compared at full depth, before 16-bit samples are cut down to 8 bits.
+static const char *convert_row_rgba(struct png_rows *png, const uint8_t *src) {
+    uint8_t *dst = png->rgb;
+    uint32_t width = png->width;
+    int depth = png->bit_depth;
+    int step = depth == 16 ? 2 : 1;
+    switch (png->color_type) {
+        case 6:
+            if (depth == 8) return (const char *)src;
+            for (uint32_t x = 0; x < width; x++, dst += 4, src += 8) {
+                dst[0] = src[0];
+                dst[1] = src[2];
+                dst[2] = src[4];
+                dst[3] = src[6];
+            }
+            break;
+        case 2:
+            for (uint32_t x = 0; x < width; x++, dst += 4, src += 3 * step) {
+                int r = step == 2 ? read_be16(src) : src[0];
+                int g = step == 2 ? read_be16(src + 2) : src[1];
+                int b = step == 2 ? read_be16(src + 4) : src[2];
+                dst[0] = src[0];
+                dst[1] = src[step];
+                dst[2] = src[2 * step];
+                dst[3] = (r == png->key[0] && g == png->key[1] && b == png->key[2]) ? 0 : 0xFF;
+            }
+            break;
+        case 0:
+            for (uint32_t x = 0; x < width; x++, dst += 4) {
+                int sample;
+                if (depth == 16)
+                    sample = read_be16(src + (size_t)x * 2);
+                else if (depth == 8)
+                    sample = src[x];
+                else
+                    sample = packed_sample(src, x, depth);
+                uint8_t gray = depth == 16 ? sample >> 8 : depth == 8 ? sample : sample * 255 / ((1 << depth) - 1);
+                dst[0] = dst[1] = dst[2] = gray;
+                dst[3] = sample == png->key[0] ? 0 : 0xFF;
+            }
+            break;
+        case 4:
+            for (uint32_t x = 0; x < width; x++, dst += 4, src += 2 * step) {
+                dst[0] = dst[1] = dst[2] = src[0];
+                dst[3] = src[step];
+            }
+            break;
+        case 3:
+            for (uint32_t x = 0; x < width; x++, dst += 4) {
+                int index = depth == 8 ? src[x] : packed_sample(src, x, depth);
+                if (index < png->palette_size) {
+                    memcpy(dst, png->palette + index * 3, 3);
+                    dst[3] = png->palette_alpha[index];
+                } else {
+                    dst[0] = dst[1] = dst[2] = 0;
+                    dst[3] = 0xFF;
+                }
+            }
+            break;
+    }
+    return (const char *)png->rgb;
+}
+
+// Inflates and unfilters the next scanline, NULL on corrupt data
+static const uint8_t *next_scanline(struct png_rows *png) {
+    uint8_t *row = png->rows[png->y & 1];
+    const uint8_t *prev = png->rows[(png->y + 1) & 1];
+    long size = inflate_read(png->z, row, png->row_bytes + 1);
+    // The checksum at the end of the stream is verified with the last row
+    bool last = png->y + 1 == png->height;
+    if (size != (long)png->row_bytes + 1 || unfilter(row[0], row + 1, prev + 1, png->row_bytes, png->filter_bpp) != 0 || (last && inflate_end(png->z) != 0)) {
+        png->error = PNG_ECORRUPT;
+        return NULL;
+    }
+    // Give back the pages of input decoded so far, a megabyte at a time, so a
+    // large file doesn't stay resident
+    size_t done = (size_t)(png->z->in - png->data) & ~(size_t)PNG_RELEASE_MASK;
+    if (done > png->released) {
+        madvise((char *)png->map + png->released, done - png->released, MADV_DONTNEED);
+        png->released = done;
+    }
+    png->y++;
+    return row + 1;
+}
+
+const char *png_rows_next(struct png_rows *png) {
+    if (png->y >= png->height) return NULL;
+    if (png->decoded) {
+        pixconv_rgba_to_rgb(png->rgb, png->decoded + (size_t)png->y++ * png->width * 4, png->width);
+        return (const char *)png->rgb;
+    }
+    const uint8_t *row = next_scanline(png);
+    return row ? convert_row(png, row) : NULL;
+}
+
+const char *png_rows_next_rgba(struct png_rows *png) {
+    if (png->y >= png->height) return NULL;
+    if (png->decoded) return (const char *)png->decoded + (size_t)png->y++ * png->width * 4;
+    const uint8_t *row = next_scanline(png);
+    return row ? convert_row_rgba(png, row) : NULL;
+}
+
+void png_rows_find_alpha(struct png_rows *png, const char *path, struct png_rows *scan) {
+    if (!png->alpha) return;
+    if (png->decoded) {
+        size_t count = (size_t)png->width * png->height;
+        bool transparent = false;
+        for (size_t i = 0; i < count && !transparent; i++) transparent = png->decoded[i * 4 + 3] != 0xFF;
+        png->alpha = transparent;
+        return;
+    }
+    // A second decoder, so png stays at its first row
+    if (png_rows_reopen(path, scan) != PNG_OK) return;
+    bool transparent = false;
+    const uint8_t *row;
+    while (!transparent && (row = (const uint8_t *)png_rows_next_rgba(scan)) != NULL) {
+        for (uint32_t x = 0; x < scan->width && !transparent; x++) transparent = row[x * 4 + 3] != 0xFF;
+    }
+    // A file that fails to decode keeps its flag and fails in the caller
+    if (transparent || scan->error == PNG_OK) png->alpha = transparent;
+    png_rows_end(scan);
+}
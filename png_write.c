@@ -0,0 +1,235 @@
+#include "include/png_write.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "include/deflate.h"
+#include "thirdparty/lodepng/lodepng.h"
+
+// A band of rows, compressed into a complete IDAT chunk
+struct band {
+    const uint8_t *pixels;
+    int bpp; // Bytes per pixel, 3 for RGB or 4 for RGBA
+    size_t row_size;
+    uint32_t y0, y1;
+    int level;
+    bool first, last; // Carries the zlib header / ends the deflate stream
+    uint8_t *chunk;
+    size_t chunk_size;
+    uint32_t adler;
+    size_t data_size; // Filtered bytes, for combining the checksums
+};
+
+static void put_be32(uint8_t *p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// Filters a row of bpp-byte pixels with the given type into dst. prev is the
+// row above, all zero for the first one.
+static void filter_row(uint8_t *dst, const uint8_t *row, const uint8_t *prev, size_t size, int bpp, int type) {
+    for (size_t i = 0; i < size; i++) {
+        int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+        int c = i >= (size_t)bpp ? prev[i - bpp] : 0;
+        int predicted = 0;
+        switch (type) {
+            case 1:
+                predicted = a;
+                break;
+            case 2:
+                predicted = prev[i];
+                break;
+            case 3:
+                predicted = (a + prev[i]) >> 1;
+                break;
+            case 4:
+                predicted = paeth(a, prev[i], c);
+                break;
+        }
+        dst[i] = row[i] - predicted;
+    }
+}
+
+// Sum of the filtered bytes as signed values, the usual guess at which
+// filter compresses best
+static unsigned long filter_cost(const uint8_t *data, size_t size) {
+    unsigned long sum = 0;
+    for (size_t i = 0; i < size; i++) sum += data[i] < 128 ? data[i] : 256 - data[i];
+    return sum;
+}
+
+static void *encode_band(void *arg) {
+    struct band *b = arg;
+    size_t line = b->row_size + 1;
+    b->data_size = line * (b->y1 - b->y0);
+    uint8_t *filtered = malloc(b->data_size + 1);
+    uint8_t *trial = malloc(line);
+    uint8_t *zero = calloc(b->row_size + 1, 1);
+    b->chunk = malloc(8 + 2 + deflate_bound(b->data_size) + 4);
+    if (!filtered || !trial || !zero || !b->chunk) {
+        free(b->chunk);
+        b->chunk = NULL;
+        goto done;
+    }
+
+    uint8_t *dst = filtered;
+    for (uint32_t y = b->y0; y < b->y1; y++, dst += line) {
+        const uint8_t *row = b->pixels + y * b->row_size;
+        const uint8_t *prev = y > 0 ? row - b->row_size : zero;
+        if (b->level == 0) {
+            // Stored blocks gain nothing from filtering
+            dst[0] = 0;
+            memcpy(dst + 1, row, b->row_size);
+        } else if (b->level <= 3) {
+            // Sub alone is cheap and does well on flat screen contents
+            dst[0] = 1;
+            filter_row(dst + 1, row, prev, b->row_size, b->bpp, 1);
+        } else {
+            unsigned long best = -1;
+            for (int type = 0; type < 5; type++) {
+                trial[0] = type;
+                filter_row(trial + 1, row, prev, b->row_size, b->bpp, type);
+                unsigned long cost = filter_cost(trial + 1, b->row_size);
+                if (cost < best) {
+                    best = cost;
+                    memcpy(dst, trial, line);
+                }
+            }
+        }
+    }
+    b->adler = adler32(1, filtered, b->data_size);
+
+    uint8_t *data = b->chunk + 8;
+    size_t size = 0;
+    if (b->first) {
+        data[size++] = 0x78;
+        data[size++] = b->level <= 1 ? 0x01 : b->level <= 5 ? 0x5E : b->level == 6 ? 0x9C : 0xDA;
+    }
+    size_t compressed = deflate_compress(data + size, filtered, b->data_size, b->level, b->last);
+    if (compressed == 0) {
+        free(b->chunk);
+        b->chunk = NULL;
+        goto done;
+    }
+    size += compressed;
+    put_be32(b->chunk, size);
+    memcpy(b->chunk + 4, "IDAT", 4);
+    put_be32(data + size, lodepng_crc32(b->chunk + 4, size + 4));
+    b->chunk_size = size + 12;
+
+done:
+    free(zero);
+    free(trial);
+    free(filtered);
+    return NULL;
+}
+
+static int write_chunk(FILE *file, const char *type, const uint8_t *data, size_t size) {
+    uint8_t header[8];
+    put_be32(header, size);
+    memcpy(header + 4, type, 4);
+    uint8_t crc[4];
+    // The CRC covers the type and data, which aren't contiguous here
+    uint8_t *buffer = malloc(size + 4);
+    if (!buffer) return -1;
+    memcpy(buffer, type, 4);
+    if (size > 0) memcpy(buffer + 4, data, size);
+    put_be32(crc, lodepng_crc32(buffer, size + 4));
+    free(buffer);
+    if (fwrite(header, 1, 8, file) != 8 || (size > 0 && fwrite(data, 1, size, file) != size) || fwrite(crc, 1, 4, file) != 4) return -1;
+    return 0;
+}
+
+// Writes 8-bit RGB (bpp 3) or RGBA (bpp 4) pixels
+static int write_png(const char *path, const char *pixels, int bpp, uint32_t width, uint32_t height, int level, int threads) {
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if ((uint32_t)threads > height / PNG_WRITE_MIN_BAND_ROWS) threads = height / PNG_WRITE_MIN_BAND_ROWS;
+    if (threads < 1) threads = 1;
+    if (level > DEFLATE_LEVEL_MAX) level = DEFLATE_LEVEL_MAX;
+
+    struct band *bands = calloc(threads, sizeof(*bands));
+    pthread_t *workers = calloc(threads, sizeof(*workers));
+    bool *started = calloc(threads, sizeof(*started));
+    if (!bands || !workers || !started) {
+        free(started);
+        free(workers);
+        free(bands);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (int i = 0; i < threads; i++) {
+        bands[i] = (struct band){(const uint8_t *)pixels, bpp, (size_t)width * bpp, (uint64_t)height * i / threads, (uint64_t)height * (i + 1) / threads, level, i == 0, i == threads - 1};
+    }
+    // The first band runs on this thread, and so does any band whose
+    // thread can't be started
+    for (int i = 1; i < threads; i++) started[i] = pthread_create(&workers[i], NULL, encode_band, &bands[i]) == 0;
+    encode_band(&bands[0]);
+    for (int i = 1; i < threads; i++) {
+        if (started[i]) {
+            pthread_join(workers[i], NULL);
+        } else {
+            encode_band(&bands[i]);
+        }
+    }
+
+    int status = 0;
+    uint32_t adler = 1;
+    for (int i = 0; i < threads; i++) {
+        if (!bands[i].chunk) {
+            errno = ENOMEM;
+            status = -1;
+        }
+        adler = adler32_combine(adler, bands[i].adler, bands[i].data_size);
+    }
+    FILE *file = status == 0 ? fopen(path, "wb") : NULL;
+    if (file) {
+        static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        uint8_t header[13] = {0};
+        put_be32(header, width);
+        put_be32(header + 4, height);
+        header[8] = 8; // Bit depth
+        header[9] = bpp == 4 ? 6 : 2; // RGBA or RGB
+        uint8_t trailer[4];
+        put_be32(trailer, adler);
+        status = fwrite(signature, 1, sizeof(signature), file) == sizeof(signature) ? 0 : -1;
+        if (status == 0) status = write_chunk(file, "IHDR", header, sizeof(header));
+        for (int i = 0; i < threads && status == 0; i++) {
+            if (fwrite(bands[i].chunk, 1, bands[i].chunk_size, file) != bands[i].chunk_size) status = -1;
+        }
+        // The Adler-32 of the whole stream goes in a chunk of its own, as
+        // it is only known once every band is done
+        if (status == 0) status = write_chunk(file, "IDAT", trailer, sizeof(trailer));
+        if (status == 0) status = write_chunk(file, "IEND", NULL, 0);
+        if (fclose(file) != 0) status = -1;
+    } else {
+        status = -1;
+    }
+
+    for (int i = 0; i < threads; i++) free(bands[i].chunk);
+    free(started);
+    free(workers);
+    free(bands);
+    return status;
+}
+
+int png_write_rgb(const char *path, const char *rgb, uint32_t width, uint32_t height, int level, int threads) {
+    return write_png(path, rgb, 3, width, height, level, threads);
+}
+
+int png_write_rgba(const char *path, const char *rgba, uint32_t width, uint32_t height, int level, int threads) {
+    return write_png(path, rgba, 4, width, height, level, threads);
+}
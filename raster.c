@@ -0,0 +1,98 @@
+#include "include/raster.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Largest integer whose square is at most n
+static int64_t isqrt(int64_t n) {
+    if (n <= 0) return 0;
+    int64_t x = n, y = (x + 1) / 2;
+    while (y < x) {
+        x = y;
+        y = (x + n / x) / 2;
+    }
+    return x;
+}
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+static int64_t ceil_div(int64_t a, int64_t b) {
+    return -floor_div(-a, b);
+}
+
+// Narrows [*lo, *hi] to the x where min <= k * x + c <= max
+static void clip_linear(int64_t k, int64_t c, int64_t min, int64_t max, int64_t *lo, int64_t *hi) {
+    if (k < 0) {
+        int64_t t = -min;
+        min = -max;
+        max = t;
+        k = -k;
+        c = -c;
+    }
+    if (k == 0) {
+        if (c < min || c > max) *hi = *lo - 1;
+        return;
+    }
+    int64_t a = ceil_div(min - c, k), b = floor_div(max - c, k);
+    if (a > *lo) *lo = a;
+    if (b < *hi) *hi = b;
+}
+
+int raster_disc_init(struct raster_disc *disc, int radius) {
+    if (radius < 0) radius = 0;
+    disc->radius = radius;
+    disc->extent = malloc((radius + 1) * sizeof(int));
+    if (!disc->extent) return -1;
+    int64_t r2 = (int64_t)radius * radius;
+    for (int dy = 0; dy <= radius; dy++) disc->extent[dy] = isqrt(r2 - (int64_t)dy * dy);
+    return 0;
+}
+
+void raster_disc_free(struct raster_disc *disc) {
+    free(disc->extent);
+    disc->extent = NULL;
+}
+
+void raster_capsule(int x0, int y0, int x1, int y1, const struct raster_disc *disc, const struct raster_clip *clip, raster_span_fn span, void *ctx) {
+    int radius = disc->radius;
+    int top = (y0 < y1 ? y0 : y1) - radius, bottom = (y0 > y1 ? y0 : y1) + radius;
+    if (top < clip->top) top = clip->top;
+    if (bottom > clip->bottom - 1) bottom = clip->bottom - 1;
+
+    // The part between the end caps is the band of points whose projection
+    // falls on the segment and whose distance to it is at most radius. With
+    // d = (dx, dy) that is 0 <= (p - p0) . d <= |d|^2 and
+    // |(p - p0) x d| <= radius * |d|, and since the cross product is an
+    // integer the right side can be rounded down once per stroke.
+    int64_t dx = x1 - x0, dy = y1 - y0;
+    int64_t length2 = dx * dx + dy * dy;
+    int64_t reach = isqrt((int64_t)radius * radius * length2);
+
+    for (int y = top; y <= bottom; y++) {
+        int64_t lo = INT64_MAX, hi = INT64_MIN;
+        // Both end caps
+        for (int end = 0; end < 2; end++) {
+            int cx = end ? x1 : x0, dy = abs(y - (end ? y1 : y0));
+            if (dy > radius) continue;
+            int64_t h = disc->extent[dy];
+            if (cx - h < lo) lo = cx - h;
+            if (cx + h > hi) hi = cx + h;
+        }
+        if (length2 > 0) {
+            int64_t ry = y - y0, band_lo = INT64_MIN / 4, band_hi = INT64_MAX / 4;
+            clip_linear(dx, ry * dy - x0 * dx, 0, length2, &band_lo, &band_hi);
+            clip_linear(dy, -ry * dx - x0 * dy, -reach, reach, &band_lo, &band_hi);
+            if (band_lo <= band_hi) {
+                if (band_lo < lo) lo = band_lo;
+                if (band_hi > hi) hi = band_hi;
+            }
+        }
+        // The capsule is convex, so the pieces of a row always join up
+        if (lo < clip->left) lo = clip->left;
+        if (hi > clip->right - 1) hi = clip->right - 1;
+        if (lo <= hi) span(ctx, y, (int)lo, (int)hi + 1);
+    }
+}
@@ -0,0 +1,87 @@
+#include "include/rle.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+static inline bool same_pixel(const uint8_t *a, const uint8_t *b, int bpp) {
+    switch (bpp) {
+        case 4: {
+            uint32_t x, y;
+            memcpy(&x, a, 4);
+            memcpy(&y, b, 4);
+            return x == y;
+        }
+        case 3:
+            return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+        case 2:
+            return a[0] == b[0] && a[1] == b[1];
+        default:
+            return memcmp(a, b, bpp) == 0;
+    }
+}
+
+size_t rle_bound(size_t count, int bpp) {
+    return count * bpp + (count + 127) / 128;
+}
+
+size_t rle_encode(uint8_t *dst, const uint8_t *src, size_t count, int bpp) {
+    uint8_t *out = dst;
+    size_t i = 0;
+    while (i < count) {
+        const uint8_t *pixel = src + i * bpp;
+        size_t run = 1;
+        while (i + run < count && run < 129 && same_pixel(pixel, src + (i + run) * bpp, bpp)) run++;
+        if (run >= 2) {
+            *out++ = (uint8_t)(126 + run);
+            memcpy(out, pixel, bpp);
+            out += bpp;
+            i += run;
+            continue;
+        }
+
+        // Literal pixels up to the start of the next run
+        size_t start = i;
+        size_t literal = 0;
+        while (i < count && literal < 128) {
+            if (i + 1 < count && same_pixel(src + i * bpp, src + (i + 1) * bpp, bpp)) break;
+            i++;
+            literal++;
+        }
+        *out++ = (uint8_t)(literal - 1);
+        memcpy(out, src + start * bpp, literal * bpp);
+        out += literal * bpp;
+    }
+    return out - dst;
+}
+
+long rle_decode(uint8_t *dst, size_t count, const uint8_t *src, size_t size, int bpp) {
+    size_t pos = 0;
+    size_t done = 0;
+    while (done < count) {
+        if (pos >= size) return -1;
+        uint8_t control = src[pos++];
+        if (control < 128) {
+            size_t length = (size_t)control + 1;
+            if (done + length > count || length * bpp > size - pos) return -1;
+            memcpy(dst + done * bpp, src + pos, length * bpp);
+            pos += length * bpp;
+            done += length;
+        } else {
+            size_t length = (size_t)control - 126;
+            if (done + length > count || (size_t)bpp > size - pos) return -1;
+            uint8_t *out = dst + done * bpp;
+            memcpy(out, src + pos, bpp);
+            // Double the filled part until the run is complete
+            size_t filled = 1;
+            while (filled < length) {
+                size_t copy = filled < length - filled ? filled : length - filled;
+                memcpy(out + filled * bpp, out, copy * bpp);
+                filled += copy;
+            }
+            pos += bpp;
+            done += length;
+        }
+    }
+    return (long)pos;
+}
@@ -1,7 +1,10 @@
 #include "include/scale_img.h"
 
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 int floorpx(float x) {
     int i = (int)x;
@@ -19,42 +22,341 @@ unsigned char lerp(unsigned char a, unsigned char b, float t) {
     return (unsigned char)(result);
 }
 
-char *scale_image(char *image, bool bgr, int width, int height, int new_width, int new_height) {
-    char *scaled_image = (char *)malloc(new_width * new_height * 3);
-    char *converted_image = (char *)malloc(width * height * 3);
-    if (bgr) {
-        // Convert BGR to RGB
-        for (int i = 0; i < width * height * 3; i += 3) {
-            converted_image[i] = image[i + 2]; // R
-            converted_image[i + 1] = image[i + 1]; // G
-            converted_image[i + 2] = image[i]; // B
+// Maps output coordinate i to 16.16 fixed point source position i * size / new_size
+static uint32_t source_pos(int i, int size, int new_size) {
+    return (uint32_t)(((uint64_t)i * size << 16) / new_size);
+}
+
+int scaler_init(struct scaler *s, bool bgr, int width, int height, int new_width, int new_height) {
+    s->width = width;
+    s->height = height;
+    s->new_width = new_width;
+    s->new_height = new_height;
+    s->bgr = bgr;
+    s->x0 = malloc(new_width * sizeof(int));
+    s->x1 = malloc(new_width * sizeof(int));
+    s->wx = malloc(new_width);
+    if (!s->x0 || !s->x1 || !s->wx) {
+        scaler_free(s);
+        return -1;
+    }
+    for (int w = 0; w < new_width; w++) {
+        uint32_t pos = source_pos(w, width, new_width);
+        int x0 = pos >> 16;
+        int x1 = (x0 + 1 < width) ? x0 + 1 : x0;
+        s->x0[w] = x0 * 3;
+        s->x1[w] = x1 * 3;
+        s->wx[w] = (pos >> 8) & 0xFF;
+    }
+    return 0;
+}
+
+void scaler_free(struct scaler *s) {
+    free(s->x0);
+    free(s->x1);
+    free(s->wx);
+    s->x0 = NULL;
+    s->x1 = NULL;
+    s->wx = NULL;
+}
+
+void scaler_source_rows(const struct scaler *s, int y, int *y0, int *y1, int *wy) {
+    uint32_t pos = source_pos(y, s->height, s->new_height);
+    *y0 = pos >> 16;
+    *y1 = (*y0 + 1 < s->height) ? *y0 + 1 : *y0;
+    *wy = (pos >> 8) & 0xFF;
+}
+
+// Horizontal pass: one source row to new_width RGB pixels scaled by 256
+static void filter_row(const struct scaler *s, const uint8_t *src, uint16_t *dst) {
+    int r = s->bgr ? 2 : 0;
+    int b = 2 - r;
+    for (int w = 0; w < s->new_width; w++, dst += 3) {
+        const uint8_t *p0 = src + s->x0[w];
+        const uint8_t *p1 = src + s->x1[w];
+        int f1 = s->wx[w];
+        int f0 = 256 - f1;
+        dst[0] = p0[r] * f0 + p1[r] * f1;
+        dst[1] = p0[1] * f0 + p1[1] * f1;
+        dst[2] = p0[b] * f0 + p1[b] * f1;
+    }
+}
+
+// Vertical pass: blends two filtered rows into RGB888
+static void blend_rows(const struct scaler *s, const uint16_t *top, const uint16_t *bottom, int wy, uint8_t *dst) {
+    size_t row_size = (size_t)s->new_width * 3;
+    if (wy == 0) {
+        for (size_t i = 0; i < row_size; i++) dst[i] = (top[i] + 128) >> 8;
+        return;
+    }
+    uint32_t f1 = wy;
+    uint32_t f0 = 256 - f1;
+    for (size_t i = 0; i < row_size; i++) dst[i] = (top[i] * f0 + bottom[i] * f1 + 32768) >> 16;
+}
+
+struct row_ring {
+    uint16_t *rows[2];
+    int y[2];
+};
+
+// Returns the filtered source row y, evicting the slot that doesn't hold keep
+static const uint16_t *ring_row(const struct scaler *s, struct row_ring *ring, const uint8_t *image, size_t stride, int y, int keep) {
+    if (ring->y[0] == y) return ring->rows[0];
+    if (ring->y[1] == y) return ring->rows[1];
+    int slot = (ring->y[0] == keep) ? 1 : 0;
+    filter_row(s, image + (size_t)y * stride, ring->rows[slot]);
+    ring->y[slot] = y;
+    return ring->rows[slot];
+}
+
+int scale_rows(const struct scaler *s, const char *image, size_t stride, char *out, size_t out_stride, int row_begin, int row_end) {
+    size_t row_size = (size_t)s->new_width * 3;
+    struct row_ring ring = {{malloc(row_size * sizeof(uint16_t)), malloc(row_size * sizeof(uint16_t))}, {-1, -1}};
+    if (!ring.rows[0] || !ring.rows[1]) {
+        free(ring.rows[0]);
+        free(ring.rows[1]);
+        return -1;
+    }
+
+    for (int h = row_begin; h < row_end; h++) {
+        int y0, y1, wy;
+        scaler_source_rows(s, h, &y0, &y1, &wy);
+        uint8_t *dst = (uint8_t *)out + (size_t)h * out_stride;
+        const uint16_t *top = ring_row(s, &ring, (const uint8_t *)image, stride, y0, y1);
+        const uint16_t *bottom = wy ? ring_row(s, &ring, (const uint8_t *)image, stride, y1, y0) : top;
+        blend_rows(s, top, bottom, wy, dst);
+    }
+
+    free(ring.rows[0]);
+    free(ring.rows[1]);
+    return 0;
+}
+
+int scaler_stream_init(struct scaler_stream *st, const struct scaler *s) {
+    size_t row_size = (size_t)s->new_width * 3;
+    st->s = s;
+    st->rows[0] = malloc(row_size * sizeof(uint16_t));
+    st->rows[1] = malloc(row_size * sizeof(uint16_t));
+    st->y[0] = st->y[1] = -1;
+    st->out = malloc(row_size);
+    st->next = 0;
+    if (!st->rows[0] || !st->rows[1] || !st->out) {
+        scaler_stream_free(st);
+        return -1;
+    }
+    return 0;
+}
+
+void scaler_stream_free(struct scaler_stream *st) {
+    free(st->rows[0]);
+    free(st->rows[1]);
+    free(st->out);
+    st->rows[0] = st->rows[1] = NULL;
+    st->out = NULL;
+}
+
+// Filters source row y into the slot holding the older row
+static void stream_filter(struct scaler_stream *st, int y, const char *row) {
+    int slot = st->y[0] < st->y[1] ? 0 : 1;
+    filter_row(st->s, (const uint8_t *)row, st->rows[slot]);
+    st->y[slot] = y;
+}
+
+static const uint16_t *stream_row(const struct scaler_stream *st, int y) {
+    return st->y[0] == y ? st->rows[0] : st->rows[1];
+}
+
+void scaler_stream_push(struct scaler_stream *st, int y, const char *row, scaler_emit_fn emit, void *ctx) {
+    const struct scaler *s = st->s;
+    bool filtered = false;
+    while (st->next < s->new_height) {
+        int y0, y1, wy;
+        scaler_source_rows(s, st->next, &y0, &y1, &wy);
+        bool needed = y0 == y || (wy && y1 == y);
+        if (needed && !filtered) {
+            stream_filter(st, y, row);
+            filtered = true;
         }
+        // Wait for the lower source row
+        if ((wy ? y1 : y0) > y) return;
+        const uint16_t *top = stream_row(st, y0);
+        blend_rows(s, top, wy ? stream_row(st, y1) : top, wy, st->out);
+        emit(ctx, st->next++, (const char *)st->out);
+    }
+}
+
+void scale_fit(int width, int height, int max_width, int max_height, int *new_width, int *new_height) {
+    if ((uint64_t)max_height * width < (uint64_t)max_width * height) {
+        *new_width = (uint64_t)width * max_height / height;
+        *new_height = max_height;
     } else {
-        // Copy RGB directly
-        for (int i = 0; i < width * height * 3; i++) {
-            converted_image[i] = image[i];
-        }
+        *new_width = max_width;
+        *new_height = (uint64_t)height * max_width / width;
     }
+    if (*new_width < 1) *new_width = 1;
+    if (*new_height < 1) *new_height = 1;
+}
 
-    for (int w = 0; w < new_width; w++) {
-        for (int h = 0; h < new_height; h++) {
-            float orig_x = w * ((float)width / new_width);
-            float orig_y = h * ((float)height / new_height);
-            int x0 = floorpx(orig_x);
-            int y0 = floorpx(orig_y);
-            int x1 = (x0 + 1 < width) ? x0 + 1 : x0;
-            int y1 = (y0 + 1 < height) ? y0 + 1 : y0;
-            char p1r = lerp(converted_image[calc_index(width, height, x0, y0)], converted_image[calc_index(width, height, x1, y0)], orig_x - x0);
-            char p1g = lerp(converted_image[calc_index(width, height, x0, y0) + 1], converted_image[calc_index(width, height, x1, y0) + 1], orig_x - x0);
-            char p1b = lerp(converted_image[calc_index(width, height, x0, y0) + 2], converted_image[calc_index(width, height, x1, y0) + 2], orig_x - x0);
-            char p2r = lerp(converted_image[calc_index(width, height, x0, y1)], converted_image[calc_index(width, height, x1, y1)], orig_x - x0);
-            char p2g = lerp(converted_image[calc_index(width, height, x0, y1) + 1], converted_image[calc_index(width, height, x1, y1) + 1], orig_x - x0);
-            char p2b = lerp(converted_image[calc_index(width, height, x0, y1) + 2], converted_image[calc_index(width, height, x1, y1) + 2], orig_x - x0);
-            scaled_image[calc_index(new_width, new_height, w, h)] = lerp(p1r, p2r, orig_y - y0);
-            scaled_image[calc_index(new_width, new_height, w, h) + 1] = lerp(p1g, p2g, orig_y - y0);
-            scaled_image[calc_index(new_width, new_height, w, h) + 2] = lerp(p1b, p2b, orig_y - y0);
-        }
+char *scale_image(char *image, bool bgr, int width, int height, int new_width, int new_height) {
+    struct scaler s;
+    if (scaler_init(&s, bgr, width, height, new_width, new_height) != 0) return NULL;
+    char *scaled_image = (char *)malloc((size_t)new_width * new_height * 3);
+    if (scaled_image && scale_rows(&s, image, (size_t)width * 3, scaled_image, (size_t)new_width * 3, 0, new_height) != 0) {
+        free(scaled_image);
+        scaled_image = NULL;
+    }
+    scaler_free(&s);
+    return scaled_image;
+}
+
+// Persistent worker pool for scale_image_mt(). Workers sleep on the work
+// condition until a new job generation is published, then claim bands of
+// output rows until none are left.
+struct band_job {
+    const struct scaler *s;
+    const char *image;
+    char *out;
+    int band_rows;
+    int bands;
+    int workers; // Pool threads allowed to take part, the caller always does
+    int next_band;
+    int pending; // Bands not finished yet
+    int active; // Pool threads still inside run_bands()
+    bool failed;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    pthread_mutex_t run_lock; // One job at a time
+    int count;
+    unsigned generation;
+    struct band_job *job;
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER};
+
+static void run_bands(struct band_job *job) {
+    const struct scaler *s = job->s;
+    while (true) {
+        int band = __atomic_fetch_add(&job->next_band, 1, __ATOMIC_RELAXED);
+        if (band >= job->bands) return;
+        int begin = band * job->band_rows;
+        int end = begin + job->band_rows < s->new_height ? begin + job->band_rows : s->new_height;
+        int result = scale_rows(s, job->image, (size_t)s->width * 3, job->out, (size_t)s->new_width * 3, begin, end);
+        pthread_mutex_lock(&pool.lock);
+        if (result != 0) job->failed = true;
+        if (--job->pending == 0) pthread_cond_signal(&pool.done);
+        pthread_mutex_unlock(&pool.lock);
     }
+}
+
+static void *pool_worker(void *arg) {
+    int index = (int)(intptr_t)arg;
+    unsigned seen = 0;
+    pthread_mutex_lock(&pool.lock);
+    while (true) {
+        while (pool.generation == seen) pthread_cond_wait(&pool.work, &pool.lock);
+        seen = pool.generation;
+        struct band_job *job = pool.job;
+        if (!job || index >= job->workers) continue;
+        job->active++;
+        pthread_mutex_unlock(&pool.lock);
+        run_bands(job);
+        pthread_mutex_lock(&pool.lock);
+        if (--job->active == 0) pthread_cond_signal(&pool.done);
+    }
+    return NULL;
+}
 
+// Grows the pool to at least count threads. Returns the number available.
+static int pool_reserve(int count) {
+    pthread_mutex_lock(&pool.lock);
+    while (pool.count < count) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_worker, (void *)(intptr_t)pool.count) != 0) break;
+        pthread_detach(thread);
+        pool.count++;
+    }
+    int available = pool.count;
+    pthread_mutex_unlock(&pool.lock);
+    return available;
+}
+
+char *scale_image_mt(char *image, bool bgr, int width, int height, int new_width, int new_height, int threads) {
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > new_height / SCALE_MIN_BAND_ROWS) threads = new_height / SCALE_MIN_BAND_ROWS;
+    if (threads <= 1) return scale_image(image, bgr, width, height, new_width, new_height);
+
+    struct scaler s;
+    if (scaler_init(&s, bgr, width, height, new_width, new_height) != 0) return NULL;
+    char *scaled_image = (char *)malloc((size_t)new_width * new_height * 3);
+    if (!scaled_image) {
+        scaler_free(&s);
+        return NULL;
+    }
+
+    // A few bands per thread so uneven progress still balances out
+    int bands = threads * 4;
+    int band_rows = (new_height + bands - 1) / bands;
+    if (band_rows < SCALE_MIN_BAND_ROWS) band_rows = SCALE_MIN_BAND_ROWS;
+    bands = (new_height + band_rows - 1) / band_rows;
+    struct band_job job = {&s, image, scaled_image, band_rows, bands, 0, 0, bands, 0, false};
+
+    pthread_mutex_lock(&pool.run_lock);
+    job.workers = pool_reserve(threads - 1);
+    if (job.workers > threads - 1) job.workers = threads - 1;
+    pthread_mutex_lock(&pool.lock);
+    pool.job = &job;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+
+    run_bands(&job);
+
+    pthread_mutex_lock(&pool.lock);
+    while (job.pending > 0 || job.active > 0) pthread_cond_wait(&pool.done, &pool.lock);
+    pool.job = NULL;
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool.run_lock);
+
+    scaler_free(&s);
+    if (job.failed) {
+        free(scaled_image);
+        return NULL;
+    }
     return scaled_image;
 }
+
+uint32_t *scale_image_argb_mt(const uint32_t *image, size_t stride, int width, int height, int new_width, int new_height, int threads) {
+    size_t count = (size_t)width * height;
+    uint8_t *colors = malloc(count * 3);
+    uint8_t *alpha = malloc(count * 3);
+    char *scaled_colors = NULL, *scaled_alpha = NULL;
+    uint32_t *scaled = NULL;
+    if (colors && alpha) {
+        uint8_t *c = colors, *a = alpha;
+        for (int y = 0; y < height; y++) {
+            const uint32_t *row = (const uint32_t *)((const char *)image + (size_t)y * stride);
+            for (int x = 0; x < width; x++, c += 3, a += 3) {
+                c[0] = row[x] >> 16;
+                c[1] = row[x] >> 8;
+                c[2] = row[x];
+                a[0] = a[1] = a[2] = row[x] >> 24;
+            }
+        }
+        scaled_colors = scale_image_mt((char *)colors, false, width, height, new_width, new_height, threads);
+        scaled_alpha = scale_image_mt((char *)alpha, false, width, height, new_width, new_height, threads);
+    }
+    if (scaled_colors && scaled_alpha) scaled = malloc((size_t)new_width * new_height * 4);
+    if (scaled) {
+        const uint8_t *c = (const uint8_t *)scaled_colors, *a = (const uint8_t *)scaled_alpha;
+        for (size_t i = 0; i < (size_t)new_width * new_height; i++, c += 3, a += 3) {
+            scaled[i] = (uint32_t)a[0] << 24 | (uint32_t)c[0] << 16 | (uint32_t)c[1] << 8 | c[2];
+        }
+    }
+    free(scaled_alpha);
+    free(scaled_colors);
+    free(alpha);
+    free(colors);
+    return scaled;
+}
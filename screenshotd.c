@@ -3,34 +3,286 @@
 #include <linux/fb.h>
 #include <linux/input-event-codes.h>
 #include <linux/input.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "include/blit.h"
+#include "include/fb_device.h"
+#include "include/fbseq.h"
+
+// Raw frames that can wait for the worker at once. Further keypresses block
+// until a frame has been written, recorded frames are dropped instead.
+#define CAPTURE_BUFFERS 4
+// Recording rate when recording is toggled without --record
+#define DEFAULT_RECORD_FPS 10
+
+struct capture {
+    char *pixels; // Framebuffer rows in the framebuffer layout, packed
+    time_t time;
+    int sequence; // Counts captures within the same second
+    int recording; // Recording the frame belongs to, 0 for screenshots
+    uint64_t timestamp; // Microseconds since the start of the recording
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // A capture was queued or the queue is closing
+    pthread_cond_t returned; // A buffer was handed back
+    struct capture captures[CAPTURE_BUFFERS];
+    int free_list[CAPTURE_BUFFERS];
+    int free_count;
+    int queue[CAPTURE_BUFFERS]; // Ring of captures waiting for the worker
+    int head, count;
+    bool closing;
+} queue = {.lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER, .returned = PTHREAD_COND_INITIALIZER};
+
+static struct fb_device fb;
+static struct fb_var_screeninfo vinfo;
+static struct fb_fix_screeninfo finfo;
+static char *fb_ptr;
+static size_t row_size;
+static struct blitter blitter;
+static uint32_t flags = 0;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    bool active;
+    bool quit;
+    int id; // Incremented for every new recording
+    int fps;
+} recorder = {.lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER, .fps = DEFAULT_RECORD_FPS};
+
+// Recording the worker is appending to
+static struct {
+    int id;
+    FILE *file;
+    struct fbseq_writer writer;
+    int format; // Stored format, RGB888 if the layout has no .fbimg format
+    char *converted;
+} output_seq;
+
+// Converts one raw frame to RGB888 and writes it out
+static void save_capture(const struct capture *c, char *rgb_row) {
+    char output_file[256];
+    if (c->sequence == 0) {
+        snprintf(output_file, sizeof(output_file), "/tmp/screenshot_%ld.fbimg", (long)c->time);
+    } else {
+        snprintf(output_file, sizeof(output_file), "/tmp/screenshot_%ld_%d.fbimg", (long)c->time, c->sequence);
+    }
+    FILE *output = fopen(output_file, "wb");
+    if (!output) return;
+    struct fbimg_writer writer;
+    if (fbimg_writer_open(&writer, output, vinfo.xres, vinfo.yres, FBIMG_FORMAT_RGB888, vinfo.xres * 3, flags) == 0) {
+        for (uint32_t y = 0; y < vinfo.yres; y++) {
+            blit_read_image(&blitter, c->pixels, row_size, 0, y, rgb_row, (size_t)vinfo.xres * 3, vinfo.xres, 1);
+            if (fbimg_writer_row(&writer, rgb_row) != 0) break;
+        }
+    }
+    fbimg_writer_free(&writer);
+    fclose(output);
+}
+
+static void close_recording(void) {
+    if (!output_seq.file) return;
+    fbseq_writer_free(&output_seq.writer);
+    fclose(output_seq.file);
+    output_seq.file = NULL;
+}
+
+// Appends the tiles of a recorded frame that changed since the last one
+static void record_capture(const struct capture *c) {
+    if (c->recording != output_seq.id) {
+        close_recording();
+        output_seq.id = c->recording;
+        char output_file[256];
+        snprintf(output_file, sizeof(output_file), "/tmp/recording_%ld.fbseq", (long)c->time);
+        output_seq.file = fopen(output_file, "wb");
+        if (!output_seq.file) return;
+        int64_t start_time = (int64_t)c->time * 1000000;
+        if (fbseq_writer_open(&output_seq.writer, output_seq.file, vinfo.xres, vinfo.yres, output_seq.format, start_time) != 0) {
+            close_recording();
+            return;
+        }
+    }
+    if (!output_seq.file) return;
+
+    const char *frame = c->pixels;
+    if (output_seq.converted) {
+        blit_read_image(&blitter, c->pixels, row_size, 0, 0, output_seq.converted, (size_t)vinfo.xres * 3, vinfo.xres, vinfo.yres);
+        frame = output_seq.converted;
+    }
+    if (fbseq_write_frame(&output_seq.writer, frame, c->timestamp) != 0) close_recording();
+}
+
+static void *capture_worker(void *arg) {
+    char *rgb_row = arg;
+    pthread_mutex_lock(&queue.lock);
+    for (;;) {
+        while (queue.count == 0 && !queue.closing) pthread_cond_wait(&queue.ready, &queue.lock);
+        if (queue.count == 0) break;
+        int index = queue.queue[queue.head];
+        queue.head = (queue.head + 1) % CAPTURE_BUFFERS;
+        queue.count--;
+        pthread_mutex_unlock(&queue.lock);
+
+        if (queue.captures[index].recording) {
+            record_capture(&queue.captures[index]);
+        } else {
+            save_capture(&queue.captures[index], rgb_row);
+        }
+
+        pthread_mutex_lock(&queue.lock);
+        queue.free_list[queue.free_count++] = index;
+        pthread_cond_signal(&queue.returned);
+    }
+    pthread_mutex_unlock(&queue.lock);
+    close_recording();
+    return NULL;
+}
+
+// Copies the current frame into a free buffer and queues it for the worker.
+// Screenshots wait for a buffer, recorded frames are dropped if there is
+// none. Returns false if the frame was dropped.
+static bool capture(int recording, uint64_t timestamp) {
+    static time_t last_time;
+    static int sequence;
+
+    pthread_mutex_lock(&queue.lock);
+    while (queue.free_count == 0 && !recording) pthread_cond_wait(&queue.returned, &queue.lock);
+    if (queue.free_count == 0) {
+        pthread_mutex_unlock(&queue.lock);
+        return false;
+    }
+    int index = queue.free_list[--queue.free_count];
+    // Double-buffered programs pan between screens, so look up the shown one
+    const char *src = fb_device_visible(&fb);
+    pthread_mutex_unlock(&queue.lock);
+
+    struct capture *c = &queue.captures[index];
+    if (row_size == finfo.line_length) {
+        memcpy(c->pixels, src, row_size * vinfo.yres);
+    } else {
+        for (uint32_t y = 0; y < vinfo.yres; y++) memcpy(c->pixels + y * row_size, src + y * finfo.line_length, row_size);
+    }
+    c->time = time(NULL);
+    c->recording = recording;
+    c->timestamp = timestamp;
+    if (!recording) {
+        sequence = (c->time == last_time) ? sequence + 1 : 0;
+        last_time = c->time;
+        c->sequence = sequence;
+    }
+
+    pthread_mutex_lock(&queue.lock);
+    queue.queue[(queue.head + queue.count) % CAPTURE_BUFFERS] = index;
+    queue.count++;
+    pthread_cond_signal(&queue.ready);
+    pthread_mutex_unlock(&queue.lock);
+    return true;
+}
+
+static uint64_t elapsed_us(const struct timespec *start, const struct timespec *now) {
+    return (uint64_t)(now->tv_sec - start->tv_sec) * 1000000 + (now->tv_nsec - start->tv_nsec) / 1000;
+}
+
+// Samples the framebuffer at a fixed rate while recording is active
+static void *record_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&recorder.lock);
+    for (;;) {
+        while (!recorder.active && !recorder.quit) pthread_cond_wait(&recorder.changed, &recorder.lock);
+        if (recorder.quit) break;
+        int id = recorder.id;
+        long period = 1000000000L / recorder.fps;
+        pthread_mutex_unlock(&recorder.lock);
+
+        struct timespec start, next, now;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        next = start;
+        for (;;) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            capture(id, elapsed_us(&start, &now));
+
+            // Skip the ticks that were missed instead of catching up
+            do {
+                next.tv_nsec += period;
+                while (next.tv_nsec >= 1000000000L) {
+                    next.tv_nsec -= 1000000000L;
+                    next.tv_sec++;
+                }
+            } while (next.tv_sec < now.tv_sec || (next.tv_sec == now.tv_sec && next.tv_nsec <= now.tv_nsec));
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0) {
+            }
+
+            pthread_mutex_lock(&recorder.lock);
+            bool stop = !recorder.active || recorder.id != id;
+            pthread_mutex_unlock(&recorder.lock);
+            if (stop) break;
+        }
+        pthread_mutex_lock(&recorder.lock);
+    }
+    pthread_mutex_unlock(&recorder.lock);
+    return NULL;
+}
+
+static void toggle_recording(void) {
+    pthread_mutex_lock(&recorder.lock);
+    recorder.active = !recorder.active;
+    if (recorder.active) recorder.id++;
+    pthread_cond_signal(&recorder.changed);
+    pthread_mutex_unlock(&recorder.lock);
+}
+
 int main(int argc, char *argv[]) {
     static struct option long_options[] = {
         {"help", no_argument, NULL, 'h'},
         {"usage", no_argument, NULL, 'u'},
+        {"compress", no_argument, NULL, 'z'},
+        {"record", required_argument, NULL, 'r'},
+        {"fb", required_argument, NULL, 'f'},
         {NULL, 0, NULL, 0}};
+    bool record = false;
+    const char *fb_path = NULL;
     int opt;
-    while ((opt = getopt_long(argc, argv, "hu", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "huzr:f:", long_options, NULL)) != -1) {
         switch (opt) {
             case 'h':
                 printf("Usage: %s [options] /dev/input/(keyboard_device_node)\n", argv[0]);
                 printf("Options:\n");
                 printf("  -h, --help     Show this help message\n");
                 printf("  -u, --usage    Show usage information\n");
+                printf("  -z, --compress Run-length encode the screenshots\n");
+                printf("  -r, --record   Start recording right away at the given frames per second\n");
+                printf("  -f, --fb       Framebuffer device or virtual framebuffer file\n");
+                printf("                 (default: $%s or %s)\n", FB_DEVICE_ENV, FB_DEVICE_DEFAULT);
                 return 0;
             case 'u':
                 printf("This program captures screenshots when the Print Screen or F5 key is pressed.\n");
+                printf("F6 starts and stops recording the framebuffer to /tmp/recording_*.fbseq.\n");
                 return 0;
+            case 'r':
+                recorder.fps = atoi(optarg);
+                if (recorder.fps <= 0 || recorder.fps > 1000) {
+                    fprintf(stderr, "Invalid frame rate: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                record = true;
+                break;
+            case 'f':
+                fb_path = optarg;
+                break;
+            case 'z':
+                flags |= FBIMG_FLAG_RLE;
+                break;
             default:
                 fprintf(stderr, "Usage: %s /dev/input/(keyboard_device_node)\n", argv[0]);
                 exit(EXIT_FAILURE);
@@ -40,6 +292,44 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Usage: %s /dev/input/(keyboard_device_node)\n", argv[0]);
         exit(EXIT_FAILURE);
     }
+
+    // Map the framebuffer once, the mapping survives the forks below
+    if (fb_device_open(&fb, fb_device_path(fb_path), false) == -1) {
+        perror("Error opening framebuffer device");
+        exit(EXIT_FAILURE);
+    }
+    vinfo = fb.vinfo;
+    finfo = fb.finfo;
+    if (blit_init(&blitter, &vinfo, FBIMG_FORMAT_RGB888) != 0) {
+        fprintf(stderr, "Error: framebuffer pixel format not supported\n");
+        exit(EXIT_FAILURE);
+    }
+    if (fb_device_map(&fb) == -1) {
+        perror("Error mapping framebuffer memory");
+        exit(EXIT_FAILURE);
+    }
+    fb_ptr = fb.ptr;
+    row_size = (size_t)vinfo.xres * blitter.bytes_per_pixel;
+    for (int i = 0; i < CAPTURE_BUFFERS; i++) {
+        queue.captures[i].pixels = malloc(row_size * vinfo.yres);
+        if (!queue.captures[i].pixels) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        queue.free_list[queue.free_count++] = i;
+    }
+    // Recordings keep the framebuffer layout when a .fbimg format matches it
+    output_seq.format = fb_layout_format(blitter.layout);
+    if (output_seq.format < 0) {
+        output_seq.format = FBIMG_FORMAT_RGB888;
+        output_seq.converted = malloc((size_t)vinfo.xres * vinfo.yres * 3);
+    }
+    char *rgb_row = malloc((size_t)vinfo.xres * 3);
+    if (!rgb_row || (fb_layout_format(blitter.layout) < 0 && !output_seq.converted)) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
     pid_t pid = fork();
     if (pid < 0) {
         perror("fork failed");
@@ -84,69 +374,39 @@ int main(int argc, char *argv[]) {
     dup2(fd, STDERR_FILENO);
     close(fd);
 
+    // Threads don't survive fork(), so the worker starts in the daemon
+    pthread_t worker, recording_thread;
+    if (pthread_create(&worker, NULL, capture_worker, rgb_row) != 0) exit(EXIT_FAILURE);
+    if (pthread_create(&recording_thread, NULL, record_thread, NULL) != 0) exit(EXIT_FAILURE);
+    if (record) toggle_recording();
+
     const char *device = argv[optind];
     fd = open(device, O_RDONLY);
     struct input_event ev;
     while (read(fd, &ev, sizeof(ev)) > 0) {
         if (ev.type == EV_KEY && ev.value == 1) { // Key press event
-            if (ev.code == KEY_PRINT || ev.code == KEY_F5) {
-                int fb_fd = open("/dev/fb0", O_RDONLY);
-                struct fb_var_screeninfo vinfo;
-                if (ioctl(fb_fd, FBIOGET_VSCREENINFO, &vinfo) == -1) {
-                    close(fb_fd);
-                    return 1;
-                }
-                struct fb_fix_screeninfo finfo;
-                if (ioctl(fb_fd, FBIOGET_FSCREENINFO, &finfo) == -1) {
-                    close(fb_fd);
-                    return 1;
-                }
-                char *header = (char *)malloc(16);
-                strncpy(header, "FBIMG", 5);
-                memcpy(header + 5, &vinfo.xres, sizeof(uint32_t));
-                memcpy(header + 9, &vinfo.yres, sizeof(uint32_t));
-                strncpy(header + 13, "RGB", 3);
-                char *image = (char *)malloc(vinfo.xres * vinfo.yres * 3);
-                char *fb_ptr = (char *)mmap(NULL, finfo.smem_len, PROT_READ, MAP_SHARED, fb_fd, 0);
-                if (fb_ptr == MAP_FAILED) {
-                    close(fb_fd);
-                    free(header);
-                    free(image);
-                    return 1;
-                }
-                for (int i = 0; i < vinfo.yres; i++) {
-                    for (int v = 0; v < vinfo.xres; v++) {
-                        int px = (i * finfo.line_length) + v * (vinfo.bits_per_pixel / 8);
-                        unsigned char r, g, b;
-                        r = fb_ptr[px + (vinfo.red.offset / 8)];
-                        g = fb_ptr[px + (vinfo.green.offset / 8)];
-                        b = fb_ptr[px + (vinfo.blue.offset / 8)];
-                        image[(i * vinfo.xres + v) * 3] = r;
-                        image[(i * vinfo.xres + v) * 3 + 1] = g;
-                        image[(i * vinfo.xres + v) * 3 + 2] = b;
-                    }
-                }
-                char output_file[256];
-                snprintf(output_file, sizeof(output_file), "/tmp/screenshot_%ld.fbimg", time(NULL));
-                FILE *output = fopen(output_file, "wb");
-                if (!output) {
-                    munmap(fb_ptr, finfo.smem_len);
-                    free(header);
-                    free(image);
-                    close(fb_fd);
-                    return 1;
-                }
-                fwrite(header, 1, 16, output);
-                fwrite(image, 1, vinfo.xres * vinfo.yres * 3, output);
-                fclose(output);
-                close(fb_fd);
-                munmap(fb_ptr, finfo.smem_len);
-                free(header);
-                free(image);
-            }
+            if (ev.code == KEY_PRINT || ev.code == KEY_F5) capture(0, 0);
+            if (ev.code == KEY_F6) toggle_recording();
         }
     }
 
+    // Stop recording and let the worker finish the captures that are still queued
+    pthread_mutex_lock(&recorder.lock);
+    recorder.active = false;
+    recorder.quit = true;
+    pthread_cond_signal(&recorder.changed);
+    pthread_mutex_unlock(&recorder.lock);
+    pthread_join(recording_thread, NULL);
+    pthread_mutex_lock(&queue.lock);
+    queue.closing = true;
+    pthread_cond_signal(&queue.ready);
+    pthread_mutex_unlock(&queue.lock);
+    pthread_join(worker, NULL);
+
     close(fd);
+    fb_device_close(&fb);
+    for (int i = 0; i < CAPTURE_BUFFERS; i++) free(queue.captures[i].pixels);
+    free(output_seq.converted);
+    free(rgb_row);
     return 0;
 }